@@ -0,0 +1,116 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "trace.h"
+#include "energy.h"
+#include "results.h"
+#include "topology.h"
+
+/*
+ * Measure the idle power of each energy domain by sleeping for the
+ * specified duration. The resulting power, in uJ/usec (aka Watts), is
+ * stored in the baseline of the energy structure and used to compute
+ * the idle part of the energy consumed by a benchmark.
+ */
+int baseline_calibrate(struct energy *energy, unsigned int msecs)
+{
+	struct timeval begin, end;
+	struct timespec ts = {
+		.tv_sec = msecs / 1000,
+		.tv_nsec = (msecs % 1000) * 1000000,
+	};
+	struct energy *before, *after;
+	double duration;
+
+	if (!energy->handle || !msecs)
+		return 0;
+
+	before = energy_clone(energy);
+	after = energy_clone(energy);
+
+	NOTICE("Calibrating idle power for %u msecs\n", msecs);
+
+	gettimeofday(&begin, NULL);
+
+	if (energy_read(before))
+		goto out_err;
+
+	while (nanosleep(&ts, &ts))
+		;
+
+	if (energy_read(after))
+		goto out_err;
+
+	gettimeofday(&end, NULL);
+
+	duration = (end.tv_sec - begin.tv_sec) * 1000000;
+	duration += (end.tv_usec - begin.tv_usec);
+
+	energy_delta(before, after, after);
+	energy_scale(after, 1 / duration);
+
+	energy_free(before);
+
+	if (energy->baseline)
+		energy_free(energy->baseline);
+	energy->baseline = after;
+
+	NOTICE("Idle power: %lf W\n", energy_cost(after));
+
+	return 0;
+
+out_err:
+	ERROR("Failed to read sensor energy for calibration\n");
+	energy_free(before);
+	energy_free(after);
+	return -1;
+}
+
+double baseline_energy(struct energy *energy, double duration)
+{
+	if (!energy || !energy->baseline)
+		return 0;
+
+	return energy_cost(energy->baseline) * duration;
+}
+
+void baseline_save(struct ts_results *tsr, struct energy *energy)
+{
+	struct energy *baseline = energy ? energy->baseline : NULL;
+	int i;
+
+	if (!baseline)
+		return;
+
+	for (i = 0; i < baseline->topology->nrpackages; i++) {
+		char key[64];
+
+		if (baseline->flags & ENERGY_PKG_SUPPORTED) {
+			snprintf(key, sizeof(key), "baseline.pkg%d", i);
+			results_set_attr(tsr, key, "%lf W", baseline->pkg[i].pkg);
+		}
+
+		if (baseline->flags & ENERGY_CORE_SUPPORTED) {
+			snprintf(key, sizeof(key), "baseline.core%d", i);
+			results_set_attr(tsr, key, "%lf W", baseline->pkg[i].core);
+		}
+
+		if (baseline->flags & ENERGY_NONCORE_SUPPORTED) {
+			snprintf(key, sizeof(key), "baseline.noncore%d", i);
+			results_set_attr(tsr, key, "%lf W", baseline->pkg[i].noncore);
+		}
+	}
+
+	if (baseline->flags & ENERGY_DRAM_SUPPORTED)
+		results_set_attr(tsr, "baseline.dram", "%lf W", baseline->sys.dram);
+
+	if (baseline->flags & ENERGY_GPU_SUPPORTED)
+		results_set_attr(tsr, "baseline.gpu", "%lf W", baseline->sys.gpu);
+
+	if (baseline->flags & ENERGY_BOARD_SUPPORTED)
+		results_set_attr(tsr, "baseline.board", "%lf W", baseline->sys.board);
+
+	results_set_attr(tsr, "baseline.total", "%lf W", energy_cost(baseline));
+}
@@ -0,0 +1,13 @@
+#ifndef __TS_BASELINE_H
+#define __TS_BASELINE_H
+
+struct energy;
+struct ts_results;
+
+extern int baseline_calibrate(struct energy *energy, unsigned int msecs);
+
+extern double baseline_energy(struct energy *energy, double duration);
+
+extern void baseline_save(struct ts_results *tsr, struct energy *energy);
+
+#endif
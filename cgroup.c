@@ -0,0 +1,551 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "stats.h"
+#include "cgroup.h"
+#include "topology.h"
+#include "timeline.h"
+
+/*
+ * The scripts are run in a dedicated cgroup v2 group, created for each
+ * run below a "ts.<pid>" group in the harness cgroup, so the cpu, the
+ * memory, the io and the pressure of all their processes are accounted
+ * and the processes left behind are killed at the end of the run. The
+ * group can be restricted to a cpuset, "package<N>" for the cpus of a
+ * package or a cpu list, and to a maximum memory.
+ *
+ * When cgroup v2 is not mounted or not writable, the resources are the
+ * ones returned by wait4(), which only covers the waited processes.
+ *
+ * The cgroup v2 root can be changed with the TS_CGROUP_ROOT environment
+ * variable, "/sys/fs/cgroup" or "/sys/fs/cgroup/unified" by default.
+ */
+#define CGROUP_ROOT        "/sys/fs/cgroup"
+#define CGROUP_ROOT_HYBRID "/sys/fs/cgroup/unified"
+#define CGROUP_KILL_WAIT   1000 /* msecs for the killed processes to exit */
+
+static char *cgroup_base;   /* the ts.<pid> group */
+static char *cgroup_run;    /* the group of the current run */
+static char *cgroup_cpuset;
+static const char *cgroup_memory_max;
+static int cgroup_created;  /* the run group exists */
+static int cgroup_attached; /* the script is in the run group */
+
+static int cgroup_write(const char *dir, const char *file, const char *fmt, ...)
+{
+	char *path;
+	va_list ap;
+	int fd, ret;
+
+	if (asprintf(&path, "%s/%s", dir, file) < 0)
+		FATAL("Failed to allocate memory for the cgroup path\n");
+
+	fd = open(path, O_WRONLY);
+	free(path);
+	if (fd < 0)
+		return -1;
+
+	va_start(ap, fmt);
+	ret = vdprintf(fd, fmt, ap);
+	va_end(ap);
+
+	if (close(fd))
+		ret = -1;
+
+	return ret < 0 ? -1 : 0;
+}
+
+static FILE *cgroup_open(const char *dir, const char *file)
+{
+	char *path;
+	FILE *f;
+
+	if (asprintf(&path, "%s/%s", dir, file) < 0)
+		FATAL("Failed to allocate memory for the cgroup path\n");
+
+	f = fopen(path, "r");
+
+	free(path);
+
+	return f;
+}
+
+/*
+ * The value of a "key value" line, as in cpu.stat
+ */
+static double cgroup_read_key(const char *dir, const char *file, const char *key)
+{
+	unsigned long long value;
+	char name[64];
+	double ret = 0;
+	FILE *f;
+
+	f = cgroup_open(dir, file);
+	if (!f)
+		return 0;
+
+	while (fscanf(f, "%63s %llu", name, &value) == 2) {
+		if (!strcmp(name, key)) {
+			ret = value;
+			break;
+		}
+	}
+
+	fclose(f);
+
+	return ret;
+}
+
+static double cgroup_read_value(const char *dir, const char *file)
+{
+	unsigned long long value;
+	double ret = 0;
+	FILE *f;
+
+	f = cgroup_open(dir, file);
+	if (!f)
+		return 0;
+
+	if (fscanf(f, "%llu", &value) == 1)
+		ret = value;
+
+	fclose(f);
+
+	return ret;
+}
+
+/*
+ * The "some" stall total in usecs of a PSI file
+ */
+static double cgroup_read_pressure(const char *dir, const char *file)
+{
+	unsigned long long total;
+	char *line = NULL, *ptr;
+	double ret = 0;
+	size_t len = 0;
+	FILE *f;
+
+	f = cgroup_open(dir, file);
+	if (!f)
+		return 0;
+
+	while (getline(&line, &len, f) > 0) {
+		if (strncmp(line, "some ", 5))
+			continue;
+		ptr = strstr(line, "total=");
+		if (ptr && sscanf(ptr, "total=%llu", &total) == 1)
+			ret = total;
+		break;
+	}
+
+	free(line);
+	fclose(f);
+
+	return ret;
+}
+
+/*
+ * Sum the bytes read and written of all the devices in io.stat
+ */
+static void cgroup_read_io(const char *dir, struct cgroup_stat *stat)
+{
+	unsigned long long value;
+	char token[64];
+	FILE *f;
+
+	f = cgroup_open(dir, "io.stat");
+	if (!f)
+		return;
+
+	while (fscanf(f, "%63s", token) == 1) {
+		if (sscanf(token, "rbytes=%llu", &value) == 1)
+			stat->rbytes += value;
+		else if (sscanf(token, "wbytes=%llu", &value) == 1)
+			stat->wbytes += value;
+	}
+
+	fclose(f);
+}
+
+static int cgroup_has_controller(const char *controller)
+{
+	char name[32];
+	int ret = 0;
+	FILE *f;
+
+	f = cgroup_open(cgroup_base, "cgroup.subtree_control");
+	if (!f)
+		return 0;
+
+	while (fscanf(f, "%31s", name) == 1) {
+		if (!strcmp(name, controller)) {
+			ret = 1;
+			break;
+		}
+	}
+
+	fclose(f);
+
+	return ret;
+}
+
+/*
+ * The cgroup v2 path of the harness, from the "0::" line
+ */
+static char *cgroup_self(void)
+{
+	char *line = NULL, *path = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/cgroup", "r");
+	if (!f)
+		return NULL;
+
+	while (getline(&line, &len, f) > 0) {
+		if (strncmp(line, "0::", 3))
+			continue;
+		line[strcspn(line, "\n")] = '\0';
+		path = strdup(line + 3);
+		break;
+	}
+
+	free(line);
+	fclose(f);
+
+	return path;
+}
+
+static const char *cgroup_root(void)
+{
+	const char *root = getenv("TS_CGROUP_ROOT");
+	struct stat st;
+
+	if (root)
+		return root;
+
+	if (!stat(CGROUP_ROOT "/cgroup.controllers", &st))
+		return CGROUP_ROOT;
+
+	if (!stat(CGROUP_ROOT_HYBRID "/cgroup.controllers", &st))
+		return CGROUP_ROOT_HYBRID;
+
+	return NULL;
+}
+
+/*
+ * The cpu list of "package<N>", or the cpuset as is
+ */
+static char *cgroup_build_cpuset(struct topology *topology, const char *cpuset)
+{
+	struct package *package;
+	char *list = NULL, *tmp;
+	int i, j, k, id;
+
+	if (sscanf(cpuset, "package%d", &id) != 1)
+		return strdup(cpuset);
+
+	if (id < 0 || id >= topology->nrpackages) {
+		ERROR("No package %d for the cpuset\n", id);
+		return NULL;
+	}
+
+	package = &topology->package[id];
+
+	for (i = 0; i < package->nrcores; i++) {
+		struct core *core = &package->core[i];
+
+		for (j = 0; j < (core->nrthreads ? core->nrthreads : 1); j++) {
+			k = core->nrthreads ? core->thread[j].os_id : core->os_id;
+			if (asprintf(&tmp, "%s%s%d", list ? list : "",
+				     list ? "," : "", k) < 0)
+				FATAL("Failed to allocate memory for the cpuset\n");
+			free(list);
+			list = tmp;
+		}
+	}
+
+	return list;
+}
+
+int cgroup_init(struct topology *topology, const char *cpuset,
+		const char *memory_max)
+{
+	const char *controllers[] = { "cpu", "memory", "io", "cpuset", NULL };
+	const char *root;
+	char *self, *parent;
+	int i, ret = 0;
+
+	timeline_begin("cgroup_init", NULL);
+
+	if (cpuset) {
+		cgroup_cpuset = cgroup_build_cpuset(topology, cpuset);
+		if (!cgroup_cpuset) {
+			ret = -1;
+			goto out;
+		}
+	}
+
+	cgroup_memory_max = memory_max;
+
+	root = cgroup_root();
+	self = cgroup_self();
+	if (!root || !self) {
+		DEBUG("No cgroup v2, the scripts are accounted with wait4\n");
+		free(self);
+		goto out_fallback;
+	}
+
+	if (asprintf(&parent, "%s%s", root, strcmp(self, "/") ? self : "") < 0 ||
+	    asprintf(&cgroup_base, "%s/ts.%d", parent, getpid()) < 0 ||
+	    asprintf(&cgroup_run, "%s/run", cgroup_base) < 0)
+		FATAL("Failed to allocate memory for the cgroup path\n");
+
+	free(self);
+
+	if (mkdir(cgroup_base, 0755)) {
+		DEBUG("Failed to create '%s': %m, the scripts are accounted "
+		      "with wait4\n", cgroup_base);
+		free(parent);
+		free(cgroup_base);
+		free(cgroup_run);
+		cgroup_base = cgroup_run = NULL;
+		goto out_fallback;
+	}
+
+	/*
+	 * The controllers may only be delegated by the parent when it has
+	 * no process, that is when the harness is in the root group
+	 */
+	for (i = 0; controllers[i]; i++) {
+		cgroup_write(parent, "cgroup.subtree_control", "+%s",
+			     controllers[i]);
+		cgroup_write(cgroup_base, "cgroup.subtree_control", "+%s",
+			     controllers[i]);
+	}
+
+	free(parent);
+
+	if (cgroup_cpuset && !cgroup_has_controller("cpuset"))
+		WARNING("No cpuset controller in '%s', the cpuset is ignored\n",
+			cgroup_base);
+
+	if (cgroup_memory_max && !cgroup_has_controller("memory"))
+		WARNING("No memory controller in '%s', the memory limit is "
+			"ignored\n", cgroup_base);
+
+	DEBUG("Scripts run in '%s'\n", cgroup_run);
+
+	goto out;
+
+out_fallback:
+	if (cgroup_cpuset || cgroup_memory_max)
+		WARNING("No cgroup v2, the cpuset and the memory limit are "
+			"ignored\n");
+out:
+	timeline_end("cgroup_init");
+
+	return ret;
+}
+
+/*
+ * Create the group of the next run, before forking the script
+ */
+void cgroup_begin(void)
+{
+	cgroup_created = cgroup_attached = 0;
+
+	if (!cgroup_run)
+		return;
+
+	if (mkdir(cgroup_run, 0755)) {
+		WARNING("Failed to create '%s': %m\n", cgroup_run);
+		return;
+	}
+
+	cgroup_created = 1;
+
+	if (cgroup_cpuset && cgroup_has_controller("cpuset") &&
+	    cgroup_write(cgroup_run, "cpuset.cpus", "%s", cgroup_cpuset))
+		WARNING("Failed to set the cpuset '%s': %m\n", cgroup_cpuset);
+
+	if (cgroup_memory_max && cgroup_has_controller("memory") &&
+	    cgroup_write(cgroup_run, "memory.max", "%s", cgroup_memory_max))
+		WARNING("Failed to set the memory limit '%s': %m\n",
+			cgroup_memory_max);
+}
+
+/*
+ * Move the script into the group, before it is allowed to execute
+ */
+int cgroup_attach(pid_t pid)
+{
+	if (!cgroup_created)
+		return -1;
+
+	if (cgroup_write(cgroup_run, "cgroup.procs", "%d", pid)) {
+		WARNING("Failed to move %d into '%s': %m\n", pid, cgroup_run);
+		return -1;
+	}
+
+	cgroup_attached = 1;
+
+	return 0;
+}
+
+/*
+ * The processes in the group of the current run, including the ones
+ * left behind by the script, NULL if the script is not in a group
+ */
+pid_t *cgroup_procs(int *nr)
+{
+	pid_t *pids = NULL;
+	int pid;
+	FILE *f;
+
+	*nr = 0;
+
+	if (!cgroup_attached)
+		return NULL;
+
+	f = cgroup_open(cgroup_run, "cgroup.procs");
+	if (!f)
+		return NULL;
+
+	while (fscanf(f, "%d", &pid) == 1) {
+		pids = realloc(pids, sizeof(*pids) * (*nr + 1));
+		if (!pids)
+			FATAL("Failed to allocate memory for the cgroup processes\n");
+		pids[(*nr)++] = pid;
+	}
+
+	fclose(f);
+
+	return pids;
+}
+
+static int cgroup_populated(void)
+{
+	return cgroup_read_key(cgroup_run, "cgroup.events", "populated") != 0;
+}
+
+/*
+ * Kill the processes left behind by the script, with cgroup.kill when
+ * the kernel has it
+ */
+static void cgroup_kill(void)
+{
+	struct timespec ts = { .tv_nsec = 10000000 };
+	int pid, nr = 0, waited;
+	FILE *f;
+
+	if (!cgroup_populated())
+		return;
+
+	f = cgroup_open(cgroup_run, "cgroup.procs");
+	if (f) {
+		while (fscanf(f, "%d", &pid) == 1) {
+			nr++;
+			kill(pid, SIGKILL);
+		}
+		fclose(f);
+	}
+
+	cgroup_write(cgroup_run, "cgroup.kill", "1");
+
+	WARNING("Killed %d processes left by the script\n", nr);
+
+	for (waited = 0; waited < CGROUP_KILL_WAIT && cgroup_populated();
+	     waited += 10)
+		nanosleep(&ts, NULL);
+}
+
+static void cgroup_stat_rusage(const struct rusage *rusage,
+			       struct cgroup_stat *stat)
+{
+	stat->user = rusage->ru_utime.tv_sec * 1000000.0 + rusage->ru_utime.tv_usec;
+	stat->system = rusage->ru_stime.tv_sec * 1000000.0 + rusage->ru_stime.tv_usec;
+	stat->memory = rusage->ru_maxrss * 1024.0;
+	stat->rbytes = rusage->ru_inblock * 512.0;
+	stat->wbytes = rusage->ru_oublock * 512.0;
+	stat->wait4 = 1;
+}
+
+/*
+ * Collect the resources of the run, the rusage of the waited script
+ * being the fallback, and remove the group
+ */
+void cgroup_end(const struct rusage *rusage, struct cgroup_stat *stat)
+{
+	memset(stat, 0, sizeof(*stat));
+
+	if (!cgroup_attached)
+		cgroup_stat_rusage(rusage, stat);
+
+	if (!cgroup_created)
+		return;
+
+	cgroup_kill();
+
+	if (cgroup_attached) {
+		stat->user = cgroup_read_key(cgroup_run, "cpu.stat", "user_usec");
+		stat->system = cgroup_read_key(cgroup_run, "cpu.stat", "system_usec");
+		/* The controllers which could not be enabled are not reported */
+		if (cgroup_has_controller("memory"))
+			stat->memory = cgroup_read_value(cgroup_run, "memory.peak");
+		else
+			stat->missing |= CGROUP_NO_MEMORY;
+		if (cgroup_has_controller("io"))
+			cgroup_read_io(cgroup_run, stat);
+		else
+			stat->missing |= CGROUP_NO_IO;
+		stat->cpu_some = cgroup_read_pressure(cgroup_run, "cpu.pressure");
+		stat->memory_some = cgroup_read_pressure(cgroup_run, "memory.pressure");
+		stat->io_some = cgroup_read_pressure(cgroup_run, "io.pressure");
+	}
+
+	if (rmdir(cgroup_run))
+		WARNING("Failed to remove '%s': %m\n", cgroup_run);
+
+	cgroup_created = cgroup_attached = 0;
+}
+
+/*
+ * Average stat in avg, where nr is the number of runs averaged
+ * including this one
+ */
+void cgroup_average(struct cgroup_stat *avg, const struct cgroup_stat *stat,
+		    int nr)
+{
+	avg->user = avg(avg->user, stat->user, nr);
+	avg->system = avg(avg->system, stat->system, nr);
+	avg->memory = avg(avg->memory, stat->memory, nr);
+	avg->rbytes = avg(avg->rbytes, stat->rbytes, nr);
+	avg->wbytes = avg(avg->wbytes, stat->wbytes, nr);
+	avg->cpu_some = avg(avg->cpu_some, stat->cpu_some, nr);
+	avg->memory_some = avg(avg->memory_some, stat->memory_some, nr);
+	avg->io_some = avg(avg->io_some, stat->io_some, nr);
+	avg->wait4 |= stat->wait4;
+	avg->missing |= stat->missing;
+}
+
+void cgroup_fini(void)
+{
+	if (cgroup_base && rmdir(cgroup_base))
+		WARNING("Failed to remove '%s': %m\n", cgroup_base);
+
+	free(cgroup_base);
+	free(cgroup_run);
+	free(cgroup_cpuset);
+
+	cgroup_base = cgroup_run = cgroup_cpuset = NULL;
+}
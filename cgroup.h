@@ -0,0 +1,44 @@
+#ifndef __TS_CGROUP_H
+#define __TS_CGROUP_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+struct topology;
+
+#define CGROUP_NO_MEMORY 0x1 /* no memory controller, no peak memory */
+#define CGROUP_NO_IO     0x2 /* no io controller, no bytes read and written */
+
+/*
+ * Resources used by a script and all its processes during a run
+ */
+struct cgroup_stat {
+	double user;        /* usecs */
+	double system;      /* usecs */
+	double memory;      /* peak bytes */
+	double rbytes;      /* bytes read from the block devices */
+	double wbytes;      /* bytes written to the block devices */
+	double cpu_some;    /* usecs with some tasks waiting for a cpu */
+	double memory_some; /* usecs with some tasks stalled on the memory */
+	double io_some;     /* usecs with some tasks stalled on the io */
+	int wait4;          /* from wait4(), of the waited processes only */
+	int missing;        /* CGROUP_NO_* of the controllers not enabled */
+};
+
+extern int cgroup_init(struct topology *topology, const char *cpuset,
+		       const char *memory_max);
+
+extern void cgroup_begin(void);
+
+extern int cgroup_attach(pid_t pid);
+
+extern pid_t *cgroup_procs(int *nr);
+
+extern void cgroup_end(const struct rusage *rusage, struct cgroup_stat *stat);
+
+extern void cgroup_average(struct cgroup_stat *avg,
+			   const struct cgroup_stat *stat, int nr);
+
+extern void cgroup_fini(void);
+
+#endif
@@ -0,0 +1,404 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "trace.h"
+#include "daemon.h"
+#include "options.h"
+
+/*
+ * The daemon keeps the topology, the sensors, the calibrations and the
+ * loaded plugins between the requests of the clients, received on a
+ * UNIX socket and served one at a time.
+ *
+ * A client sends the number of its arguments, then its working
+ * directory and its arguments as strings prefixed by their size_t
+ * length. The daemon parses the arguments as its own command line, runs
+ * the request from the working directory of the client and streams the
+ * output back, followed by a NUL byte and the exit status.
+ *
+ * The options setting up the harness, as the calibration times, the
+ * noise threshold or the cgroup limits, are the ones of the daemon. The
+ * timeline is the one of the daemon, it can not be set by a request.
+ *
+ * A client stalled for DAEMON_TIMEOUT secs is dropped, so it does not
+ * block the other ones.
+ */
+#define DAEMON_MAXARGS 256
+#define DAEMON_MAXLEN  65536
+#define DAEMON_TIMEOUT 10 /* secs for a client to send or to read */
+
+static volatile sig_atomic_t daemon_stopped;
+
+static int daemon_read(int fd, void *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = read(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static int daemon_write(int fd, const void *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static int daemon_write_string(int fd, const char *str)
+{
+	size_t len = strlen(str);
+
+	if (daemon_write(fd, &len, sizeof(len)) ||
+	    daemon_write(fd, str, len))
+		return -1;
+
+	return 0;
+}
+
+static char *daemon_read_string(int fd)
+{
+	size_t len;
+	char *str;
+
+	if (daemon_read(fd, &len, sizeof(len)) || len > DAEMON_MAXLEN)
+		return NULL;
+
+	str = malloc(len + 1);
+	if (!str)
+		FATAL("Failed to allocate memory for the request\n");
+
+	if (daemon_read(fd, str, len)) {
+		free(str);
+		return NULL;
+	}
+
+	str[len] = '\0';
+
+	return str;
+}
+
+static int daemon_address(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		ERROR("Socket path '%s' is too long\n", path);
+		return -1;
+	}
+
+	strcpy(addr->sun_path, path);
+
+	return 0;
+}
+
+/*
+ * Run the request with the output redirected to the client, an invalid
+ * command line is reported to the client only
+ */
+static int daemon_request(int fd, int argc, char *argv[],
+			  daemon_request_t request)
+{
+	struct ts_options tso;
+	trace_level_t level = trace_level;
+	int out, err, ret = 1;
+
+	trace_flush();
+	fflush(stdout);
+	fflush(stderr);
+
+	out = dup(STDOUT_FILENO);
+	err = dup(STDERR_FILENO);
+	if (out < 0 || err < 0)
+		FATAL("Failed to save the daemon output\n");
+
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+
+	/* Start over the parsing of a new command line */
+	optind = 0;
+
+	if (ts_getoptions(argc, argv, &tso)) {
+		ERROR("Failed to parse options\n");
+		goto out;
+	}
+
+	if (tso.help) {
+		ts_usage(stdout);
+		ret = 0;
+		goto out;
+	}
+
+	if (tso.timeline) {
+		ERROR("The timeline is set when starting the daemon\n");
+		goto out;
+	}
+
+	if (tso.hwmon_root || tso.hwmon_map || tso.hwmon_period) {
+		ERROR("The sensor is set when starting the daemon\n");
+		goto out;
+	}
+
+	if (tso.daemon) {
+		ERROR("A request can not start a daemon\n");
+		goto out;
+	}
+
+	trace_set_level(tso.loglevel);
+
+	ret = request(&tso);
+
+	trace_set_level(level);
+out:
+	ts_options_free(&tso);
+
+	trace_flush();
+	fflush(stdout);
+	fflush(stderr);
+
+	dup2(out, STDOUT_FILENO);
+	dup2(err, STDERR_FILENO);
+	close(out);
+	close(err);
+
+	return ret;
+}
+
+static void daemon_handle(int fd, daemon_request_t request)
+{
+	char *cwd = NULL, *argv[DAEMON_MAXARGS + 1] = { NULL };
+	char saved[MAXPATHLEN];
+	struct timeval timeout = { .tv_sec = DAEMON_TIMEOUT };
+	struct ucred ucred;
+	socklen_t len = sizeof(ucred);
+	int i, argc;
+	char status[2] = { '\0', 1 };
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &ucred, &len) ||
+	    ucred.uid != geteuid()) {
+		WARNING("Request from another user rejected\n");
+		return;
+	}
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) ||
+	    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout))) {
+		WARNING("Failed to set the timeout of %d: %m\n", ucred.pid);
+		return;
+	}
+
+	if (daemon_read(fd, &argc, sizeof(argc)) ||
+	    argc < 1 || argc > DAEMON_MAXARGS) {
+		WARNING("Invalid request from %d\n", ucred.pid);
+		return;
+	}
+
+	cwd = daemon_read_string(fd);
+	for (i = 0; cwd && i < argc; i++) {
+		argv[i] = daemon_read_string(fd);
+		if (!argv[i])
+			break;
+	}
+
+	if (!cwd || i < argc) {
+		WARNING("Truncated request from %d\n", ucred.pid);
+		goto out;
+	}
+
+	if (!getcwd(saved, sizeof(saved)))
+		FATAL("Failed to get the daemon directory: %m\n");
+
+	if (chdir(cwd)) {
+		dprintf(fd, "ERROR: Failed to change to '%s': %m\n", cwd);
+		goto out_status;
+	}
+
+	DEBUG("Request from %d in '%s'\n", ucred.pid, cwd);
+
+	status[1] = daemon_request(fd, argc, argv, request);
+
+	if (chdir(saved))
+		FATAL("Failed to change back to '%s': %m\n", saved);
+
+	DEBUG("Request from %d done with %d\n", ucred.pid, status[1]);
+
+out_status:
+	daemon_write(fd, status, sizeof(status));
+out:
+	for (i = 0; i < argc && argv[i]; i++)
+		free(argv[i]);
+	free(cwd);
+}
+
+static void daemon_stop(int sig)
+{
+	daemon_stopped = 1;
+}
+
+/*
+ * Serve the requests of the clients on the socket path until SIGINT
+ * or SIGTERM
+ */
+int daemon_serve(const char *path, daemon_request_t request)
+{
+	struct sigaction sa = { .sa_handler = daemon_stop };
+	struct sockaddr_un addr;
+	int fd, client;
+
+	if (daemon_address(path, &addr))
+		return 1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		ERROR("Failed to create the daemon socket: %m\n");
+		return 1;
+	}
+
+	/* A socket left by a dead daemon refuses the connections */
+	if (!connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		ERROR("A daemon is already listening on '%s'\n", path);
+		close(fd);
+		return 1;
+	}
+
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    chmod(path, 0600) || listen(fd, 16)) {
+		ERROR("Failed to listen on '%s': %m\n", path);
+		close(fd);
+		return 1;
+	}
+
+	/* No SA_RESTART, accept() is interrupted by the signals */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	NOTICE("Listening on '%s'\n", path);
+
+	while (!daemon_stopped) {
+
+		client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+		if (client < 0) {
+			if (errno == EINTR)
+				continue;
+			ERROR("Failed to accept a client: %m\n");
+			break;
+		}
+
+		daemon_handle(client, request);
+
+		close(client);
+	}
+
+	close(fd);
+	unlink(path);
+
+	NOTICE("Stopped listening on '%s'\n", path);
+
+	return 0;
+}
+
+/*
+ * Send the command line to the daemon and print its output, the exit
+ * status is the one of the request
+ */
+int daemon_client(const char *path, int argc, char *argv[])
+{
+	struct sockaddr_un addr;
+	char buffer[4096], cwd[MAXPATHLEN], *nul;
+	ssize_t len;
+	int fd, i, status = -1;
+
+	if (daemon_address(path, &addr))
+		return 1;
+
+	if (!getcwd(cwd, sizeof(cwd))) {
+		ERROR("Failed to get the current directory: %m\n");
+		return 1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		ERROR("Failed to create the client socket: %m\n");
+		return 1;
+	}
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		ERROR("Failed to connect to the daemon on '%s': %m\n", path);
+		close(fd);
+		return 1;
+	}
+
+	if (daemon_write(fd, &argc, sizeof(argc)) ||
+	    daemon_write_string(fd, cwd))
+		goto out_error;
+
+	for (i = 0; i < argc; i++)
+		if (daemon_write_string(fd, argv[i]))
+			goto out_error;
+
+	while (status < 0) {
+
+		len = read(fd, buffer, sizeof(buffer));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			goto out_error;
+
+		nul = memchr(buffer, '\0', len);
+
+		fwrite(buffer, 1, nul ? nul - buffer : len, stdout);
+		fflush(stdout);
+
+		if (!nul)
+			continue;
+
+		/* The status may be in the next read */
+		if (nul + 1 < buffer + len)
+			status = nul[1];
+		else if (daemon_read(fd, buffer, 1))
+			goto out_error;
+		else
+			status = buffer[0];
+	}
+
+	close(fd);
+
+	return status;
+
+out_error:
+	ERROR("Lost the connection to the daemon on '%s'\n", path);
+	close(fd);
+	return 1;
+}
@@ -0,0 +1,12 @@
+#ifndef __TS_DAEMON_H
+#define __TS_DAEMON_H
+
+struct ts_options;
+
+typedef int (*daemon_request_t)(struct ts_options *tso);
+
+extern int daemon_serve(const char *path, daemon_request_t request);
+
+extern int daemon_client(const char *path, int argc, char *argv[]);
+
+#endif
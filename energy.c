@@ -5,11 +5,13 @@
 #include <regex.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 
 #include "energy.h"
 #include "trace.h"
 #include "topology.h"
+#include "timeline.h"
 
 #define PLUGINS_SENSOR "./sensors"
 
@@ -17,6 +19,12 @@ static int    (*sensor_init)(struct energy *);
 static void   (*sensor_fini)(struct energy *);
 static int    (*sensor_read)(struct energy *);
 static int    (*sensor_probe)(void);
+static int    (*sensor_snapshot)(struct energy *, void **, size_t *);
+static int    (*sensor_restore)(struct energy *, const void *, size_t);
+static void   (*sensor_describe)(struct energy *, char *, size_t);
+
+/* Path of the sensor in use, for the machine snapshot */
+static char *energy_sensor_path;
 
 void *energy_sensor_probe(const char *path, struct topology *topology)
 {
@@ -37,7 +45,7 @@ void *energy_sensor_probe(const char *path, struct topology *topology)
 	if (sensor_probe())
 		goto out_close;
 
-	NOTICE("'%s' probed successfully\n", path);
+	DEBUG("'%s' probed successfully\n", path);
 
 	return handle;
 out_close:
@@ -74,6 +82,10 @@ static int energy_sensor_read(void *handle, struct energy *energy)
 
 int energy_read(struct energy *energy)
 {
+	/* No sensor found, nothing to measure */
+	if (!energy->handle)
+		return 0;
+
 	return energy_sensor_read(energy->handle, energy);
 }
 
@@ -91,8 +103,25 @@ void energy_delta(struct energy *before, struct energy *after, struct energy *re
 
 	result->sys.dram = after->sys.dram - before->sys.dram;
 	result->sys.gpu = after->sys.gpu - before->sys.gpu;
+	result->sys.board = after->sys.board - before->sys.board;
+
+	TRACE("energy sys: gpu=%lf, dram=%lf, board=%lf uJ\n",
+	      result->sys.gpu, result->sys.dram, result->sys.board);
+}
+
+void energy_scale(struct energy *energy, double factor)
+{
+	int i;
+
+	for (i = 0; i < energy->topology->nrpackages; i++) {
+		energy->pkg[i].pkg *= factor;
+		energy->pkg[i].core *= factor;
+		energy->pkg[i].noncore *= factor;
+	}
 
-	TRACE("energy sys: gpu=%lf, dram=%lf uJ\n", result->sys.gpu, result->sys.dram);
+	energy->sys.dram *= factor;
+	energy->sys.gpu *= factor;
+	energy->sys.board *= factor;
 }
 
 struct energy *energy_alloc(struct topology *topology)
@@ -123,6 +152,13 @@ double energy_cost(struct energy *energy)
 	cost += energy->sys.gpu;
 	cost += energy->sys.dram;
 
+	/*
+	 * The board domain includes all the others, account it only
+	 * when it is the only one available
+	 */
+	if (energy->flags == ENERGY_BOARD_SUPPORTED)
+		cost += energy->sys.board;
+
 	return cost;
 }
 
@@ -140,17 +176,35 @@ struct energy *energy_clone(struct energy *energy)
 
 void energy_free(struct energy *energy)
 {
+	if (energy->baseline)
+		energy_free(energy->baseline);
 	free(energy->pkg);
 	free(energy);
 }
 
+/*
+ * The priority exported by the sensor, 0 by default. The dedicated
+ * sensors, as RAPL, are preferred to the generic ones, as hwmon, which
+ * may also probe successfully on the same machine.
+ */
+static int energy_sensor_priority(void *handle)
+{
+	int *priority = dlsym(handle, "sensor_priority");
+
+	return priority ? *priority : 0;
+}
+
 struct energy *energy_init(struct topology *topology)
 {
 	DIR *dir;
 	struct dirent dirent, *direntp;
 	struct energy *energy;
 	regex_t regex;
-	char *path;
+	char *path, *best_path = NULL;
+	void *best = NULL;
+	int priority, best_priority = 0;
+
+	timeline_begin("energy_init", NULL);
 
 	energy = energy_alloc(topology);
 
@@ -161,6 +215,10 @@ struct energy *energy_init(struct topology *topology)
 	if (!dir)
 		FATAL("Failed to open plugin '%s'\n", PLUGINS_SENSOR);
 
+	/*
+	 * All the sensors are probed, the one with the highest priority
+	 * and then the first name wins, whatever the directory order
+	 */
 	while (!readdir_r(dir, &dirent, &direntp)) {
 
 		void *handle;
@@ -179,27 +237,144 @@ struct energy *energy_init(struct topology *topology)
 		}
 
 		handle = energy_sensor_probe(path, topology);
+		if (!handle) {
+			free(path);
+			continue;
+		}
 
-		free(path);
+		priority = energy_sensor_priority(handle);
 
-		if (!handle)
+		if (best && (priority < best_priority ||
+			     (priority == best_priority &&
+			      strcmp(path, best_path) > 0))) {
+			dlclose(handle);
+			free(path);
 			continue;
+		}
 
-		energy->handle = handle;
-
-		if (energy_sensor_init(handle, energy))
-			FATAL("Sensor initialization failed\n");
+		if (best)
+			dlclose(best);
+		free(best_path);
 
-		break;
+		best = handle;
+		best_path = path;
+		best_priority = priority;
 	}
 	
 	closedir(dir);
+	regfree(&regex);
+
+	if (best) {
+		NOTICE("'%s' probed successfully\n", best_path);
+
+		energy->handle = best;
+
+		if (energy_sensor_init(best, energy))
+			FATAL("Sensor initialization failed\n");
+
+		energy_sensor_path = best_path;
+	}
+
+	timeline_end("energy_init");
+
+	return energy;
+}
+
+/*
+ * Initialize the sensor known from a machine snapshot, probing only
+ * this sensor, so a sensor which can no longer be read is not used. The
+ * sensor state is restored from data when the sensor supports it, it is
+ * initialized as usual otherwise.
+ */
+struct energy *energy_init_sensor(struct topology *topology, const char *path,
+				  int flags, const void *data, size_t len)
+{
+	struct energy *energy;
+	void *handle;
+
+	energy = energy_alloc(topology);
+
+	timeline_begin("energy_init", NULL);
+
+	handle = energy_sensor_probe(path, topology);
+	if (!handle)
+		goto out_free;
+
+	energy->handle = handle;
+
+	sensor_restore = dlsym(handle, "sensor_restore");
+	if (sensor_restore && len) {
+		energy->flags = flags;
+		if (sensor_restore(energy, data, len))
+			goto out_close;
+	} else if (energy_sensor_init(handle, energy)) {
+		goto out_close;
+	}
+
+	energy_sensor_path = strdup(path);
+	if (!energy_sensor_path)
+		FATAL("Failed to allocate path for plugin\n");
+
+	DEBUG("'%s' restored from the machine snapshot\n", path);
+
+	timeline_end("energy_init");
 
 	return energy;
+
+out_close:
+	dlclose(handle);
+out_free:
+	energy_free(energy);
+	timeline_end("energy_init");
+	return NULL;
+}
+
+/*
+ * The sensor in use and its state to store in the machine snapshot,
+ * the state is allocated and empty if the sensor does not support it
+ */
+const char *energy_snapshot(struct energy *energy, void **data, size_t *len)
+{
+	*data = NULL;
+	*len = 0;
+
+	if (!energy->handle)
+		return NULL;
+
+	sensor_snapshot = dlsym(energy->handle, "sensor_snapshot");
+	if (sensor_snapshot && sensor_snapshot(energy, data, len)) {
+		*data = NULL;
+		*len = 0;
+	}
+
+	return energy_sensor_path;
+}
+
+/*
+ * The path of the sensor in use, NULL if there is none, with its units
+ * described in buf when the sensor supports it, empty otherwise
+ */
+const char *energy_sensor(struct energy *energy, char *buf, size_t len)
+{
+	if (len)
+		buf[0] = '\0';
+
+	if (!energy->handle)
+		return NULL;
+
+	sensor_describe = dlsym(energy->handle, "sensor_describe");
+	if (sensor_describe)
+		sensor_describe(energy, buf, len);
+
+	return energy_sensor_path;
 }
 
 void energy_fini(struct energy *energy)
 {
-	energy_sensor_fini(energy->handle, energy);
+	if (energy->handle)
+		energy_sensor_fini(energy->handle, energy);
 	energy_free(energy);
+
+	free(energy_sensor_path);
+	energy_sensor_path = NULL;
 }
@@ -1,11 +1,14 @@
 #ifndef __TS_ENERGY_H
 #define __TS_ENERGY_H
 
+#include <stddef.h>
+
 #define ENERGY_CORE_SUPPORTED    0x1
 #define ENERGY_NONCORE_SUPPORTED 0x2
 #define ENERGY_PKG_SUPPORTED     0x4
 #define ENERGY_DRAM_SUPPORTED    0x8
 #define ENERGY_GPU_SUPPORTED     0x10
+#define ENERGY_BOARD_SUPPORTED   0x20
 
 struct energy_pkg {
 	double pkg;
@@ -16,8 +19,13 @@ struct energy_pkg {
 struct energy_sys {
 	double dram;
 	double gpu;
+	double board;
 };
 
+/*
+ * The sensors report the energies in micro-Joules, so the energy over
+ * a duration in usecs is a power in Watts
+ */
 struct energy {
 	void *data;
 	void *handle;
@@ -25,12 +33,39 @@ struct energy {
 	struct energy_sys sys;
 	struct energy_pkg *pkg;
 	struct topology *topology;
+	struct energy *baseline; /* idle power, NULL if not calibrated */
 };
 
 struct topology;
 
+/*
+ * A sensor can export "int sensor_priority", the sensor with the highest
+ * priority is used when several sensors probe successfully
+ */
 extern struct energy *energy_init(struct topology *);
 
+/*
+ * The sensors whose state can be kept in the machine snapshot export:
+ *
+ *   int sensor_snapshot(struct energy *energy, void **data, size_t *len);
+ *   int sensor_restore(struct energy *energy, const void *data, size_t len);
+ *
+ * sensor_snapshot() allocates the state of an initialized sensor, and
+ * sensor_restore() initializes the sensor from it, instead of
+ * sensor_init(), with the energy flags already set.
+ */
+extern struct energy *energy_init_sensor(struct topology *, const char *path,
+					 int flags, const void *data, size_t len);
+
+extern const char *energy_snapshot(struct energy *, void **data, size_t *len);
+
+/*
+ * The sensors can describe their units, stored with the results, with:
+ *
+ *   void sensor_describe(struct energy *energy, char *buf, size_t len);
+ */
+extern const char *energy_sensor(struct energy *, char *buf, size_t len);
+
 extern int  energy_read(struct energy *);
 
 extern void energy_fini(struct energy *);
@@ -41,6 +76,8 @@ extern struct energy *energy_clone(struct energy *);
 
 extern double energy_cost(struct energy *);
 
+extern void energy_scale(struct energy *, double);
+
 extern void energy_free(struct energy *);
 
 #endif
@@ -0,0 +1,300 @@
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+
+#include "trace.h"
+#include "env.h"
+#include "energy.h"
+#include "results.h"
+#include "topology.h"
+
+/*
+ * The machine and the environment of the run are stored in the "env."
+ * attributes of the results, so a comparison can tell when they
+ * changed: the kernel, its command line, the cpufreq governor, the
+ * boost, the frequency range, the cpu microcode, the SMT control, the
+ * online cpus, the topology and the sensor.
+ *
+ * The cpu sysfs root can be changed with the TS_CPU_ROOT environment
+ * variable, "/sys/devices/system/cpu" by default, to use a fake tree.
+ */
+#define ENV_CPU_ROOT "/sys/devices/system/cpu"
+
+static const char *env_cpu_root;
+
+/*
+ * The first line of a file, without the newline, NULL if it can not
+ * be read
+ */
+static char *env_read(const char *fmt, ...)
+{
+	char *path, *line = NULL;
+	size_t len = 0;
+	va_list ap;
+	FILE *f;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vasprintf(&path, fmt, ap);
+	va_end(ap);
+	if (ret < 0)
+		FATAL("Failed to allocate memory for the environment path\n");
+
+	f = fopen(path, "r");
+	free(path);
+	if (!f)
+		return NULL;
+
+	if (getline(&line, &len, f) < 0) {
+		free(line);
+		line = NULL;
+	} else {
+		line[strcspn(line, "\n")] = '\0';
+	}
+
+	fclose(f);
+
+	return line;
+}
+
+static void env_set(struct ts_results *tsr, const char *key, char *value)
+{
+	if (!value)
+		return;
+
+	results_set_attr(tsr, key, "%s", value);
+	free(value);
+}
+
+/*
+ * The value of a "key : value" line of /proc/cpuinfo for the first cpu
+ */
+static char *env_cpuinfo(const char *key)
+{
+	char *line = NULL, *value = NULL, *colon;
+	size_t len = 0;
+	FILE *f;
+
+	f = fopen("/proc/cpuinfo", "r");
+	if (!f)
+		return NULL;
+
+	while (getline(&line, &len, f) > 0) {
+		colon = strchr(line, ':');
+		if (!colon)
+			continue;
+		if (strncmp(line, key, strlen(key)) ||
+		    colon - line != strlen(key) +
+		    strspn(line + strlen(key), " \t"))
+			continue;
+		colon += strspn(colon + 1, " \t") + 1;
+		colon[strcspn(colon, "\n")] = '\0';
+		value = strdup(colon);
+		break;
+	}
+
+	free(line);
+	fclose(f);
+
+	return value;
+}
+
+/*
+ * The cpu model, the arm cpus have no model name in /proc/cpuinfo but
+ * the implementer and the part of the core, the hardware name, or the
+ * identification register of the cpu
+ */
+static char *env_cpu_model(void)
+{
+	char *model, *implementer, *part;
+
+	model = env_cpuinfo("model name");
+	if (model)
+		return model;
+
+	implementer = env_cpuinfo("CPU implementer");
+	part = env_cpuinfo("CPU part");
+	if (part && asprintf(&model, "implementer %s part %s",
+			     implementer ? implementer : "?", part) < 0)
+		FATAL("Failed to allocate memory for the cpu model\n");
+	free(implementer);
+	free(part);
+	if (model)
+		return model;
+
+	model = env_cpuinfo("Hardware");
+	if (model)
+		return model;
+
+	return env_read("%s/cpu0/regs/identification/midr_el1", env_cpu_root);
+}
+
+/*
+ * Whether the item is one of the comma separated list
+ */
+static int env_listed(const char *list, const char *item)
+{
+	size_t len = strlen(item);
+
+	while (list) {
+		if (!strncmp(list, item, len) &&
+		    (list[len] == ',' || list[len] == '\0'))
+			return 1;
+
+		list = strchr(list, ',');
+		if (list)
+			list++;
+	}
+
+	return 0;
+}
+
+/*
+ * The governors in use, one if all the cpus agree, else the list of
+ * the different ones
+ */
+static char *env_governors(struct topology *topology)
+{
+	char *governors = NULL, *governor, *tmp;
+	int i, j, k, cpu;
+
+	for (i = 0; i < topology->nrpackages; i++) {
+		struct package *package = &topology->package[i];
+
+		for (j = 0; j < package->nrcores; j++) {
+			struct core *core = &package->core[j];
+
+			for (k = 0; k < (core->nrthreads ? core->nrthreads : 1); k++) {
+				cpu = core->nrthreads ? core->thread[k].os_id : core->os_id;
+
+				governor = env_read("%s/cpu%d/cpufreq/scaling_governor",
+						    env_cpu_root, cpu);
+				if (!governor)
+					continue;
+
+				if (env_listed(governors, governor)) {
+					free(governor);
+					continue;
+				}
+
+				if (asprintf(&tmp, "%s%s%s", governors ? governors : "",
+					     governors ? "," : "", governor) < 0)
+					FATAL("Failed to allocate memory for the governors\n");
+
+				free(governors);
+				free(governor);
+				governors = tmp;
+			}
+		}
+	}
+
+	return governors;
+}
+
+/*
+ * The cpufreq boost, or the turbo of intel_pstate which is inverted
+ */
+static char *env_boost(void)
+{
+	char *boost, *no_turbo;
+
+	boost = env_read("%s/cpufreq/boost", env_cpu_root);
+	if (boost)
+		return boost;
+
+	no_turbo = env_read("%s/intel_pstate/no_turbo", env_cpu_root);
+	if (!no_turbo)
+		return NULL;
+
+	boost = strdup(strcmp(no_turbo, "0") ? "0" : "1");
+
+	free(no_turbo);
+
+	return boost;
+}
+
+static void env_save_topology(struct ts_results *tsr, struct topology *topology)
+{
+	int i, j, nrcores = 0, nrthreads = 0;
+
+	for (i = 0; i < topology->nrpackages; i++) {
+		nrcores += topology->package[i].nrcores;
+		for (j = 0; j < topology->package[i].nrcores; j++)
+			nrthreads += topology->package[i].core[j].nrthreads ? : 1;
+	}
+
+	results_set_attr(tsr, "env.topology", "%d packages, %d cores, %d threads",
+			 topology->nrpackages, nrcores, nrthreads);
+}
+
+static void env_save_sensor(struct ts_results *tsr, struct energy *energy)
+{
+	const struct {
+		int flag;
+		const char *name;
+	} domains[] = {
+		{ ENERGY_PKG_SUPPORTED,     "pkg" },
+		{ ENERGY_CORE_SUPPORTED,    "core" },
+		{ ENERGY_NONCORE_SUPPORTED, "noncore" },
+		{ ENERGY_DRAM_SUPPORTED,    "dram" },
+		{ ENERGY_GPU_SUPPORTED,     "gpu" },
+		{ ENERGY_BOARD_SUPPORTED,   "board" },
+	};
+	char names[64] = "", units[128];
+	const char *sensor;
+	int i;
+
+	sensor = energy ? energy_sensor(energy, units, sizeof(units)) : NULL;
+	if (!sensor) {
+		results_set_attr(tsr, "env.sensor", "none");
+		return;
+	}
+
+	for (i = 0; i < sizeof(domains) / sizeof(domains[0]); i++) {
+		if (!(energy->flags & domains[i].flag))
+			continue;
+		if (names[0])
+			strcat(names, ",");
+		strcat(names, domains[i].name);
+	}
+
+	results_set_attr(tsr, "env.sensor", "%s (%s)", sensor, names);
+
+	if (units[0])
+		results_set_attr(tsr, "env.sensor.units", "%s", units);
+}
+
+void env_save(struct ts_results *tsr, struct topology *topology,
+	      struct energy *energy)
+{
+	struct utsname utsname;
+
+	env_cpu_root = getenv("TS_CPU_ROOT");
+	if (!env_cpu_root)
+		env_cpu_root = ENV_CPU_ROOT;
+
+	if (!uname(&utsname)) {
+		results_set_attr(tsr, "env.kernel", "%s %s", utsname.release,
+				 utsname.version);
+		results_set_attr(tsr, "env.machine", "%s", utsname.machine);
+	}
+
+	env_set(tsr, "env.cmdline", env_read("/proc/cmdline"));
+	env_set(tsr, "env.cpu", env_cpu_model());
+	env_set(tsr, "env.microcode", env_cpuinfo("microcode"));
+	env_set(tsr, "env.governor", env_governors(topology));
+	env_set(tsr, "env.boost", env_boost());
+	env_set(tsr, "env.freq.min", env_read("%s/cpu0/cpufreq/scaling_min_freq",
+					      env_cpu_root));
+	env_set(tsr, "env.freq.max", env_read("%s/cpu0/cpufreq/scaling_max_freq",
+					      env_cpu_root));
+	env_set(tsr, "env.smt", env_read("%s/smt/control", env_cpu_root));
+	env_set(tsr, "env.cpus.online", env_read("%s/online", env_cpu_root));
+
+	env_save_topology(tsr, topology);
+	env_save_sensor(tsr, energy);
+}
@@ -0,0 +1,11 @@
+#ifndef __TS_ENV_H
+#define __TS_ENV_H
+
+struct ts_results;
+struct topology;
+struct energy;
+
+extern void env_save(struct ts_results *tsr, struct topology *topology,
+		     struct energy *energy);
+
+#endif
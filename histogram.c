@@ -0,0 +1,46 @@
+#include <math.h>
+
+#include "histogram.h"
+
+/*
+ * Highest value counted in a bucket
+ */
+static uint64_t histogram_value(int index)
+{
+	int bucket = index / HISTOGRAM_SUB, sub = index % HISTOGRAM_SUB;
+
+	if (!bucket)
+		return index;
+
+	return ((uint64_t)(HISTOGRAM_SUB + sub + 1) << (bucket - 1)) - 1;
+}
+
+/*
+ * Value below which the percentile of the recorded values are
+ */
+uint64_t histogram_percentile(const struct histogram *histogram,
+			      double percentile)
+{
+	uint64_t target, count = 0, value;
+	int i;
+
+	if (!histogram->count)
+		return 0;
+
+	target = ceil(histogram->count * percentile / 100);
+	if (!target)
+		target = 1;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+
+		count += histogram->buckets[i];
+		if (count < target)
+			continue;
+
+		value = histogram_value(i);
+
+		return value > histogram->max ? histogram->max : value;
+	}
+
+	return histogram->max;
+}
@@ -0,0 +1,91 @@
+#ifndef __TS_HISTOGRAM_H
+#define __TS_HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Log-linear histogram of latencies in nsecs, as the HDR histograms:
+ * each power of two is split in HISTOGRAM_SUB linear buckets, so the
+ * relative error is below 1 / HISTOGRAM_SUB whatever the value. The
+ * values below HISTOGRAM_SUB are exact.
+ *
+ * Recording is a few instructions without any lock, a histogram must
+ * be written by one thread only. The multi-threaded plugins record in
+ * one histogram per thread and merge them at the end.
+ */
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB      (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS  ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB)
+
+struct histogram {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+static inline int histogram_index(uint64_t value)
+{
+	int msb;
+
+	if (value < HISTOGRAM_SUB)
+		return value;
+
+	msb = 63 - __builtin_clzll(value);
+
+	return (msb - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB +
+		(value >> (msb - HISTOGRAM_SUB_BITS)) - HISTOGRAM_SUB;
+}
+
+static inline void histogram_record(struct histogram *histogram, uint64_t value)
+{
+	if (!histogram->count || value < histogram->min)
+		histogram->min = value;
+	if (value > histogram->max)
+		histogram->max = value;
+
+	histogram->count++;
+	histogram->buckets[histogram_index(value)]++;
+}
+
+static inline void histogram_reset(struct histogram *histogram)
+{
+	memset(histogram, 0, sizeof(*histogram));
+}
+
+static inline void histogram_merge(struct histogram *dst, const struct histogram *src)
+{
+	int i;
+
+	if (!src->count)
+		return;
+
+	if (!dst->count || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+
+	dst->count += src->count;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+/*
+ * Monotonic timestamp in nsecs for the latencies
+ */
+static inline uint64_t histogram_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+extern uint64_t histogram_percentile(const struct histogram *histogram,
+				     double percentile);
+
+#endif
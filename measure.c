@@ -0,0 +1,73 @@
+#include <sys/time.h>
+
+#include "trace.h"
+#include "energy.h"
+#include "measure.h"
+#include "residency.h"
+#include "thermal.h"
+#include "noise.h"
+#include "timeline.h"
+
+/*
+ * The measurement window shared by the plugins, the scripts and the
+ * harness calibration. The energy consumed by the function is stored
+ * in the energy parameter and its duration in usecs in duration.
+ */
+int measure(measure_fn_t fn, void *arg, struct energy *energy,
+	    unsigned long *duration)
+{
+	struct timeval begin, end;
+	uint64_t ts_begin, ts_end;
+	struct energy *nrj;
+	int ret;
+
+	nrj = energy_clone(energy);
+
+	trace_hold();
+
+	/* Read out of the window, the cpus are many on the big systems */
+	residency_begin();
+	thermal_begin();
+	noise_begin();
+
+	ts_begin = timeline_now();
+
+	gettimeofday(&begin, NULL);
+
+	if (energy_read(nrj))
+		ERROR("Failed to read sensor energie\n");
+
+	ret = fn(arg);
+
+	if (energy_read(energy))
+		ERROR("Failed to read sensor energie\n");
+
+	gettimeofday(&end, NULL);
+
+	ts_end = timeline_now();
+
+	residency_end();
+	thermal_end();
+	noise_end();
+
+	trace_release();
+
+	energy_delta(nrj, energy, energy);
+
+	energy_free(nrj);
+
+	*duration = (end.tv_sec - begin.tv_sec) * 1000000;
+	*duration += (end.tv_usec - begin.tv_usec);
+
+	/*
+	 * The average power during the window, falling back to the idle
+	 * power, if known, at the end of the window
+	 */
+	timeline_energy(ts_begin, "power (W)", energy,
+			*duration ? 1.0 / *duration : 0);
+	timeline_energy(ts_end, "power (W)",
+			energy->baseline ? energy->baseline : energy,
+			energy->baseline ? 1 : 0);
+
+	return ret;
+}
@@ -0,0 +1,11 @@
+#ifndef __TS_MEASURE_H
+#define __TS_MEASURE_H
+
+struct energy;
+
+typedef int (*measure_fn_t)(void *);
+
+extern int measure(measure_fn_t fn, void *arg, struct energy *energy,
+		   unsigned long *duration);
+
+#endif
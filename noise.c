@@ -0,0 +1,405 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "trace.h"
+#include "noise.h"
+#include "cgroup.h"
+#include "timeline.h"
+
+/*
+ * System noise around the measurement windows: the cpu time of the
+ * system from /proc/stat, minus the one of the benchmarked tree, is the
+ * time used by the other tasks. The benchmarked tree is the harness and
+ * its reaped children from getrusage(), its live descendants, as the
+ * workers of the plugins only waited at the postrun, and the processes
+ * of the script cgroup, as the ones left behind by the scripts.
+ * The interrupts are summed from /proc/interrupts and the load is read
+ * from /proc/loadavg.
+ *
+ * The /proc/stat time is sampled at the tick, the windows shorter than
+ * NOISE_TICKS ticks are too imprecise to be judged and are never noisy.
+ */
+#define NOISE_TICKS 10
+
+struct noise_snapshot {
+	uint64_t busy; /* usecs of user, nice, system and steal time */
+	uint64_t self; /* usecs of the harness and its children */
+	uint64_t irqs;
+	uint64_t ts;   /* usecs */
+};
+
+static double noise_threshold;
+static long noise_hz;
+static int noise_nrcpus;
+static struct noise_snapshot noise_snapshot;
+static struct noise noise;
+static int noise_last_noisy;
+
+static uint64_t noise_busy(void)
+{
+	unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+	uint64_t busy = 0;
+	FILE *f;
+
+	f = fopen("/proc/stat", "r");
+	if (!f)
+		return 0;
+
+	/* irq and softirq are also caused by the benchmark, not counted */
+	if (fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &user,
+		   &nice, &system, &idle, &iowait, &irq, &softirq, &steal) == 8)
+		busy = (user + nice + system + steal) * 1000000 / noise_hz;
+
+	fclose(f);
+
+	return busy;
+}
+
+/*
+ * The run time in nsecs of the threads of the process, from schedstat
+ * which is not rounded to the tick, -1 if it is not available
+ */
+static int64_t noise_proc_runtime(pid_t pid)
+{
+	unsigned long long runtime;
+	struct dirent *dirent;
+	char path[64];
+	int64_t total = 0;
+	FILE *f;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ((dirent = readdir(dir))) {
+
+		int tid = atoi(dirent->d_name);
+
+		if (tid <= 0)
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/%d/task/%d/schedstat", pid, tid);
+
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+
+		if (fscanf(f, "%llu", &runtime) == 1)
+			total += runtime;
+		else
+			total = -1;
+
+		fclose(f);
+
+		if (total < 0)
+			break;
+	}
+
+	closedir(dir);
+
+	return total;
+}
+
+/*
+ * The cpu time in usecs of the process and of its reaped children, 0
+ * if the process is gone
+ */
+static uint64_t noise_proc_usecs(pid_t pid)
+{
+	unsigned long long utime, stime, cutime, cstime;
+	char path[64], buffer[1024], *ptr;
+	int64_t runtime;
+	uint64_t usecs;
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	len = read(fd, buffer, sizeof(buffer) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+
+	buffer[len] = '\0';
+
+	/* The command name can contain spaces and parentheses */
+	ptr = strrchr(buffer, ')');
+	if (!ptr || sscanf(ptr + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+			   "%llu %llu %llu %llu", &utime, &stime,
+			   &cutime, &cstime) != 4)
+		return 0;
+
+	usecs = (cutime + cstime) * 1000000 / noise_hz;
+
+	/* The short lived workers would all be rounded down to 0 tick */
+	runtime = noise_proc_runtime(pid);
+	if (runtime >= 0)
+		usecs += runtime / 1000;
+	else
+		usecs += (utime + stime) * 1000000 / noise_hz;
+
+	return usecs;
+}
+
+static int noise_pid_in(pid_t pid, pid_t *pids, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (pids[i] == pid)
+			return 1;
+
+	return 0;
+}
+
+static void noise_pid_add(pid_t pid, pid_t **pids, int *nr)
+{
+	if (noise_pid_in(pid, *pids, *nr))
+		return;
+
+	*pids = realloc(*pids, sizeof(**pids) * (*nr + 1));
+	if (!*pids)
+		FATAL("Failed to allocate memory for the processes\n");
+
+	(*pids)[(*nr)++] = pid;
+}
+
+/*
+ * Add the children of the threads of the process, from their children
+ * file, to the processes
+ */
+static void noise_children(pid_t pid, pid_t **pids, int *nr)
+{
+	struct dirent *dirent;
+	char path[64];
+	int child;
+	FILE *f;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+
+	dir = opendir(path);
+	if (!dir)
+		return;
+
+	while ((dirent = readdir(dir))) {
+
+		int tid = atoi(dirent->d_name);
+
+		if (tid <= 0)
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/%d/task/%d/children", pid, tid);
+
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+
+		while (fscanf(f, "%d", &child) == 1)
+			noise_pid_add(child, pids, nr);
+
+		fclose(f);
+	}
+
+	closedir(dir);
+}
+
+/*
+ * The cpu time in usecs of the live descendants of the harness and of
+ * the processes in the script cgroup. Only the benchmarked tree is
+ * walked, from the children of each process, so the cost does not
+ * depend on the other tasks of the system.
+ */
+static uint64_t noise_descendants(void)
+{
+	pid_t *pids = NULL;
+	uint64_t usecs = 0;
+	int i, nr = 0;
+
+	pids = cgroup_procs(&nr);
+
+	noise_children(getpid(), &pids, &nr);
+
+	/* The list grows with the children of each process while walked */
+	for (i = 0; i < nr; i++) {
+		if (pids[i] == getpid())
+			continue;
+		usecs += noise_proc_usecs(pids[i]);
+		noise_children(pids[i], &pids, &nr);
+	}
+
+	free(pids);
+
+	return usecs;
+}
+
+static uint64_t noise_self(void)
+{
+	struct rusage self, children;
+
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+
+	/*
+	 * A descendant reaped during the window moves its time from its
+	 * /proc stat to the children rusage, the sum is kept
+	 */
+	return (self.ru_utime.tv_sec + self.ru_stime.tv_sec +
+		children.ru_utime.tv_sec + children.ru_stime.tv_sec) * 1000000ULL +
+		self.ru_utime.tv_usec + self.ru_stime.tv_usec +
+		children.ru_utime.tv_usec + children.ru_stime.tv_usec +
+		noise_descendants();
+}
+
+/*
+ * Sum of the per cpu counters of all the interrupt lines
+ */
+static uint64_t noise_irqs(void)
+{
+	char *line = NULL, *ptr, *end;
+	unsigned long long value;
+	uint64_t irqs = 0;
+	size_t len = 0;
+	FILE *f;
+
+	f = fopen("/proc/interrupts", "r");
+	if (!f)
+		return 0;
+
+	while (getline(&line, &len, f) > 0) {
+
+		ptr = strchr(line, ':');
+		if (!ptr)
+			continue;
+
+		for (ptr++; ; ptr = end) {
+			value = strtoull(ptr, &end, 10);
+			if (end == ptr)
+				break;
+			irqs += value;
+		}
+	}
+
+	free(line);
+	fclose(f);
+
+	return irqs;
+}
+
+static double noise_load(void)
+{
+	double load = 0;
+	FILE *f;
+
+	f = fopen("/proc/loadavg", "r");
+	if (!f)
+		return 0;
+
+	if (fscanf(f, "%lf", &load) != 1)
+		load = 0;
+
+	fclose(f);
+
+	return load;
+}
+
+static void noise_read(struct noise_snapshot *snapshot)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	snapshot->busy = noise_busy();
+	snapshot->self = noise_self();
+	snapshot->irqs = noise_irqs();
+	snapshot->ts = tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+int noise_init(double threshold)
+{
+	timeline_begin("noise_init", NULL);
+
+	noise_threshold = threshold;
+	noise_hz = sysconf(_SC_CLK_TCK);
+	noise_nrcpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (noise_hz <= 0 || noise_nrcpus <= 0) {
+		ERROR("Failed to get the clock ticks and the cpus\n");
+		noise_hz = 0;
+		timeline_end("noise_init");
+		return -1;
+	}
+
+	DEBUG("Noise threshold %.2lf%% of %d cpus\n", threshold, noise_nrcpus);
+
+	timeline_end("noise_init");
+
+	return 0;
+}
+
+void noise_begin(void)
+{
+	if (!noise_hz)
+		return;
+
+	noise_read(&noise_snapshot);
+}
+
+void noise_end(void)
+{
+	struct noise_snapshot end;
+	int64_t foreign;
+	uint64_t duration;
+
+	if (!noise_hz)
+		return;
+
+	noise_read(&end);
+
+	duration = end.ts - noise_snapshot.ts;
+	if (!duration)
+		duration = 1;
+
+	foreign = (end.busy - noise_snapshot.busy) - (end.self - noise_snapshot.self);
+	if (foreign < 0)
+		foreign = 0;
+	if (foreign > duration * noise_nrcpus)
+		foreign = duration * noise_nrcpus;
+
+	noise.foreign = 100.0 * foreign / ((double)duration * noise_nrcpus);
+	noise.irqs = (end.irqs - noise_snapshot.irqs) * 1000000.0 / duration;
+	noise.load = noise_load();
+
+	noise_last_noisy = noise_threshold > 0 &&
+		duration >= NOISE_TICKS * 1000000 / noise_hz &&
+		noise.foreign > noise_threshold;
+
+	DEBUG("%.2lf%% foreign cpu, %.0lf irqs/s, load %.2lf%s\n",
+	      noise.foreign, noise.irqs, noise.load,
+	      noise_last_noisy ? ", noisy" : "");
+}
+
+const struct noise *noise_last(void)
+{
+	return &noise;
+}
+
+int noise_noisy(void)
+{
+	return noise_last_noisy;
+}
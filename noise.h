@@ -0,0 +1,23 @@
+#ifndef __TS_NOISE_H
+#define __TS_NOISE_H
+
+/*
+ * Activity of the rest of the system during a measurement window
+ */
+struct noise {
+	double foreign; /* % of the cpus time used by the other tasks */
+	double irqs;    /* interrupts per second */
+	double load;    /* 1 minute load average at the end */
+};
+
+extern int noise_init(double threshold);
+
+extern void noise_begin(void);
+
+extern void noise_end(void);
+
+extern const struct noise *noise_last(void);
+
+extern int noise_noisy(void);
+
+#endif
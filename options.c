@@ -1,23 +1,79 @@
 #include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "trace.h"
 #include "options.h"
 
 static struct option long_options[] = {
-	{ "loglevel",   0, 0, 'l' },
+	{ "help",       0, 0, 'h' },
+	{ "loglevel",   1, 0, 'l' },
 	{ "publish",    0, 0, 'b' },
 	{ "compare",    0, 0, 'c' },
 	{ "save",       0, 0, 's' },
-	{ "plugins",    0, 0, 'p' },
-	{ "scripts",    0, 0, 'r' },
-	{ "iterations", 0, 0, 'i' },
-	{ "file",       0, 0, 'f' },
+	{ "plugins",    1, 0, 'p' },
+	{ "scripts",    1, 0, 'r' },
+	{ "iterations", 1, 0, 'i' },
+	{ "file",       1, 0, 'f' },
 	{ "file1",      0, 0, 'x' },
 	{ "file2",      0, 0, 'y' },
+	{ "calibrate",  1, 0, 'C' },
+	{ "recalibrate", 0, 0, 'R' },
+	{ "overhead",   1, 0, 'O' },
+	{ "sync-trace", 0, 0, 'S' },
+	{ "timeline",   1, 0, 't' },
+	{ "min-time",   1, 0, 'm' },
+	{ "sweep",      1, 0, 'w' },
+	{ "cooldown",   1, 0, 'k' },
+	{ "cooldown-timeout", 1, 0, 'K' },
+	{ "noise",      1, 0, 'n' },
+	{ "reruns",     1, 0, 'N' },
+	{ "cpuset",     1, 0, 'u' },
+	{ "memory-max", 1, 0, 'M' },
+	{ "daemon",     1, 0, 'D' },
+	{ "client",     1, 0, 'X' },
+	{ "rediscover", 0, 0, 'd' },
+	{ "hwmon-root", 1, 0, 'H' },
+	{ "hwmon-map",  1, 0, 'A' },
+	{ "hwmon-period", 1, 0, 'P' },
         { 0, 0, 0, 0 },
 };
 
+void ts_usage(FILE *f)
+{
+	fprintf(f,
+		"Usage: ts [options]\n"
+		"  -h, --help                  show this help\n"
+		"  -l, --loglevel <level>      trace level\n"
+		"  -p, --plugins <dir>         benchmark plugins directory\n"
+		"  -r, --scripts <dir>         benchmark scripts directory\n"
+		"  -i, --iterations <nr>       iterations of each benchmark\n"
+		"  -f, --file <file>[,<file>]  results file, two to compare\n"
+		"  -s, --save                  save the results in the file\n"
+		"  -b, --publish               show the results of the file\n"
+		"  -c, --compare               compare the results of the files\n"
+		"  -C, --calibrate <msecs>     idle power calibration, 0 disables\n"
+		"  -R, --recalibrate           calibrate before each benchmark\n"
+		"  -O, --overhead <runs>       harness overhead calibration runs\n"
+		"  -S, --sync-trace            synchronous traces\n"
+		"  -t, --timeline <file>       timeline trace of the run\n"
+		"  -m, --min-time <msecs>      minimum duration of a benchmark\n"
+		"  -w, --sweep <sweep>         parameter sweep, name=range;...\n"
+		"  -k, --cooldown <idle|temp>  cool down before each benchmark\n"
+		"  -K, --cooldown-timeout <s>  maximum cooldown time\n"
+		"  -n, --noise <percent>       foreign cpu time rerun threshold\n"
+		"  -N, --reruns <nr>           maximum reruns of a noisy benchmark\n"
+		"  -u, --cpuset <cpus>         cpus of the scripts cgroup\n"
+		"  -M, --memory-max <bytes>    memory limit of the scripts cgroup\n"
+		"  -D, --daemon <socket>       serve the requests on the socket\n"
+		"  -X, --client <socket>       send the request to the daemon\n"
+		"  -d, --rediscover            ignore the machine snapshot\n"
+		"  -H, --hwmon-root <dir>      hwmon sensor sysfs root\n"
+		"  -A, --hwmon-map <map>       hwmon channels domains, label=domain,...\n"
+		"  -P, --hwmon-period <usecs>  hwmon power sampling period\n");
+}
+
 int ts_getoptions(int argc, char *argv[], struct ts_options *tso)
 {
 	int c;
@@ -27,16 +83,25 @@ int ts_getoptions(int argc, char *argv[], struct ts_options *tso)
 	tso->pluginspath = "./plugins";
 	tso->scriptspath = "./scripts";
 	tso->iterations = 1;
+	tso->calibrate = 500;
+	tso->overhead = 100;
+	tso->mintime = 100;
+	tso->cooldown_timeout = 60;
+	tso->noise = 5;
+	tso->reruns = 3;
 
 	while (1) {
 		int optindex = 0;
 
-		c = getopt_long(argc, argv, "bcsr:f:p:l:i:v",
+		c = getopt_long(argc, argv, "hbcsr:f:p:l:i:C:RO:St:m:w:k:K:n:N:u:M:D:X:dH:A:P:v",
 				long_options, &optindex);
 		if (c == -1)
 			break;
 
 		switch (c) {
+		case 'h':
+			tso->help = true;
+			return 0;
 		case 'l':
 			tso->loglevel = trace_char2level(optarg);
 			break;
@@ -61,37 +126,152 @@ int ts_getoptions(int argc, char *argv[], struct ts_options *tso)
 		case 'i':
 			tso->iterations = atoi(optarg);
 			break;
+		case 'C':
+			tso->calibrate = atoi(optarg);
+			break;
+		case 'R':
+			tso->recalibrate = true;
+			break;
+		case 'O':
+			tso->overhead = atoi(optarg);
+			break;
+		case 'S':
+			tso->synctrace = true;
+			break;
+		case 't':
+			tso->timeline = optarg;
+			break;
+		case 'm':
+			tso->mintime = atoi(optarg);
+			break;
+		case 'w':
+			tso->sweep = optarg;
+			break;
+		case 'k':
+			tso->cooldown = optarg;
+			break;
+		case 'K':
+			if (atoi(optarg) < 0) {
+				ERROR("'cooldown-timeout' option must be positive\n");
+				return -1;
+			}
+			tso->cooldown_timeout = atoi(optarg);
+			break;
+		case 'n':
+			tso->noise = atof(optarg);
+			break;
+		case 'N':
+			tso->reruns = atoi(optarg);
+			break;
+		case 'u':
+			tso->cpuset = optarg;
+			break;
+		case 'M':
+			tso->memory_max = optarg;
+			break;
+		case 'D':
+			tso->daemon = optarg;
+			break;
+		case 'X':
+			tso->client = optarg;
+			break;
+		case 'd':
+			tso->rediscover = true;
+			break;
+		case 'H':
+			tso->hwmon_root = optarg;
+			break;
+		case 'A':
+			tso->hwmon_map = optarg;
+			break;
+		case 'P':
+			if (strtol(optarg, NULL, 0) <= 0) {
+				ERROR("'hwmon-period' option must be positive\n");
+				return -1;
+			}
+			tso->hwmon_period = optarg;
+			break;
 		default:
 			return -1;
 		}
 	}
 
-	if (tso->iterations < 1)
-		FATAL("'iterations' option must be greater than zero\n");
+	if (tso->iterations < 1) {
+		ERROR("'iterations' option must be greater than zero\n");
+		return -1;
+	}
+
+	if (tso->mintime < 1) {
+		ERROR("'min-time' option must be greater than zero\n");
+		return -1;
+	}
+
+	if (tso->cooldown) {
+		char *end;
+
+		if (strcmp(tso->cooldown, "idle") &&
+		    (strtod(tso->cooldown, &end) <= 0 || *end)) {
+			ERROR("'cooldown' option must be 'idle' or degrees\n");
+			return -1;
+		}
+
+		/* No time to cool down is no cooldown */
+		if (!tso->cooldown_timeout)
+			tso->cooldown = NULL;
+	}
+
+	if (tso->compare && tso->save) {
+		ERROR("'compare' and 'save' options are mutually exclusive\n");
+		return -1;
+	}
 
-	if (tso->compare && tso->save)
-		FATAL("'compare' and 'save' options are mutually exclusive\n");
+	if (tso->save && !tso->file) {
+		ERROR("'save' option set but no specified file to save in\n");
+		return -1;
+	}
 
-	if (tso->save && !tso->file)
-		FATAL("'save' option set but no specified file to save in\n");
+	if (tso->publish && !tso->file) {
+		ERROR("'publish' option set but no specified file to show\n");
+		return -1;
+	}
 
-	if (tso->publish && !tso->file)
-		FATAL("'publish' option set but no specified file to show\n");
+	if (tso->daemon && tso->client) {
+		ERROR("'daemon' and 'client' options are mutually exclusive\n");
+		return -1;
+	}
 
-	if (tso->compare && !tso->file)
-		FATAL("'compare' option set but no specified files to compare to\n");
+	if (tso->compare && !tso->file) {
+		ERROR("'compare' option set but no specified files to compare to\n");
+		return -1;
+	}
 
 	if (tso->compare) {
 		char *token;
 
 		token = strchr(tso->file, ',');
-		if (!token)
-			FATAL("Failed to parse file name\n");
+		if (!token) {
+			ERROR("Failed to parse file name\n");
+			return -1;
+		}
 
-		*token = '\0';
-		tso->file1 = tso->file;
+		/* The arguments are left as is, for the daemon clients */
+		tso->file1 = strndup(tso->file, token - tso->file);
+		if (!tso->file1) {
+			ERROR("Failed to allocate memory for the file name\n");
+			return -1;
+		}
 		tso->file2 = token + 1;
 	}
 
 	return 0;
 }
+
+/*
+ * Free what the parsing allocated, the other strings point to the
+ * arguments
+ */
+void ts_options_free(struct ts_options *tso)
+{
+	free((char *)tso->file1);
+	tso->file1 = NULL;
+}
@@ -2,20 +2,43 @@
 #define __TS_OPTIONS_H
 
 #include <stdbool.h>
+#include <stdio.h>
 
 struct ts_options {
 	int loglevel;
 	int iterations;
+	unsigned int calibrate;
+	unsigned int overhead;
+	unsigned int mintime;
+	bool recalibrate;
+	bool synctrace;
 	bool compare;
 	bool save;
 	bool publish;
+	bool rediscover; /* ignore the machine snapshot */
+	bool help;
 	const char *file;
 	const char *file1;
 	const char *file2;
 	const char *pluginspath;
 	const char *scriptspath;
+	const char *timeline;
+	const char *sweep;
+	const char *cooldown;
+	unsigned int cooldown_timeout;
+	double noise;
+	int reruns;
+	const char *cpuset;
+	const char *memory_max;
+	const char *daemon; /* socket of the daemon to serve */
+	const char *client; /* socket of the daemon to send the request to */
+	const char *hwmon_root;   /* TS_HWMON_ROOT */
+	const char *hwmon_map;    /* TS_HWMON_MAP */
+	const char *hwmon_period; /* TS_HWMON_PERIOD */
 };
 
+extern void ts_usage(FILE *f);
 extern int ts_getoptions(int argc, char *argv[], struct ts_options *options);
+extern void ts_options_free(struct ts_options *options);
 
 #endif
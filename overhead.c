@@ -0,0 +1,112 @@
+#include <math.h>
+
+#include "trace.h"
+#include "energy.h"
+#include "measure.h"
+#include "results.h"
+#include "stats.h"
+
+/*
+ * A result is considered as being in the harness noise when it is
+ * below the overhead average plus NOISE_STDDEV standard deviations
+ */
+#define NOISE_STDDEV 3
+
+static struct overhead {
+	unsigned int runs;
+	double duration;
+	double duration_stddev;
+	double energy;
+	double energy_stddev;
+} overhead;
+
+static int overhead_null(void *arg)
+{
+	return 0;
+}
+
+/*
+ * Run a null workload through the measurement window to compute the
+ * time and the energy the harness adds to each measurement
+ */
+int overhead_calibrate(struct energy *energy, unsigned int runs)
+{
+	double sum_duration2 = 0, sum_energy2 = 0;
+	unsigned long duration;
+	unsigned int i;
+	double cost;
+
+	if (!runs)
+		return 0;
+
+	overhead.duration = 0;
+	overhead.energy = 0;
+
+	for (i = 0; i < runs; i++) {
+
+		if (measure(overhead_null, NULL, energy, &duration))
+			return -1;
+
+		cost = energy_cost(energy);
+
+		overhead.duration = avg(overhead.duration, duration, i + 1);
+		overhead.energy = avg(overhead.energy, cost, i + 1);
+
+		sum_duration2 += (double)duration * duration;
+		sum_energy2 += cost * cost;
+	}
+
+	overhead.runs = runs;
+	overhead.duration_stddev = stddev(overhead.duration, sum_duration2, runs);
+	overhead.energy_stddev = stddev(overhead.energy, sum_energy2, runs);
+
+	/* Rounding errors when the values are constant */
+	if (isnan(overhead.duration_stddev))
+		overhead.duration_stddev = 0;
+	if (isnan(overhead.energy_stddev))
+		overhead.energy_stddev = 0;
+
+	NOTICE("Harness overhead: %.2lf usecs (+/- %.2lf), %lf uJ (+/- %lf)\n",
+	       overhead.duration, overhead.duration_stddev,
+	       overhead.energy, overhead.energy_stddev);
+
+	return 0;
+}
+
+/*
+ * Flag the results which are in the noise of the harness overhead and
+ * remove the overhead from the measurements
+ */
+void overhead_apply(struct ts_plugin_results *tspr)
+{
+	if (!overhead.runs)
+		return;
+
+	if (tspr->duration <= overhead.duration +
+	    NOISE_STDDEV * overhead.duration_stddev)
+		tspr->flags |= RESULT_OVERHEAD_NOISE;
+
+	if (overhead.energy &&
+	    tspr->energy <= overhead.energy + NOISE_STDDEV * overhead.energy_stddev)
+		tspr->flags |= RESULT_OVERHEAD_NOISE;
+
+	tspr->duration -= overhead.duration;
+	if (tspr->duration < 0)
+		tspr->duration = 0;
+
+	tspr->energy -= overhead.energy;
+	if (tspr->energy < 0)
+		tspr->energy = 0;
+}
+
+void overhead_save(struct ts_results *tsr)
+{
+	if (!overhead.runs)
+		return;
+
+	results_set_attr(tsr, "overhead.runs", "%u", overhead.runs);
+	results_set_attr(tsr, "overhead.duration", "%.2lf usecs (+/- %.2lf)",
+			 overhead.duration, overhead.duration_stddev);
+	results_set_attr(tsr, "overhead.energy", "%lf uJ (+/- %lf)",
+			 overhead.energy, overhead.energy_stddev);
+}
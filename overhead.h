@@ -0,0 +1,14 @@
+#ifndef __TS_OVERHEAD_H
+#define __TS_OVERHEAD_H
+
+struct energy;
+struct ts_results;
+struct ts_plugin_results;
+
+extern int overhead_calibrate(struct energy *energy, unsigned int runs);
+
+extern void overhead_apply(struct ts_plugin_results *tspr);
+
+extern void overhead_save(struct ts_results *tsr);
+
+#endif
@@ -8,80 +8,412 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 
 #include "trace.h"
 #include "options.h"
 #include "results.h"
 #include "energy.h"
 #include "topology.h"
+#include "plugin.h"
+#include "baseline.h"
+#include "measure.h"
+#include "overhead.h"
+#include "stats.h"
+#include "timeline.h"
+#include "residency.h"
+#include "thermal.h"
+#include "noise.h"
+#include "pool.h"
+#include "sweep.h"
+#include "histogram.h"
+
+#define PLUGIN_BATCH_GROWS 16        /* growing passes of the batch */
+#define PLUGIN_BATCH_MAX   (1UL << 48) /* operations in a batch */
 
 static void  (*plugin_init)(struct ts_options *);
-static void *(*plugin_prerun)(void);
+static void *(*plugin_prerun)(struct ts_param *);
 static int   (*plugin_run)(void *);
 static int   (*plugin_postrun)(void *);
+static int   (*plugin_run_batch)(void *, struct ts_work *);
+static int   (*plugin_run_worker)(void *, struct ts_worker *);
+static int   (*plugin_workers)(void *);
+static int   (*plugin_init_worker)(void *, struct ts_worker *);
+static void  (*plugin_histogram)(void *, struct histogram *);
+
+/* Latencies recorded by the runs discarded while growing the batch */
+static struct histogram plugin_discarded;
+
+/*
+ * The plugins stay loaded between the runs, and between the requests
+ * of the daemon, a plugin is reloaded when its file changed
+ */
+struct plugin_handle {
+	char *path;
+	void *handle;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+};
 
-static int _plugin_run(struct ts_options *tso, const char *path,
-		       unsigned long *duration, struct energy *energy)
+static struct plugin_handle *plugin_handles;
+static int plugin_nrhandles;
+
+static void *plugin_open(const char *path)
 {
-	void *handle, *data;
-	struct timeval begin, end;
-	struct energy *nrj;
-	int ret = -1;
+	struct plugin_handle *ph = NULL;
+	struct stat st;
+	int i;
+
+	if (stat(path, &st)) {
+		ERROR("Failed to stat '%s': %m\n", path);
+		return NULL;
+	}
 
-	nrj = energy_clone(energy);
+	for (i = 0; i < plugin_nrhandles; i++) {
+		if (!strcmp(plugin_handles[i].path, path)) {
+			ph = &plugin_handles[i];
+			break;
+		}
+	}
 
-	handle = dlopen(path, RTLD_LAZY);
-	if (!handle) {
+	if (ph && ph->dev == st.st_dev && ph->ino == st.st_ino &&
+	    ph->mtime.tv_sec == st.st_mtim.tv_sec &&
+	    ph->mtime.tv_nsec == st.st_mtim.tv_nsec)
+		return ph->handle;
+
+	if (ph) {
+		DEBUG("'%s' changed, reloading it\n", path);
+		dlclose(ph->handle);
+	} else {
+		plugin_handles = realloc(plugin_handles, sizeof(*plugin_handles) *
+					 (plugin_nrhandles + 1));
+		if (!plugin_handles)
+			FATAL("Failed to allocate memory for the plugin handles\n");
+		ph = &plugin_handles[plugin_nrhandles++];
+		ph->path = strdup(path);
+		if (!ph->path)
+			FATAL("Failed to allocate memory for the plugin handles\n");
+	}
+
+	ph->handle = dlopen(path, RTLD_LAZY);
+	if (!ph->handle) {
 		ERROR("Failed to dlopen '%s': %s\n", path, dlerror());
-		return -1;
+		free(ph->path);
+		*ph = plugin_handles[--plugin_nrhandles];
+		return NULL;
+	}
+
+	ph->dev = st.st_dev;
+	ph->ino = st.st_ino;
+	ph->mtime = st.st_mtim;
+
+	return ph->handle;
+}
+
+void plugins_fini(void)
+{
+	int i;
+
+	for (i = 0; i < plugin_nrhandles; i++) {
+		dlclose(plugin_handles[i].handle);
+		free(plugin_handles[i].path);
+	}
+
+	free(plugin_handles);
+	plugin_handles = NULL;
+	plugin_nrhandles = 0;
+}
+
+struct plugin_batch {
+	void *data;
+	struct pool *pool;
+	struct ts_work *work;
+};
+
+static int plugin_batch_run(void *arg)
+{
+	struct plugin_batch *batch = arg;
+
+	if (batch->pool)
+		return pool_run(batch->pool, batch->work);
+
+	return plugin_run_batch(batch->data, batch->work);
+}
+
+/*
+ * Run a throughput plugin, the first time with a batch growing until
+ * the run lasts at least the minimum time. The batch size found is
+ * kept in the work for the next iterations.
+ */
+static int plugin_batch_measure(struct ts_options *tso, void *data,
+				struct pool *pool, struct ts_work *work,
+				struct energy *energy, unsigned long *duration)
+{
+	struct plugin_batch batch = { .data = data, .pool = pool, .work = work };
+	unsigned long min_time = tso->mintime * 1000;
+	int grow = !work->batch, passes = 0;
+	double factor;
+	int ret;
+
+	if (grow)
+		work->batch = 1;
+
+	for (;;) {
+		work->ops = 0;
+		work->bytes = 0;
+
+		ret = measure(plugin_batch_run, &batch, energy, duration);
+		if (!pool && !work->ops)
+			work->ops = work->batch;
+
+		/* Workers not reporting operations do a fixed work */
+		if (ret || !grow || !work->ops || *duration >= min_time)
+			return ret;
+
+		/* Aim 20% above the minimum time, growing by 2 to 100 times */
+		factor = *duration ? 1.2 * min_time / *duration : 100;
+		factor = MAX(2, MIN(factor, 100));
+
+		/* The duration of the plugin does not follow the batch */
+		if (++passes > PLUGIN_BATCH_GROWS ||
+		    work->batch * factor > PLUGIN_BATCH_MAX) {
+			WARNING("Still %lu usecs with a batch of %lu, the plugin "
+				"ignores its batch\n", *duration, work->batch);
+			return ret;
+		}
+
+		work->batch *= factor;
+
+		DEBUG("%lu usecs is too short, growing the batch to %lu\n",
+		      *duration, work->batch);
+
+		if (plugin_histogram) {
+			plugin_histogram(data, &plugin_discarded);
+			histogram_reset(&plugin_discarded);
+		}
 	}
+}
+
+static int _plugin_run(struct ts_options *tso, const char *path,
+		       unsigned long *duration, struct energy *energy,
+		       struct ts_work *work, struct sweep *sweep,
+		       struct histogram *histogram)
+{
+	struct ts_param *params;
+	void *handle, *data = NULL;
+	struct pool *pool = NULL;
+	int ret = -1;
 
+	timeline_begin("dlopen", NULL);
+	handle = plugin_open(path);
+	timeline_end("dlopen");
+	if (!handle)
+		return -1;
+
+	timeline_begin("init", NULL);
 	plugin_init = dlsym(handle, "plugin_init");
 	if (plugin_init)
 		plugin_init(tso);
 	else ERROR("No init function defined for plugin\n");
+	timeline_end("init");
+
+	params = dlsym(handle, "plugin_params");
+	for (; params && params->name; params++)
+		params->value = sweep_value(sweep, params->name);
 
+	timeline_begin("prerun", NULL);
 	plugin_prerun = dlsym(handle, "plugin_prerun");
 	if (plugin_prerun)
-		data = plugin_prerun();
+		data = plugin_prerun(dlsym(handle, "plugin_params"));
 	else DEBUG("No prerun function defined for plugin '%s'\n", path);
 
 	plugin_run = dlsym(handle, "plugin_run");
-	if (!plugin_run) {
+	plugin_run_batch = dlsym(handle, "plugin_run_batch");
+	plugin_run_worker = dlsym(handle, "plugin_run_worker");
+	plugin_histogram = dlsym(handle, "plugin_histogram");
+	if (!plugin_run && !plugin_run_batch && !plugin_run_worker) {
 		ERROR("plugin has no 'run' function\n");
+		timeline_end("prerun");
 		goto out;
 	}
 
-	trace_raw(NOTICE, "NOTICE: Running '%s'... ", path);
-	gettimeofday(&begin, NULL);
+	timeline_end("prerun");
 
-	if (energy_read(nrj))
-		ERROR("Failed to read sensor energie\n");
+	if (plugin_run_worker) {
+		plugin_workers = dlsym(handle, "plugin_workers");
+		plugin_init_worker = dlsym(handle, "plugin_init_worker");
 
-	ret = plugin_run(data);
-	
-	if (energy_read(energy))
-		ERROR("Failed to read sensor energie\n");
+		timeline_begin("pool_create", NULL);
+		pool = pool_create(energy->topology,
+				   plugin_workers ? plugin_workers(data) : 0,
+				   plugin_init_worker, plugin_run_worker, data);
+		timeline_end("pool_create");
+		if (!pool) {
+			ERROR("Failed to create the workers pool\n");
+			goto out_postrun;
+		}
+	}
 
-	gettimeofday(&end, NULL);
+	if (sweep_nrparams(sweep))
+		trace_raw(NOTICE, "NOTICE: Running '%s' [%s]... ", path,
+			  sweep_tag(sweep));
+	else
+		trace_raw(NOTICE, "NOTICE: Running '%s'... ", path);
+
+	timeline_begin("run", NULL);
+	if (pool || plugin_run_batch)
+		ret = plugin_batch_measure(tso, data, pool, work, energy, duration);
+	else
+		ret = measure(plugin_run, data, energy, duration);
+	timeline_end("run");
+
+	if (plugin_histogram)
+		plugin_histogram(data, histogram);
 
 	trace_raw(NOTICE, "%s\n", ret ? "Fail" : "Ok");
 
-	energy_delta(nrj, energy, energy);
+	timeline_begin("pool_destroy", NULL);
+	pool_destroy(pool);
+	timeline_end("pool_destroy");
 
+out_postrun:
+	timeline_begin("postrun", NULL);
 	plugin_postrun = dlsym(handle, "plugin_postrun");
 	if (plugin_postrun)
 		plugin_postrun(data);
 	else DEBUG("No postrun function defined for plugin '%s'\n", path);
-	
-	*duration = (end.tv_sec - begin.tv_sec) * 1000000;
-	*duration += (end.tv_usec - begin.tv_usec);
+	timeline_end("postrun");
 out:
-	dlclose(handle);
+	/* The prefix set by plugin_init() is the one of the plugin only */
+	trace_set_prefix(NULL);
 	return ret;
 }
 
-#define avg(a, b, i) ((a) + (((b) - (a)) / (i)))
+/*
+ * Build the sweep of the parameters declared by the plugin
+ */
+static struct sweep *plugin_sweep(struct ts_options *tso, const char *path,
+				  const char *name)
+{
+	struct ts_param *params;
+	struct sweep *sweep;
+	void *handle;
+
+	sweep = sweep_alloc(name, tso->sweep);
+
+	handle = plugin_open(path);
+	if (!handle)
+		goto out_free;
+
+	params = dlsym(handle, "plugin_params");
+	for (; params && params->name; params++) {
+		if (sweep_add(sweep, params->name, params->range))
+			goto out_free;
+	}
+
+	return sweep;
+
+out_free:
+	sweep_free(sweep);
+	return NULL;
+}
+
+/*
+ * Run the iterations of the plugin for the current values of the
+ * sweep and store the averaged results
+ */
+static int plugin_bench(struct ts_options *tso, struct ts_results *tsr,
+			struct energy *energy, const char *path,
+			struct sweep *sweep)
+{
+	struct ts_plugin_results tspr = { 0 };
+	struct ts_work work = { 0 };
+	struct histogram *histogram, *run;
+	struct residency *residency = NULL;
+	const struct noise *noise = noise_last();
+	double avg_duration = 0, avg_energy = 0;
+	double avg_ops = 0, avg_bytes = 0;
+	unsigned long duration;
+	int i, ret, tries = 0;
+
+	if (tso->recalibrate && baseline_calibrate(energy, tso->calibrate))
+		WARNING("Failed to recalibrate the idle power\n");
+
+	timeline_begin("plugin", "path", path, "params", sweep_tag(sweep), NULL);
+
+	/* The latencies of all the kept iterations are merged */
+	histogram = calloc(2, sizeof(*histogram));
+	if (!histogram)
+		FATAL("Failed to allocate memory for the histogram\n");
+	run = &histogram[1];
+
+	for (i = 0; i < tso->iterations; i++) {
+		if (tso->cooldown)
+			thermal_cooldown(energy, tso->cooldown,
+					 tso->cooldown_timeout);
+
+		histogram_reset(run);
+		ret = _plugin_run(tso, path, &duration, energy, &work, sweep,
+				  run);
+		if (ret) {
+			WARNING("'%s' failed \n", path);
+			break;
+		}
+
+		if (noise_noisy()) {
+			if (tries++ < tso->reruns) {
+				WARNING("'%s' noisy, %.2lf%% foreign cpu, rerun\n",
+					path, noise->foreign);
+				tspr.reruns++;
+				i--;
+				continue;
+			}
+			tspr.flags |= RESULT_NOISY;
+		}
+		tries = 0;
+
+		histogram_merge(histogram, run);
+
+		avg_duration = avg(avg_duration, duration, i + 1);
+		avg_energy = avg(avg_energy, energy_cost(energy), i + 1);
+		avg_ops = avg(avg_ops, work.ops, i + 1);
+		avg_bytes = avg(avg_bytes, work.bytes, i + 1);
+		residency_average(&residency, i + 1);
+		tspr.noise = avg(tspr.noise, noise->foreign, i + 1);
+		tspr.irqs = avg(tspr.irqs, noise->irqs, i + 1);
+		tspr.load = avg(tspr.load, noise->load, i + 1);
+
+		if (thermal_throttled())
+			tspr.flags |= RESULT_THROTTLED;
+	}
+
+	tspr.path = path;
+	tspr.params = sweep_tag(sweep);
+	tspr.duration = avg_duration;
+	tspr.energy = avg_energy;
+	tspr.ops = avg_ops;
+	tspr.bytes = avg_bytes;
+	tspr.histogram = histogram->count ? histogram : NULL;
+	tspr.residency = residency;
+	overhead_apply(&tspr);
+	tspr.baseline = baseline_energy(energy, tspr.duration);
+
+	if (!ret && results_update(tsr, &tspr)) {
+		ERROR("Failed to update results for '%s'", path);
+		free(histogram);
+		residency_free(residency);
+		timeline_end("plugin");
+		return -1;
+	}
+
+	free(histogram);
+	residency_free(residency);
+
+	timeline_end("plugin");
+
+	return 0;
+}
 
 int plugin_is_excluded(char **exclude_list, const char *name)
 {
@@ -149,9 +481,7 @@ int plugins_run(struct ts_options *tso, struct ts_results *tsr, struct energy *e
 {
 	DIR *dir;
 	struct dirent dirent, *direntp;
-	unsigned long duration;
-	double avg_duration = 0;
-	double avg_energy = 0;
+	struct sweep *sweep;
 	regex_t regex;
 	char *path;
 	char **exclude_list;
@@ -173,8 +503,6 @@ int plugins_run(struct ts_options *tso, struct ts_results *tsr, struct energy *e
 
 	while (!readdir_r(dir, &dirent, &direntp)) {
 
-		int i, ret;
-
 		if (!direntp)
 			break;
 		
@@ -193,25 +521,19 @@ int plugins_run(struct ts_options *tso, struct ts_results *tsr, struct energy *e
 			return -1;
 		}
 
-		avg_duration = 0;
-		avg_energy   = 0;
-
-		for (i = 0; i < tso->iterations; i++) {
-			ret = _plugin_run(tso, path, &duration, energy);
-			if (ret) {
-				WARNING("'%s' failed \n", path);
-				break;
-			}
-
-			avg_duration = avg(avg_duration, duration, i + 1);
-			avg_energy = avg(avg_energy, energy_cost(energy), i + 1);
+		sweep = plugin_sweep(tso, path, direntp->d_name);
+		if (!sweep) {
+			WARNING("'%s' has invalid parameters\n", path);
+			free(path);
+			continue;
 		}
 
-		if (!ret && results_update(tsr, path, avg_duration, avg_energy)) {
-			ERROR("Failed to update results for '%s'",
-			      direntp->d_name);
-			return -1;
-		}
+		do {
+			if (plugin_bench(tso, tsr, energy, path, sweep))
+				return -1;
+		} while (sweep_next(sweep));
+
+		sweep_free(sweep);
 
 		free(path);
 	}
@@ -1,11 +1,94 @@
 #ifndef __TS_PLUGIN_H
 #define __TS_PLUGIN_H
 
+#include <pthread.h>
+
 struct ts_options;
 struct ts_results;
 struct energy;
 
+/*
+ * Throughput plugins export, instead of plugin_run():
+ *
+ *   int plugin_run_batch(void *arg, struct ts_work *work);
+ *
+ * which must do 'batch' operations and report the number of operations
+ * and bytes processed. The harness grows the batch until the run lasts
+ * long enough to be accurately measured.
+ */
+struct ts_work {
+	unsigned long batch; /* number of operations to do */
+	unsigned long ops;   /* number of operations done */
+	unsigned long bytes; /* number of bytes processed */
+};
+
+/*
+ * Multi-threaded plugins export, instead of plugin_run():
+ *
+ *   int plugin_run_worker(void *arg, struct ts_worker *worker);
+ *
+ * which is called on each worker of a pool created by the harness
+ * before the measurement, and optionally:
+ *
+ *   int plugin_workers(void *arg);
+ *
+ * returning the number of workers, one per cpu by default, and:
+ *
+ *   int plugin_init_worker(void *arg, struct ts_worker *worker);
+ *
+ * called once by each worker on its cpu when the pool is created, out
+ * of the measurement, as to first touch its part of the memory on its
+ * NUMA node. The workers are pinned following the topology: the
+ * physical cores first, then their siblings. The time and the energy are measured from the release
+ * of the workers to the end of the last one.
+ *
+ * The workers doing the operations asked in work.batch and reporting
+ * them in work.ops/work.bytes are throughput workers, their batch is
+ * grown by the harness as for plugin_run_batch().
+ */
+struct ts_worker {
+	int id;                     /* 0 .. nrworkers - 1 */
+	int nrworkers;
+	int cpu;                    /* cpu the worker is pinned on */
+	pthread_barrier_t *barrier; /* synchronize the workers */
+	struct ts_work work;
+};
+
+/*
+ * Plugins recording the latency of their operations, with the
+ * histogram API of histogram.h, export:
+ *
+ *   void plugin_histogram(void *arg, struct histogram *histogram);
+ *
+ * which merges the latencies recorded since the last call into the
+ * histogram and starts over. It is called by the harness after each
+ * measurement, the multi-threaded plugins merge there the histograms
+ * of their workers.
+ */
+struct histogram;
+
+/*
+ * Plugins taking parameters export a NULL terminated array:
+ *
+ *   struct ts_param plugin_params[] = {
+ *	{ .name = "size", .range = "4096:65536:*2" },
+ *	{ NULL },
+ *   };
+ *
+ * The harness runs the cartesian product of the values of the ranges,
+ * which can be overridden with the sweep option. Before each prerun
+ * the value fields are set to the current values of the sweep and the
+ * array is passed as parameter to plugin_prerun().
+ */
+struct ts_param {
+	const char *name;
+	const char *range;
+	const char *value;
+};
+
 extern int plugins_run(struct ts_options *,
 		       struct ts_results *, struct energy *);
 
+extern void plugins_fini(void);
+
 #endif
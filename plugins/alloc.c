@@ -0,0 +1,361 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "common.h"
+#include "cache.h"
+
+/*
+ * Memory allocator stress: the workers of the pool allocate and free
+ * with malloc() and free(), so the allocator measured is the one the
+ * harness runs with, eg. LD_PRELOAD=libjemalloc.so ts ... The patterns
+ * are:
+ *
+ * - short:  each allocation is freed right away
+ * - long:   each allocation replaces a random one of 'live' allocations
+ *           kept by the worker, fragmenting the heap
+ * - remote: each worker frees the allocations of the previous worker,
+ *           passed through a ring, and the allocator has to move the
+ *           memory between the threads
+ *
+ * with sizes in the small, medium or large classes, or a mix of 80%
+ * small, 15% medium and 5% large. One byte per page of each allocation
+ * is written. An operation is an allocation, so J/op is the energy per
+ * allocation. The growth of the RSS over the live memory and the page
+ * faults per allocation are reported when the plugin ends.
+ */
+#define ALLOC_PAGE 4096
+#define ALLOC_RING 1024 /* power of two */
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
+
+const char *plugin_name = "Alloc";
+const char *plugin_desc = "Memory allocator throughput and fragmentation";
+
+struct ts_param plugin_params[] = {
+	{ .name = "pattern", .range = "short,long,remote" },
+	{ .name = "sizes",   .range = "small,medium,large,mixed" },
+	{ .name = "workers", .range = "cores" },
+	{ .name = "live",    .range = "4096" }, /* per worker, long pattern */
+	{ NULL },
+};
+
+enum { SHORT, LONG, REMOTE };
+
+static const char *patterns[] = { "short", "long", "remote" };
+
+static const struct alloc_class {
+	const char *name;
+	size_t min;
+	size_t max;
+} classes[] = {
+	{ "small",  16,    256 },
+	{ "medium", 1024,  32768 },
+	{ "large",  65536, 1048576 },
+	{ "mixed",  0,     0 },
+};
+
+struct alloc_chunk {
+	void *ptr;
+	size_t size;
+};
+
+struct alloc_worker {
+	unsigned int seed;
+	unsigned long ops;
+	struct alloc_chunk *live;
+	/* Allocations of this worker to be freed by the next one */
+	unsigned long head __attribute__((aligned(64)));
+	unsigned long tail __attribute__((aligned(64)));
+	struct alloc_chunk ring[ALLOC_RING];
+} __attribute__((aligned(64)));
+
+static struct alloc {
+	int pattern;
+	const struct alloc_class *class;
+	int nrworkers;  /* zero for one per cpu */
+	int nrslots;    /* the most workers the pool may start */
+	int nrran;      /* workers started by the pool */
+	int live;
+	struct alloc_worker *workers;
+	long rss;       /* at the start, in pages */
+	struct rusage rusage;
+} alloc;
+
+static long alloc_rss(void)
+{
+	long size, rss = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+
+	if (fscanf(f, "%ld %ld", &size, &rss) != 2)
+		rss = 0;
+
+	fclose(f);
+
+	return rss;
+}
+
+static size_t alloc_size(struct alloc *a, unsigned int *seed)
+{
+	const struct alloc_class *class = a->class;
+	int r;
+
+	if (!class->max) {
+		r = rand_r(seed) % 100;
+		class = r < 80 ? &classes[0] : r < 95 ? &classes[1] : &classes[2];
+	}
+
+	return class->min + rand_r(seed) % (class->max - class->min + 1);
+}
+
+static void *alloc_touch(size_t size)
+{
+	char *ptr;
+	size_t i;
+
+	ptr = malloc(size);
+	if (!ptr)
+		return NULL;
+
+	for (i = 0; i < size; i += ALLOC_PAGE)
+		ptr[i] = 1;
+
+	return ptr;
+}
+
+/*
+ * Free the allocations passed by the previous worker
+ */
+static void alloc_drain(struct alloc_worker *prev)
+{
+	unsigned long head, tail;
+
+	head = __atomic_load_n(&prev->head, __ATOMIC_ACQUIRE);
+	tail = prev->tail;
+
+	for (; tail != head; tail++)
+		free(prev->ring[tail % ALLOC_RING].ptr);
+
+	__atomic_store_n(&prev->tail, tail, __ATOMIC_RELEASE);
+}
+
+static int alloc_run(struct alloc *a, struct alloc_worker *w,
+		     struct alloc_worker *prev, unsigned long nrallocs)
+{
+	struct alloc_chunk chunk;
+	unsigned long i;
+	int slot;
+
+	for (i = 0; i < nrallocs; i++) {
+
+		chunk.size = alloc_size(a, &w->seed);
+		chunk.ptr = alloc_touch(chunk.size);
+		if (!chunk.ptr) {
+			ERROR("Failed to allocate %zu bytes\n", chunk.size);
+			return -1;
+		}
+
+		switch (a->pattern) {
+		case SHORT:
+			free(chunk.ptr);
+			break;
+		case LONG:
+			slot = rand_r(&w->seed) % a->live;
+			free(w->live[slot].ptr);
+			w->live[slot] = chunk;
+			break;
+		case REMOTE:
+			/* Free it locally when the next worker is behind */
+			if (w->head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) ==
+			    ALLOC_RING) {
+				free(chunk.ptr);
+			} else {
+				w->ring[w->head % ALLOC_RING] = chunk;
+				__atomic_store_n(&w->head, w->head + 1, __ATOMIC_RELEASE);
+			}
+			alloc_drain(prev);
+			break;
+		}
+	}
+
+	w->ops += nrallocs;
+
+	return 0;
+}
+
+/*
+ * Memory still allocated: the live allocations and the rings
+ */
+static size_t alloc_live(struct alloc *a)
+{
+	struct alloc_worker *w;
+	unsigned long tail;
+	size_t live = 0;
+	int i, j;
+
+	for (i = 0; i < a->nrran; i++) {
+		w = &a->workers[i];
+
+		for (j = 0; w->live && j < a->live; j++)
+			live += w->live[j].size;
+
+		for (tail = w->tail; tail != w->head; tail++)
+			live += w->ring[tail % ALLOC_RING].size;
+	}
+
+	return live;
+}
+
+static void alloc_show_allocator(void)
+{
+	Dl_info info;
+
+	if (dladdr(dlsym(RTLD_DEFAULT, "malloc"), &info) && info.dli_fname)
+		NOTICE("malloc() from %s\n", info.dli_fname);
+}
+
+void *plugin_prerun(struct ts_param *params)
+{
+	const char *pattern = plugin_param(params, "pattern");
+	const char *sizes = plugin_param(params, "sizes");
+	int (*trim)(size_t);
+	int i;
+
+	memset(&alloc, 0, sizeof(alloc));
+
+	for (i = 0, alloc.pattern = -1; i < ARRAY_SIZE(patterns); i++)
+		if (!strcmp(patterns[i], pattern))
+			alloc.pattern = i;
+
+	for (i = 0; i < ARRAY_SIZE(classes); i++)
+		if (!strcmp(classes[i].name, sizes))
+			alloc.class = &classes[i];
+
+	if (alloc.pattern < 0 || !alloc.class) {
+		ERROR("Unknown pattern '%s' or sizes '%s'\n", pattern, sizes);
+		return NULL;
+	}
+
+	alloc.nrworkers = cpu_nrworkers(plugin_param(params, "workers"));
+	alloc.live = plugin_param_long(params, "live");
+
+	if (alloc.nrworkers < 0 || alloc.live <= 0) {
+		ERROR("Invalid workers or live allocations\n");
+		return NULL;
+	}
+
+	/* One per online cpu are started, the offline ones are not known */
+	alloc.nrslots = alloc.nrworkers ? alloc.nrworkers :
+		sysconf(_SC_NPROCESSORS_CONF);
+	alloc.nrran = 0;
+
+	if (posix_memalign((void **)&alloc.workers, 64,
+			   sizeof(*alloc.workers) * alloc.nrslots))
+		FATAL("Failed to allocate memory for the workers\n");
+
+	memset(alloc.workers, 0, sizeof(*alloc.workers) * alloc.nrslots);
+
+	for (i = 0; i < alloc.nrslots; i++) {
+
+		alloc.workers[i].seed = i;
+
+		if (alloc.pattern != LONG)
+			continue;
+
+		alloc.workers[i].live = calloc(alloc.live, sizeof(struct alloc_chunk));
+		if (!alloc.workers[i].live)
+			FATAL("Failed to allocate memory for the live allocations\n");
+	}
+
+	alloc_show_allocator();
+
+	/* Give back the memory freed by the previous runs, with glibc */
+	trim = dlsym(RTLD_DEFAULT, "malloc_trim");
+	if (trim)
+		trim(0);
+
+	alloc.rss = alloc_rss();
+	getrusage(RUSAGE_SELF, &alloc.rusage);
+
+	return &alloc;
+}
+
+int plugin_workers(void *arg)
+{
+	struct alloc *a = arg;
+
+	return a ? a->nrworkers : 0;
+}
+
+int plugin_run_worker(void *arg, struct ts_worker *worker)
+{
+	struct alloc *a = arg;
+	struct alloc_worker *w, *prev;
+	int ret;
+
+	if (!a || worker->id >= a->nrslots)
+		return -1;
+
+	if (!worker->id)
+		a->nrran = worker->nrworkers;
+
+	w = &a->workers[worker->id];
+	prev = &a->workers[(worker->id + worker->nrworkers - 1) % worker->nrworkers];
+
+	ret = alloc_run(a, w, prev, worker->work.batch);
+
+	worker->work.ops = worker->work.batch;
+
+	return ret;
+}
+
+void plugin_postrun(void *arg)
+{
+	struct alloc *a = arg;
+	struct alloc_worker *w;
+	struct rusage rusage;
+	unsigned long ops = 0;
+	long rss;
+	size_t live;
+	int i, j;
+
+	if (!a)
+		return;
+
+	rss = (alloc_rss() - a->rss) * sysconf(_SC_PAGESIZE);
+	live = alloc_live(a);
+	getrusage(RUSAGE_SELF, &rusage);
+
+	for (i = 0; i < a->nrran; i++)
+		ops += a->workers[i].ops;
+
+	NOTICE("RSS grew by %ld KB for %zu KB allocated\n", rss / 1024, live / 1024);
+
+	if (ops)
+		NOTICE("%.2f minor and %.2f major page faults per 1000 allocations\n",
+		       (rusage.ru_minflt - a->rusage.ru_minflt) * 1000.0 / ops,
+		       (rusage.ru_majflt - a->rusage.ru_majflt) * 1000.0 / ops);
+
+	for (i = 0; i < a->nrslots; i++) {
+		w = &a->workers[i];
+
+		for (j = 0; w->live && j < a->live; j++)
+			free(w->live[j].ptr);
+
+		for (; w->tail != w->head; w->tail++)
+			free(w->ring[w->tail % ALLOC_RING].ptr);
+
+		free(w->live);
+	}
+
+	free(a->workers);
+	a->workers = NULL;
+}
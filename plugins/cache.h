@@ -0,0 +1,168 @@
+#ifndef __PLUGIN_CACHE_H
+#define __PLUGIN_CACHE_H
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Cpu topology and caches description from sysfs, for the plugins
+ * sizing their working sets or their number of workers
+ */
+#define CPU_SYSFS "/sys/devices/system/cpu"
+
+struct cache {
+	int level;
+	size_t size;
+	int first; /* first cpu sharing the cache */
+};
+
+static inline FILE *cpu_sysfs_open(int cpu, const char *file)
+{
+	char path[128];
+
+	snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/%s", cpu, file);
+
+	return fopen(path, "r");
+}
+
+/*
+ * Read the first number of a sysfs file, which is also the first cpu
+ * of the cpu lists
+ */
+static inline long cpu_sysfs_read(int cpu, const char *file)
+{
+	FILE *f;
+	long value;
+
+	f = cpu_sysfs_open(cpu, file);
+	if (!f)
+		return -1;
+
+	if (fscanf(f, "%ld", &value) != 1)
+		value = -1;
+
+	fclose(f);
+
+	return value;
+}
+
+/*
+ * Read a cpu list file, eg. "0-3,8-11", into a cpu set
+ */
+static inline int cpu_sysfs_cpuset(int cpu, const char *file, cpu_set_t *cpuset)
+{
+	char list[1024], *token, *saveptr;
+	int first, last;
+	FILE *f;
+
+	f = cpu_sysfs_open(cpu, file);
+	if (!f)
+		return -1;
+
+	if (!fgets(list, sizeof(list), f)) {
+		fclose(f);
+		return -1;
+	}
+
+	fclose(f);
+
+	CPU_ZERO(cpuset);
+
+	for (token = strtok_r(list, ",\n", &saveptr); token;
+	     token = strtok_r(NULL, ",\n", &saveptr)) {
+
+		if (sscanf(token, "%d-%d", &first, &last) != 2)
+			last = first = atoi(token);
+
+		for (; first <= last; first++)
+			CPU_SET(first, cpuset);
+	}
+
+	return 0;
+}
+
+/*
+ * Fill the data and unified caches of a cpu, from the closest to the
+ * farthest, and return their number
+ */
+static inline int cpu_caches(int cpu, struct cache *caches, int nrcaches)
+{
+	char file[64], type[32], unit;
+	size_t size;
+	int i, nr = 0;
+	FILE *f;
+
+	for (i = 0; nr < nrcaches; i++) {
+
+		snprintf(file, sizeof(file), "cache/index%d/type", i);
+		f = cpu_sysfs_open(cpu, file);
+		if (!f)
+			break;
+
+		if (fscanf(f, "%31s", type) != 1)
+			type[0] = '\0';
+		fclose(f);
+
+		if (!strcmp(type, "Instruction"))
+			continue;
+
+		snprintf(file, sizeof(file), "cache/index%d/size", i);
+		f = cpu_sysfs_open(cpu, file);
+		if (!f)
+			continue;
+
+		unit = 'K';
+		if (fscanf(f, "%zu%c", &size, &unit) < 1)
+			size = 0;
+		fclose(f);
+
+		caches[nr].size = size * (unit == 'M' ? 1024 * 1024 : 1024);
+
+		snprintf(file, sizeof(file), "cache/index%d/level", i);
+		caches[nr].level = cpu_sysfs_read(cpu, file);
+
+		snprintf(file, sizeof(file), "cache/index%d/shared_cpu_list", i);
+		caches[nr].first = cpu_sysfs_read(cpu, file);
+
+		nr++;
+	}
+
+	return nr;
+}
+
+/*
+ * Number of workers for a placement: one per physical core, one per
+ * package, or zero for one per cpu, as the harness pool spreads them
+ * this way. A number is taken as is.
+ */
+static inline int cpu_nrworkers(const char *placement)
+{
+	const char *file;
+	int cpu, nrcpus, nr = 0;
+
+	if (!strcmp(placement, "cpus"))
+		return 0;
+	else if (!strcmp(placement, "cores"))
+		file = "topology/thread_siblings_list";
+	else if (!strcmp(placement, "packages"))
+		file = "topology/core_siblings_list";
+	else if (strspn(placement, "0123456789") == strlen(placement))
+		return atoi(placement);
+	else {
+		ERROR("Unknown workers placement '%s'\n", placement);
+		return -1;
+	}
+
+	nrcpus = sysconf(_SC_NPROCESSORS_CONF);
+
+	for (cpu = 0; cpu < nrcpus; cpu++)
+		if (cpu_sysfs_read(cpu, file) == cpu)
+			nr++;
+
+	return nr;
+}
+
+#endif
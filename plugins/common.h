@@ -1,5 +1,10 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "../trace.h"
 #include "../options.h"
+#include "../plugin.h"
+#include "../histogram.h"
 
 extern const char *plugin_name;
 extern const char *plugin_desc;
@@ -13,3 +18,30 @@ void plugin_init(struct ts_options *tso)
 	TRACE("Plugin initialized\n");
 }
 
+/*
+ * Wait for all the workers of the pool, see struct ts_worker
+ */
+static inline void worker_barrier(struct ts_worker *worker)
+{
+	pthread_barrier_wait(worker->barrier);
+}
+
+/*
+ * Value of the parameter for the current run of the sweep, from the
+ * array passed to plugin_prerun(), see struct ts_param
+ */
+static inline const char *plugin_param(struct ts_param *params, const char *name)
+{
+	for (; params && params->name; params++)
+		if (!strcmp(params->name, name))
+			return params->value;
+
+	return NULL;
+}
+
+static inline long plugin_param_long(struct ts_param *params, const char *name)
+{
+	const char *value = plugin_param(params, name);
+
+	return value ? strtol(value, NULL, 0) : 0;
+}
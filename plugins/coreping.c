@@ -0,0 +1,386 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "common.h"
+#include "../topology.h"
+
+/*
+ * Core to core communication latency: a partner thread pinned on one
+ * cpu of a pair answers the pings of the harness pinned on the other
+ * one. A ping and its answer is an operation, so the time and the
+ * energy per operation are those of a round trip, with:
+ *
+ * - atomic: the two cpus bounce a cache line with atomic stores
+ * - futex:  the same with futex waits and wakes
+ * - pipe:   a byte through a pipe each way
+ *
+ * The pairs are built from the topology when the plugin is loaded and
+ * are labelled with their relationship: "smt" siblings, cores of the
+ * same "package" or "cross" package, eg. "pair=package.0-2". Each pair
+ * is a value of the sweep so the matrix is stored in the results and
+ * compared like any other parameter. All the pairs are measured up to
+ * COREPING_ALL cpus, beyond only the pairs from the first cpu of each
+ * package to the first thread of every core and to its SMT siblings.
+ */
+#define COREPING_ALL  16
+#define COREPING_STOP ULONG_MAX
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() do { } while (0)
+#endif
+
+const char *plugin_name = "Coreping";
+const char *plugin_desc = "Core to core round trip latency";
+
+struct ts_param plugin_params[] = {
+	{ .name = "method", .range = "atomic,futex,pipe" },
+	{ .name = "pair",   .range = "none" }, /* built from the topology */
+	{ NULL },
+};
+
+enum { ATOMIC, FUTEX, PIPE };
+
+struct coreping_cpu {
+	int cpu;
+	int package;
+	int core;
+};
+
+static struct coreping {
+	int method;
+	int cpus[2];
+	pthread_t partner;
+	int started;
+	int ping[2];
+	int pong[2];
+	unsigned long seq;
+	cpu_set_t cpuset; /* affinity of the harness to restore */
+	struct histogram histogram;
+	unsigned long line __attribute__((aligned(64)));
+	unsigned int futex __attribute__((aligned(64)));
+} coreping;
+
+static char *coreping_range;
+
+static int coreping_cpus(struct topology *topology, struct coreping_cpu **cpus)
+{
+	int i, j, k, nr = 0;
+
+	*cpus = NULL;
+
+	for (i = 0; i < topology->nrpackages; i++) {
+		struct package *package = &topology->package[i];
+
+		for (j = 0; j < package->nrcores; j++) {
+			struct core *core = &package->core[j];
+
+			for (k = 0; k < core->nrthreads; k++) {
+
+				*cpus = realloc(*cpus, sizeof(**cpus) * (nr + 1));
+				if (!*cpus)
+					FATAL("Failed to allocate memory for the cpus\n");
+
+				(*cpus)[nr].cpu = core->thread[k].os_id;
+				(*cpus)[nr].package = i;
+				(*cpus)[nr].core = j;
+				nr++;
+			}
+		}
+	}
+
+	return nr;
+}
+
+static const char *coreping_relation(struct coreping_cpu *a, struct coreping_cpu *b)
+{
+	if (a->package != b->package)
+		return "cross";
+
+	return a->core == b->core ? "smt" : "package";
+}
+
+static void coreping_add_pair(struct coreping_cpu *a, struct coreping_cpu *b)
+{
+	char *range;
+
+	if (asprintf(&range, "%s%s%s.%d-%d", coreping_range ? coreping_range : "",
+		     coreping_range ? "," : "", coreping_relation(a, b),
+		     a->cpu, b->cpu) < 0)
+		FATAL("Failed to allocate memory for the pairs\n");
+
+	free(coreping_range);
+	coreping_range = range;
+}
+
+/*
+ * Build the range of the pairs when the plugin is loaded, before the
+ * harness reads the parameters
+ */
+static void __attribute__((constructor)) coreping_pairs(void)
+{
+	trace_level_t level = trace_level;
+	struct topology *topology;
+	struct coreping_cpu *cpus;
+	int i, j, nr;
+
+	/* The topology discovery of the harness was already traced */
+	trace_set_level(WARNING);
+	topology = topology_init();
+	trace_set_level(level);
+	if (!topology)
+		return;
+
+	nr = coreping_cpus(topology, &cpus);
+
+	for (i = 0; i < nr; i++) {
+		for (j = i + 1; j < nr; j++) {
+
+			if (nr > COREPING_ALL) {
+				/* From the first cpu of a package */
+				if (i && cpus[i].package == cpus[i - 1].package)
+					continue;
+				/* to its siblings or the first thread of a core */
+				if (cpus[j].core == cpus[j - 1].core &&
+				    cpus[j].package == cpus[j - 1].package &&
+				    (cpus[j].package != cpus[i].package ||
+				     cpus[j].core != cpus[i].core))
+					continue;
+			}
+
+			coreping_add_pair(&cpus[i], &cpus[j]);
+		}
+	}
+
+	free(cpus);
+	topology_fini(topology);
+	free(topology);
+
+	if (coreping_range)
+		plugin_params[1].range = coreping_range;
+}
+
+static void __attribute__((destructor)) coreping_pairs_free(void)
+{
+	free(coreping_range);
+}
+
+static long futex(unsigned int *uaddr, int op, unsigned int val)
+{
+	return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static int coreping_pin(int cpu)
+{
+	cpu_set_t cpuset;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+
+	return sched_setaffinity(0, sizeof(cpuset), &cpuset);
+}
+
+/*
+ * The partner answers the odd sequence numbers with the next one
+ */
+static void *coreping_partner(void *arg)
+{
+	struct coreping *cp = arg;
+	unsigned long value;
+	unsigned int word;
+	char byte;
+
+	if (coreping_pin(cp->cpus[1]))
+		WARNING("Failed to pin the partner on cpu%d: %m\n", cp->cpus[1]);
+
+	switch (cp->method) {
+	case ATOMIC:
+		while ((value = __atomic_load_n(&cp->line, __ATOMIC_ACQUIRE)) !=
+		       COREPING_STOP) {
+			if (value & 1)
+				__atomic_store_n(&cp->line, value + 1, __ATOMIC_RELEASE);
+			else
+				cpu_relax();
+		}
+		break;
+	case FUTEX:
+		while ((word = __atomic_load_n(&cp->futex, __ATOMIC_ACQUIRE)) !=
+		       (unsigned int)COREPING_STOP) {
+			if (!(word & 1)) {
+				futex(&cp->futex, FUTEX_WAIT_PRIVATE, word);
+				continue;
+			}
+			__atomic_store_n(&cp->futex, word + 1, __ATOMIC_RELEASE);
+			futex(&cp->futex, FUTEX_WAKE_PRIVATE, 1);
+		}
+		break;
+	case PIPE:
+		while (read(cp->ping[0], &byte, 1) == 1)
+			if (write(cp->pong[1], &byte, 1) != 1)
+				break;
+		break;
+	}
+
+	return NULL;
+}
+
+static int coreping_round_trip(struct coreping *cp)
+{
+	unsigned int word;
+	char byte = 0;
+
+	cp->seq += 2;
+
+	switch (cp->method) {
+	case ATOMIC:
+		__atomic_store_n(&cp->line, cp->seq - 1, __ATOMIC_RELEASE);
+		while (__atomic_load_n(&cp->line, __ATOMIC_ACQUIRE) != cp->seq)
+			cpu_relax();
+		break;
+	case FUTEX:
+		__atomic_store_n(&cp->futex, (unsigned int)cp->seq - 1, __ATOMIC_RELEASE);
+		futex(&cp->futex, FUTEX_WAKE_PRIVATE, 1);
+		while ((word = __atomic_load_n(&cp->futex, __ATOMIC_ACQUIRE)) !=
+		       (unsigned int)cp->seq)
+			futex(&cp->futex, FUTEX_WAIT_PRIVATE, word);
+		break;
+	case PIPE:
+		if (write(cp->ping[1], &byte, 1) != 1 ||
+		    read(cp->pong[0], &byte, 1) != 1) {
+			ERROR("pipe: %m\n");
+			return -1;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+void *plugin_prerun(struct ts_param *params)
+{
+	const char *method = plugin_param(params, "method");
+	const char *pair = plugin_param(params, "pair");
+
+	memset(&coreping, 0, sizeof(coreping));
+	coreping.ping[0] = coreping.ping[1] = -1;
+	coreping.pong[0] = coreping.pong[1] = -1;
+
+	coreping.method = !strcmp(method, "atomic") ? ATOMIC :
+		!strcmp(method, "futex") ? FUTEX :
+		!strcmp(method, "pipe") ? PIPE : -1;
+
+	if (coreping.method < 0) {
+		ERROR("Unknown method '%s'\n", method);
+		return NULL;
+	}
+
+	/* The relationship label is optional */
+	if (!strcmp(pair, "none")) {
+		ERROR("At least two cpus are needed\n");
+		return NULL;
+	}
+
+	if (sscanf(pair, "%d-%d", &coreping.cpus[0], &coreping.cpus[1]) != 2 &&
+	    sscanf(pair, "%*[^.].%d-%d", &coreping.cpus[0], &coreping.cpus[1]) != 2) {
+		ERROR("Invalid pair '%s'\n", pair);
+		return NULL;
+	}
+
+	sched_getaffinity(0, sizeof(coreping.cpuset), &coreping.cpuset);
+
+	if (coreping.method == PIPE && (pipe(coreping.ping) || pipe(coreping.pong))) {
+		ERROR("pipe: %m\n");
+		return &coreping;
+	}
+
+	if (coreping_pin(coreping.cpus[0])) {
+		ERROR("Failed to pin on cpu%d: %m\n", coreping.cpus[0]);
+		return &coreping;
+	}
+
+	if (pthread_create(&coreping.partner, NULL, coreping_partner, &coreping)) {
+		ERROR("Failed to create the partner thread\n");
+		return &coreping;
+	}
+
+	coreping.started = 1;
+
+	return &coreping;
+}
+
+int plugin_run_batch(void *arg, struct ts_work *work)
+{
+	struct coreping *cp = arg;
+	unsigned long i;
+	uint64_t start;
+
+	if (!cp || !cp->started)
+		return -1;
+
+	for (i = 0; i < work->batch; i++) {
+
+		start = histogram_now();
+
+		if (coreping_round_trip(cp))
+			return -1;
+
+		histogram_record(&cp->histogram, histogram_now() - start);
+	}
+
+	work->ops = work->batch;
+
+	return 0;
+}
+
+void plugin_histogram(void *arg, struct histogram *histogram)
+{
+	struct coreping *cp = arg;
+
+	if (!cp)
+		return;
+
+	histogram_merge(histogram, &cp->histogram);
+	histogram_reset(&cp->histogram);
+}
+
+void plugin_postrun(void *arg)
+{
+	struct coreping *cp = arg;
+
+	if (!cp)
+		return;
+
+	if (cp->started) {
+		__atomic_store_n(&cp->line, COREPING_STOP, __ATOMIC_RELEASE);
+		__atomic_store_n(&cp->futex, (unsigned int)COREPING_STOP,
+				 __ATOMIC_RELEASE);
+		futex(&cp->futex, FUTEX_WAKE_PRIVATE, 1);
+
+		/* The partner reads the end of file of the ping pipe */
+		if (cp->ping[1] >= 0)
+			close(cp->ping[1]);
+		cp->ping[1] = -1;
+
+		pthread_join(cp->partner, NULL);
+	}
+
+	if (cp->ping[0] >= 0) {
+		close(cp->ping[0]);
+		close(cp->pong[0]);
+		close(cp->pong[1]);
+	}
+
+	if (cp->ping[1] >= 0)
+		close(cp->ping[1]);
+
+	sched_setaffinity(0, sizeof(cp->cpuset), &cp->cpuset);
+}
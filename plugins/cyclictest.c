@@ -0,0 +1,274 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+
+#include "common.h"
+
+/*
+ * Periodic wakeups in the way of cyclictest: each worker waits for the
+ * next period and records how late it woke up. The waits are:
+ *
+ * - nanosleep: clock_nanosleep() to the absolute time of the period
+ * - timerfd:   a periodic timerfd
+ * - poll:      busy polling the clock, the cpu never goes idle
+ *
+ * Comparing the energy per wakeup and the latencies of the sleeping
+ * waits and of the busy polling gives the trade-off of the idle states,
+ * which the timer slack and the period change.
+ */
+#define NSEC_PER_SEC  1000000000ULL
+#define NSEC_PER_USEC 1000ULL
+
+const char *plugin_name = "Cyclictest";
+const char *plugin_desc = "Periodic timer wakeup latency";
+
+struct ts_param plugin_params[] = {
+	{ .name = "wait",     .range = "nanosleep,timerfd,poll" },
+	{ .name = "period",   .range = "1000" },  /* usecs */
+	{ .name = "threads",  .range = "1" },
+	{ .name = "slack",    .range = "50000" }, /* nsecs */
+	{ .name = "priority", .range = "0" },     /* SCHED_FIFO if not zero */
+	{ NULL },
+};
+
+enum { NANOSLEEP, TIMERFD, POLL };
+
+static struct cyclictest {
+	int wait;
+	uint64_t period;
+	int threads;
+	unsigned long slack;
+	int priority;
+	struct histogram *histograms; /* one per worker */
+	int nrhistograms;
+} cyclictest;
+
+static struct timespec ns_to_timespec(uint64_t ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / NSEC_PER_SEC,
+		.tv_nsec = ns % NSEC_PER_SEC,
+	};
+
+	return ts;
+}
+
+static int cyclictest_nanosleep(struct cyclictest *ct, struct histogram *histogram,
+				unsigned long nrwakeups)
+{
+	struct timespec ts;
+	uint64_t next;
+	unsigned long i;
+	int ret;
+
+	next = histogram_now();
+
+	for (i = 0; i < nrwakeups; i++) {
+
+		next += ct->period;
+		ts = ns_to_timespec(next);
+
+		/* The error is returned, not set in errno */
+		while ((ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					      &ts, NULL)) == EINTR)
+			;
+
+		if (ret) {
+			ERROR("clock_nanosleep: %s\n", strerror(ret));
+			return -1;
+		}
+
+		histogram_record(histogram, histogram_now() - next);
+	}
+
+	return 0;
+}
+
+static int cyclictest_timerfd(struct cyclictest *ct, struct histogram *histogram,
+			      unsigned long nrwakeups)
+{
+	struct itimerspec its;
+	uint64_t first, expirations, expired = 0;
+	int fd, ret = 0;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (fd < 0) {
+		ERROR("timerfd_create: %m\n");
+		return -1;
+	}
+
+	first = histogram_now() + ct->period;
+	its.it_value = ns_to_timespec(first);
+	its.it_interval = ns_to_timespec(ct->period);
+
+	if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+		ERROR("timerfd_settime: %m\n");
+		close(fd);
+		return -1;
+	}
+
+	while (expired < nrwakeups) {
+
+		if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+			ERROR("timerfd read: %m\n");
+			ret = -1;
+			break;
+		}
+
+		/* The missed periods are overruns, the latency is from the last one */
+		expired += expirations;
+
+		histogram_record(histogram, histogram_now() -
+				 (first + (expired - 1) * ct->period));
+	}
+
+	close(fd);
+
+	return ret;
+}
+
+static int cyclictest_poll(struct cyclictest *ct, struct histogram *histogram,
+			   unsigned long nrwakeups)
+{
+	uint64_t next, now;
+	unsigned long i;
+
+	next = histogram_now();
+
+	for (i = 0; i < nrwakeups; i++) {
+
+		next += ct->period;
+
+		do {
+			now = histogram_now();
+		} while (now < next);
+
+		histogram_record(histogram, now - next);
+	}
+
+	return 0;
+}
+
+void *plugin_prerun(struct ts_param *params)
+{
+	const char *wait = plugin_param(params, "wait");
+
+	free(cyclictest.histograms);
+	memset(&cyclictest, 0, sizeof(cyclictest));
+
+	cyclictest.wait = !strcmp(wait, "nanosleep") ? NANOSLEEP :
+		!strcmp(wait, "timerfd") ? TIMERFD :
+		!strcmp(wait, "poll") ? POLL : -1;
+	cyclictest.period = plugin_param_long(params, "period") * NSEC_PER_USEC;
+	cyclictest.threads = plugin_param_long(params, "threads");
+	cyclictest.slack = plugin_param_long(params, "slack");
+	cyclictest.priority = plugin_param_long(params, "priority");
+
+	if (cyclictest.wait < 0) {
+		ERROR("Unknown wait '%s'\n", wait);
+		return NULL;
+	}
+
+	if (!cyclictest.period || cyclictest.threads < 0) {
+		ERROR("Invalid period or number of threads\n");
+		return NULL;
+	}
+
+	/* A worker per cpu when the number of threads is zero */
+	cyclictest.nrhistograms = cyclictest.threads ? cyclictest.threads :
+		sysconf(_SC_NPROCESSORS_CONF);
+
+	cyclictest.histograms = calloc(cyclictest.nrhistograms,
+				       sizeof(*cyclictest.histograms));
+	if (!cyclictest.histograms)
+		FATAL("Failed to allocate memory for the histograms\n");
+
+	return &cyclictest;
+}
+
+int plugin_workers(void *arg)
+{
+	struct cyclictest *ct = arg;
+
+	return ct ? ct->threads : 0;
+}
+
+int plugin_run_worker(void *arg, struct ts_worker *worker)
+{
+	struct cyclictest *ct = arg;
+	struct histogram *histogram;
+	struct sched_param param = { .sched_priority = ct ? ct->priority : 0 };
+	struct sched_param saved_param;
+	unsigned long nrwakeups = worker->work.batch;
+	int ret = -1, saved_policy, rt = 0;
+	long saved_slack;
+
+	if (!ct || worker->id >= ct->nrhistograms)
+		return -1;
+
+	histogram = &ct->histograms[worker->id];
+
+	/* The pool threads are restored for the next runs and plugins */
+	saved_slack = prctl(PR_GET_TIMERSLACK);
+
+	if (prctl(PR_SET_TIMERSLACK, ct->slack))
+		WARNING("Failed to set the timer slack: %m\n");
+
+	if (ct->priority) {
+		if (pthread_getschedparam(pthread_self(), &saved_policy, &saved_param) ||
+		    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))
+			WARNING("Failed to set the realtime priority\n");
+		else
+			rt = 1;
+	}
+
+	switch (ct->wait) {
+	case NANOSLEEP:
+		ret = cyclictest_nanosleep(ct, histogram, nrwakeups);
+		break;
+	case TIMERFD:
+		ret = cyclictest_timerfd(ct, histogram, nrwakeups);
+		break;
+	case POLL:
+		ret = cyclictest_poll(ct, histogram, nrwakeups);
+		break;
+	}
+
+	worker->work.ops = nrwakeups;
+
+	if (rt && pthread_setschedparam(pthread_self(), saved_policy, &saved_param))
+		WARNING("Failed to restore the scheduling policy\n");
+
+	if (saved_slack > 0 && prctl(PR_SET_TIMERSLACK, saved_slack))
+		WARNING("Failed to restore the timer slack: %m\n");
+
+	return ret;
+}
+
+void plugin_histogram(void *arg, struct histogram *histogram)
+{
+	struct cyclictest *ct = arg;
+	int i;
+
+	if (!ct)
+		return;
+
+	for (i = 0; i < ct->nrhistograms; i++) {
+		histogram_merge(histogram, &ct->histograms[i]);
+		histogram_reset(&ct->histograms[i]);
+	}
+}
+
+void plugin_postrun(void *arg)
+{
+	free(cyclictest.histograms);
+	cyclictest.histograms = NULL;
+}
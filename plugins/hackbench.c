@@ -0,0 +1,485 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "common.h"
+#include "cache.h"
+
+/*
+ * Scheduler and IPC messaging benchmark in the way of hackbench: the
+ * tasks are split in groups of senders and receivers, each sender of
+ * a group sends 'loops' messages to each receiver of the group for
+ * each operation of the batch.
+ *
+ * The tasks are threads or processes, created before the measurement
+ * and waiting for the number of loops on a control pipe. A message
+ * carries its send time, the receiver records the time it took to be
+ * woken up and get it. The eventfd messages are counters without
+ * payload, their latency is not recorded.
+ *
+ * When a task fails, the tasks of its group may wait forever for its
+ * messages or for room to write theirs. The ones which did not finish
+ * shortly after a failure are killed, and the next runs fail.
+ */
+#define HACKBENCH_MAXSIZE 4096 /* PIPE_BUF, the writes are atomic */
+#define HACKBENCH_TIMEOUT 1000 /* msecs for the others after a failure */
+
+const char *plugin_name = "Hackbench";
+const char *plugin_desc = "Groups of tasks messaging each other";
+
+struct ts_param plugin_params[] = {
+	{ .name = "ipc",     .range = "pipe,socket,eventfd" },
+	{ .name = "mode",    .range = "thread,process" },
+	{ .name = "groups",  .range = "10" },
+	{ .name = "fds",     .range = "20" }, /* senders and receivers per group */
+	{ .name = "size",    .range = "100" },
+	{ .name = "loops",   .range = "10" },
+	{ .name = "pin",     .range = "none" },
+	{ NULL },
+};
+
+enum { PIPE, SOCKET, EVENTFD };
+
+struct hackbench_task {
+	int ctl[2];     /* loops to do, zero to exit */
+	int fd;         /* channel to read from, or -1 for a sender */
+	int *channels;  /* channels of the receivers of the group */
+	struct histogram *histogram;
+	cpu_set_t cpuset;
+	int pinned;
+	pid_t pid;
+	pthread_t thread;
+};
+
+static struct hackbench {
+	int ipc;
+	int process;
+	int groups;
+	int fds;
+	size_t size;
+	unsigned long loops;
+	int nrtasks;
+	int broken;     /* tasks killed after a failure */
+	int done[2];    /* a byte written by each task at the end */
+	int *channels;  /* read and write ends, two per receiver */
+	struct hackbench_task *tasks;
+	struct histogram *histograms; /* shared, one per receiver */
+} hackbench;
+
+static int hackbench_channel(int ipc, int *fds)
+{
+	switch (ipc) {
+	case PIPE:
+		return pipe(fds);
+	case SOCKET:
+		return socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	case EVENTFD:
+		fds[0] = fds[1] = eventfd(0, EFD_SEMAPHORE);
+		return fds[0] < 0 ? -1 : 0;
+	}
+
+	return -1;
+}
+
+static int hackbench_readall(int fd, void *buffer, size_t size)
+{
+	ssize_t ret;
+	size_t done = 0;
+
+	while (done < size) {
+		ret = read(fd, buffer + done, size - done);
+		if (ret <= 0)
+			return -1;
+		done += ret;
+	}
+
+	return 0;
+}
+
+static int hackbench_send(struct hackbench_task *task, unsigned long loops)
+{
+	char msg[HACKBENCH_MAXSIZE] = { 0 };
+	uint64_t one = 1, now;
+	unsigned long i;
+	int j;
+
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < hackbench.fds; j++) {
+
+			if (hackbench.ipc == EVENTFD) {
+				if (write(task->channels[j], &one, sizeof(one)) < 0)
+					return -1;
+				continue;
+			}
+
+			now = histogram_now();
+			memcpy(msg, &now, sizeof(now));
+
+			if (write(task->channels[j], msg, hackbench.size) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int hackbench_receive(struct hackbench_task *task, unsigned long loops)
+{
+	char msg[HACKBENCH_MAXSIZE];
+	unsigned long i;
+	uint64_t sent;
+
+	for (i = 0; i < loops * hackbench.fds; i++) {
+
+		if (hackbench.ipc == EVENTFD) {
+			if (hackbench_readall(task->fd, msg, sizeof(uint64_t)))
+				return -1;
+			continue;
+		}
+
+		if (hackbench_readall(task->fd, msg, hackbench.size))
+			return -1;
+
+		memcpy(&sent, msg, sizeof(sent));
+		histogram_record(task->histogram, histogram_now() - sent);
+	}
+
+	return 0;
+}
+
+static void *hackbench_task(void *arg)
+{
+	struct hackbench_task *task = arg;
+	unsigned long loops;
+	char status;
+	int ret;
+
+	if (task->pinned)
+		sched_setaffinity(0, sizeof(task->cpuset), &task->cpuset);
+
+	for (;;) {
+
+		if (hackbench_readall(task->ctl[0], &loops, sizeof(loops)) || !loops)
+			break;
+
+		ret = task->fd < 0 ? hackbench_send(task, loops) :
+			hackbench_receive(task, loops);
+
+		status = ret ? 1 : 0;
+		if (write(hackbench.done[1], &status, 1) < 0)
+			break;
+	}
+
+	return NULL;
+}
+
+static int hackbench_start(struct hackbench_task *task)
+{
+	if (!hackbench.process)
+		return pthread_create(&task->thread, NULL, hackbench_task, task);
+
+	task->pid = fork();
+	if (task->pid < 0)
+		return -1;
+
+	if (!task->pid) {
+		hackbench_task(task);
+		_exit(0);
+	}
+
+	return 0;
+}
+
+/*
+ * The group is pinned on the cpus of the core or the package, the
+ * groups are spread on the cores or the packages
+ */
+static int hackbench_cpuset(const char *pin, int group, cpu_set_t *cpuset)
+{
+	const char *file;
+	int cpu, nrcpus, nr = 0;
+
+	if (!strcmp(pin, "none"))
+		return 0;
+	else if (!strcmp(pin, "core"))
+		file = "topology/thread_siblings_list";
+	else if (!strcmp(pin, "package"))
+		file = "topology/core_siblings_list";
+	else {
+		ERROR("Unknown pinning '%s'\n", pin);
+		return -1;
+	}
+
+	nrcpus = sysconf(_SC_NPROCESSORS_CONF);
+
+	for (cpu = 0; cpu < nrcpus; cpu++)
+		if (cpu_sysfs_read(cpu, file) == cpu)
+			nr++;
+
+	if (!nr)
+		return -1;
+
+	group %= nr;
+
+	for (cpu = 0; cpu < nrcpus; cpu++) {
+		if (cpu_sysfs_read(cpu, file) != cpu)
+			continue;
+		if (!group--)
+			return cpu_sysfs_cpuset(cpu, file, cpuset) ? -1 : 1;
+	}
+
+	return -1;
+}
+
+static void hackbench_stop(struct hackbench *hb)
+{
+	unsigned long zero = 0;
+	int i;
+
+	for (i = 0; i < hb->nrtasks; i++) {
+
+		struct hackbench_task *task = &hb->tasks[i];
+
+		if (task->pid <= 0 && !task->thread)
+			continue;
+
+		if (write(task->ctl[1], &zero, sizeof(zero)) < 0)
+			continue;
+
+		if (hb->process)
+			waitpid(task->pid, NULL, 0);
+		else
+			pthread_join(task->thread, NULL);
+	}
+}
+
+/*
+ * Kill the tasks, some of them blocked on the channels of a failed one
+ */
+static void hackbench_abort(struct hackbench *hb)
+{
+	int i;
+
+	for (i = 0; i < hb->nrtasks; i++) {
+
+		struct hackbench_task *task = &hb->tasks[i];
+
+		if (hb->process && task->pid > 0) {
+			kill(task->pid, SIGKILL);
+			waitpid(task->pid, NULL, 0);
+			task->pid = 0;
+		} else if (!hb->process && task->thread) {
+			/* Blocked in read() or write(), cancellation points */
+			pthread_cancel(task->thread);
+			pthread_join(task->thread, NULL);
+			task->thread = 0;
+		}
+	}
+
+	hb->broken = 1;
+}
+
+void *plugin_prerun(struct ts_param *params)
+{
+	const char *ipc = plugin_param(params, "ipc");
+	const char *mode = plugin_param(params, "mode");
+	int g, i, j, nrreceivers, pinned = 0;
+	cpu_set_t cpuset;
+
+	memset(&hackbench, 0, sizeof(hackbench));
+	hackbench.done[0] = hackbench.done[1] = -1;
+
+	hackbench.ipc = !strcmp(ipc, "pipe") ? PIPE :
+		!strcmp(ipc, "socket") ? SOCKET :
+		!strcmp(ipc, "eventfd") ? EVENTFD : -1;
+	hackbench.process = !strcmp(mode, "process");
+	hackbench.groups = plugin_param_long(params, "groups");
+	hackbench.fds = plugin_param_long(params, "fds");
+	hackbench.size = plugin_param_long(params, "size");
+	hackbench.loops = plugin_param_long(params, "loops");
+
+	if (hackbench.ipc < 0 ||
+	    (!hackbench.process && strcmp(mode, "thread"))) {
+		ERROR("Unknown ipc '%s' or mode '%s'\n", ipc, mode);
+		return NULL;
+	}
+
+	if (hackbench.groups < 1 || hackbench.fds < 1 || hackbench.loops < 1 ||
+	    hackbench.size < sizeof(uint64_t) ||
+	    hackbench.size > HACKBENCH_MAXSIZE) {
+		ERROR("Invalid groups, fds, loops or message size\n");
+		return NULL;
+	}
+
+	nrreceivers = hackbench.groups * hackbench.fds;
+	hackbench.nrtasks = nrreceivers * 2;
+
+	hackbench.tasks = calloc(hackbench.nrtasks, sizeof(*hackbench.tasks));
+	hackbench.channels = calloc(nrreceivers * 2, sizeof(int));
+	if (!hackbench.tasks || !hackbench.channels)
+		FATAL("Failed to allocate memory for the tasks\n");
+
+	/* Shared with the processes */
+	hackbench.histograms = mmap(NULL, nrreceivers * sizeof(struct histogram),
+				    PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (hackbench.histograms == MAP_FAILED) {
+		ERROR("Failed to allocate the histograms: %m\n");
+		hackbench.histograms = NULL;
+		return NULL;
+	}
+
+	if (pipe(hackbench.done)) {
+		ERROR("Failed to create the done pipe: %m\n");
+		return NULL;
+	}
+
+	for (i = 0; i < nrreceivers; i++)
+		if (hackbench_channel(hackbench.ipc, &hackbench.channels[i * 2])) {
+			ERROR("Failed to create the channels: %m\n");
+			return NULL;
+		}
+
+	/* The channels of a group are read by its receivers */
+	for (i = 0; i < hackbench.nrtasks; i++) {
+
+		struct hackbench_task *task = &hackbench.tasks[i];
+		int receiver = i / 2;
+
+		g = receiver / hackbench.fds;
+
+		if (pipe(task->ctl)) {
+			ERROR("Failed to create the control pipe: %m\n");
+			return NULL;
+		}
+
+		task->fd = i % 2 ? -1 : hackbench.channels[receiver * 2];
+		task->channels = malloc(hackbench.fds * sizeof(int));
+		if (!task->channels)
+			FATAL("Failed to allocate memory for the channels\n");
+
+		for (j = 0; j < hackbench.fds; j++)
+			task->channels[j] =
+				hackbench.channels[(g * hackbench.fds + j) * 2 + 1];
+
+		task->histogram = &hackbench.histograms[receiver];
+
+		if (!(i % (2 * hackbench.fds))) {
+			pinned = hackbench_cpuset(plugin_param(params, "pin"), g,
+						  &cpuset);
+			if (pinned < 0)
+				return NULL;
+		}
+
+		task->pinned = pinned;
+		task->cpuset = cpuset;
+	}
+
+	for (i = 0; i < hackbench.nrtasks; i++)
+		if (hackbench_start(&hackbench.tasks[i])) {
+			ERROR("Failed to start the tasks: %m\n");
+			return NULL;
+		}
+
+	return &hackbench;
+}
+
+int plugin_run_batch(void *arg, struct ts_work *work)
+{
+	struct hackbench *hb = arg;
+	struct pollfd pfd;
+	unsigned long loops;
+	char status;
+	int i, nr, ret = 0;
+
+	if (!hb || hb->broken)
+		return -1;
+
+	loops = work->batch * hb->loops;
+
+	for (i = 0; i < hb->nrtasks; i++)
+		if (write(hb->tasks[i].ctl[1], &loops, sizeof(loops)) < 0)
+			return -1;
+
+	pfd.fd = hb->done[0];
+	pfd.events = POLLIN;
+
+	for (i = 0; i < hb->nrtasks; i++) {
+		do {
+			nr = poll(&pfd, 1, ret ? HACKBENCH_TIMEOUT : -1);
+		} while (nr < 0 && errno == EINTR);
+
+		if (nr != 1) {
+			ERROR("%d tasks stuck after a failure\n", hb->nrtasks - i);
+			hackbench_abort(hb);
+			return -1;
+		}
+		if (read(hb->done[0], &status, 1) != 1)
+			return -1;
+		ret |= status;
+	}
+
+	work->ops = loops * hb->groups * hb->fds * hb->fds;
+	work->bytes = work->ops * hb->size;
+
+	return ret ? -1 : 0;
+}
+
+void plugin_histogram(void *arg, struct histogram *histogram)
+{
+	struct hackbench *hb = arg;
+	int i;
+
+	if (!hb || !hb->histograms)
+		return;
+
+	for (i = 0; i < hb->groups * hb->fds; i++) {
+		histogram_merge(histogram, &hb->histograms[i]);
+		histogram_reset(&hb->histograms[i]);
+	}
+}
+
+void plugin_postrun(void *arg)
+{
+	struct hackbench *hb = &hackbench;
+	int i, nrchannels = hb->groups * hb->fds * 2;
+
+	hackbench_stop(hb);
+
+	for (i = 0; hb->tasks && i < hb->nrtasks; i++) {
+		if (hb->tasks[i].ctl[0] > 0) {
+			close(hb->tasks[i].ctl[0]);
+			close(hb->tasks[i].ctl[1]);
+		}
+		free(hb->tasks[i].channels);
+	}
+
+	/* The eventfd is both ends of the channel */
+	for (i = 0; hb->channels && i < nrchannels; i++)
+		if (hb->channels[i] > 0 &&
+		    (hb->ipc != EVENTFD || !(i % 2)))
+			close(hb->channels[i]);
+
+	if (hb->done[0] >= 0) {
+		close(hb->done[0]);
+		close(hb->done[1]);
+	}
+
+	if (hb->histograms)
+		munmap(hb->histograms, hb->groups * hb->fds * sizeof(struct histogram));
+
+	free(hb->tasks);
+	free(hb->channels);
+}
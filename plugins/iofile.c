@@ -1,117 +1,667 @@
 #define _GNU_SOURCE
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <time.h>
+#include <linux/aio_abi.h>
+#include <linux/io_uring.h>
 
 #include "common.h"
 
-#define NROFFSET 256
 #define PAGESIZE 4096
-
-static char buffer[PAGESIZE];
-static int fno = -1;
+#define MAXDEPTH 1024
 
 const char *plugin_name = "IOlatency1";
 const char *plugin_desc = "IO latency test";
 
 /*
- * Write the big file with size NROFFSET * PAGESIZE
+ * The I/Os are submitted by an engine, up to 'depth' of them in flight:
+ *
+ * - sync:  one pread/pwrite at a time, the depth is ignored
+ * - aio:   Linux native AIO, io_submit/io_getevents
+ * - uring: io_uring, the submission and the completion in one syscall
+ *
+ * The engines use the raw syscalls, there is no library dependency.
+ *
+ * With a delay, the I/Os are spaced by a sleep, the sparse accesses let
+ * the devices and the cpus go idle between them. Each I/O is then
+ * submitted on its own and the I/Os in flight are reaped during the
+ * sleep, so their latency does not include the sleeps of the next ones.
+ */
+struct ts_param plugin_params[] = {
+	{ .name = "engine",  .range = "sync,aio,uring" },
+	{ .name = "depth",   .range = "1" },
+	{ .name = "bs",      .range = "4096" },
+	{ .name = "read",    .range = "50" }, /* percent of reads */
+	{ .name = "pattern", .range = "random" },
+	{ .name = "direct",  .range = "0" },
+	{ .name = "pages",   .range = "256" },
+	{ .name = "delay",   .range = "0,50000" }, /* usecs between the I/Os */
+	{ NULL },
+};
+
+struct iofile;
+
+struct iofile_engine {
+	const char *name;
+	int  (*setup)(struct iofile *);
+	void (*prep)(struct iofile *, int slot, int read, off_t offset);
+	int  (*submit)(struct iofile *, int nr);
+	/* Wait for min I/Os, or until the timeout when it is not NULL */
+	int  (*reap)(struct iofile *, int *slots, int min,
+		     struct timespec *timeout);
+	void (*teardown)(struct iofile *);
+};
+
+struct iofile_uring {
+	int fd;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_size, cq_size, sqes_size;
+	unsigned pending;
+	int ext_arg; /* the kernel can wait with a timeout */
+};
+
+struct iofile_aio {
+	aio_context_t ctx;
+	struct iocb iocbs[MAXDEPTH];
+	struct iocb *submit[MAXDEPTH];
+	struct io_event events[MAXDEPTH];
+	int nr;
+};
+
+static struct iofile {
+	int fd;
+	int depth;
+	int direct;
+	int random;
+	int read;
+	long delay;
+	size_t bs;
+	size_t size;
+	off_t offset; /* next sequential offset */
+	char *buffers;
+	struct iofile_engine *engine;
+	/* sync engine */
+	int done[MAXDEPTH];
+	int nrdone;
+	struct iofile_aio aio;
+	struct iofile_uring uring;
+	/* latency of the I/Os, from their submission to their completion */
+	uint64_t start[MAXDEPTH];
+	struct histogram histogram;
+} iofile = { .fd = -1 };
+
+static char *iofile_buffer(struct iofile *io, int slot)
+{
+	return io->buffers + slot * io->bs;
+}
+
+static int sync_setup(struct iofile *io)
+{
+	io->depth = 1;
+	io->nrdone = 0;
+	return 0;
+}
+
+static void sync_prep(struct iofile *io, int slot, int read, off_t offset)
+{
+	ssize_t ret;
+
+	ret = read ? pread(io->fd, iofile_buffer(io, slot), io->bs, offset) :
+		pwrite(io->fd, iofile_buffer(io, slot), io->bs, offset);
+
+	io->done[io->nrdone++] = ret < 0 ? -1 : slot;
+}
+
+static int sync_submit(struct iofile *io, int nr)
+{
+	return 0;
+}
+
+static int sync_reap(struct iofile *io, int *slots, int min,
+		     struct timespec *timeout)
+{
+	int i, nr = io->nrdone;
+
+	io->nrdone = 0;
+
+	for (i = 0; i < nr; i++) {
+		if (io->done[i] < 0) {
+			ERROR("pread/pwrite: %m\n");
+			return -1;
+		}
+		slots[i] = io->done[i];
+	}
+
+	return nr;
+}
+
+static void sync_teardown(struct iofile *io)
+{
+}
+
+static int aio_setup(struct iofile *io)
+{
+	struct iofile_aio *aio = &io->aio;
+
+	memset(aio, 0, sizeof(*aio));
+
+	if (syscall(SYS_io_setup, io->depth, &aio->ctx)) {
+		ERROR("io_setup: %m\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void aio_prep(struct iofile *io, int slot, int read, off_t offset)
+{
+	struct iofile_aio *aio = &io->aio;
+	struct iocb *iocb = &aio->iocbs[slot];
+
+	memset(iocb, 0, sizeof(*iocb));
+	iocb->aio_fildes = io->fd;
+	iocb->aio_lio_opcode = read ? IOCB_CMD_PREAD : IOCB_CMD_PWRITE;
+	iocb->aio_buf = (unsigned long)iofile_buffer(io, slot);
+	iocb->aio_nbytes = io->bs;
+	iocb->aio_offset = offset;
+	iocb->aio_data = slot;
+
+	aio->submit[aio->nr++] = iocb;
+}
+
+static int aio_submit(struct iofile *io, int nr)
+{
+	struct iofile_aio *aio = &io->aio;
+	long ret;
+
+	ret = syscall(SYS_io_submit, aio->ctx, aio->nr, aio->submit);
+	if (ret != aio->nr) {
+		ERROR("io_submit: %s\n", ret < 0 ? strerror(errno) : "partial");
+		return -1;
+	}
+
+	aio->nr = 0;
+
+	return 0;
+}
+
+static int aio_reap(struct iofile *io, int *slots, int min,
+		    struct timespec *timeout)
+{
+	struct iofile_aio *aio = &io->aio;
+	long i, nr;
+
+	nr = syscall(SYS_io_getevents, aio->ctx, min, io->depth, aio->events,
+		     timeout);
+	if (nr < 0 && errno == EINTR)
+		nr = 0;
+	if (nr < 0) {
+		ERROR("io_getevents: %m\n");
+		return -1;
+	}
+
+	for (i = 0; i < nr; i++) {
+		if ((long)aio->events[i].res < 0) {
+			ERROR("aio: %s\n", strerror(-aio->events[i].res));
+			return -1;
+		}
+		slots[i] = aio->events[i].data;
+	}
+
+	return nr;
+}
+
+static void aio_teardown(struct iofile *io)
+{
+	syscall(SYS_io_destroy, io->aio.ctx);
+}
+
+static int uring_setup(struct iofile *io)
+{
+	struct iofile_uring *uring = &io->uring;
+	struct io_uring_params p;
+
+	memset(uring, 0, sizeof(*uring));
+	memset(&p, 0, sizeof(p));
+
+	uring->fd = syscall(__NR_io_uring_setup, io->depth, &p);
+	if (uring->fd < 0) {
+		ERROR("io_uring_setup: %m\n");
+		return -1;
+	}
+
+	uring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	uring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	uring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	uring->sq_ring = mmap(NULL, uring->sq_size, PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE, uring->fd,
+			      IORING_OFF_SQ_RING);
+	uring->cq_ring = mmap(NULL, uring->cq_size, PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE, uring->fd,
+			      IORING_OFF_CQ_RING);
+	uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, uring->fd,
+			   IORING_OFF_SQES);
+	if (uring->sq_ring == MAP_FAILED || uring->cq_ring == MAP_FAILED ||
+	    uring->sqes == MAP_FAILED) {
+		ERROR("Failed to map the io_uring: %m\n");
+		close(uring->fd);
+		return -1;
+	}
+
+	uring->sq_tail = uring->sq_ring + p.sq_off.tail;
+	uring->sq_mask = uring->sq_ring + p.sq_off.ring_mask;
+	uring->sq_array = uring->sq_ring + p.sq_off.array;
+	uring->cq_head = uring->cq_ring + p.cq_off.head;
+	uring->cq_tail = uring->cq_ring + p.cq_off.tail;
+	uring->cq_mask = uring->cq_ring + p.cq_off.ring_mask;
+	uring->cqes = uring->cq_ring + p.cq_off.cqes;
+	uring->ext_arg = !!(p.features & IORING_FEAT_EXT_ARG);
+
+	return 0;
+}
+
+static void uring_prep(struct iofile *io, int slot, int read, off_t offset)
+{
+	struct iofile_uring *uring = &io->uring;
+	unsigned tail = *uring->sq_tail;
+	unsigned index = tail & *uring->sq_mask;
+	struct io_uring_sqe *sqe = &uring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = read ? IORING_OP_READ : IORING_OP_WRITE;
+	sqe->fd = io->fd;
+	sqe->addr = (unsigned long)iofile_buffer(io, slot);
+	sqe->len = io->bs;
+	sqe->off = offset;
+	sqe->user_data = slot;
+
+	uring->sq_array[index] = index;
+
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * The submission is deferred to the reap, to enter the kernel once,
+ * unless the I/Os are spaced by a delay
  */
-static int write_file(int fd)
+static int uring_submit(struct iofile *io, int nr)
 {
-	int i = 0;
+	struct iofile_uring *uring = &io->uring;
+	long ret;
+
+	uring->pending += nr;
+
+	if (!io->delay)
+		return 0;
+
+	ret = syscall(__NR_io_uring_enter, uring->fd, uring->pending, 0, 0,
+		      NULL, 0);
+	if (ret < 0) {
+		ERROR("io_uring_enter: %m\n");
+		return -1;
+	}
+
+	uring->pending -= ret;
+
+	return 0;
+}
+
+static int uring_reap(struct iofile *io, int *slots, int min,
+		      struct timespec *timeout)
+{
+	struct iofile_uring *uring = &io->uring;
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg = { .ts = (unsigned long)&ts };
+	unsigned head, tail, flags = IORING_ENTER_GETEVENTS;
+	int nr = 0;
+	long ret;
+
+	head = *uring->cq_head;
+	tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+	/* Without the timeout support, wait for the timeout and reap */
+	if (timeout && !uring->ext_arg) {
+		nanosleep(timeout, NULL);
+		timeout = NULL;
+		min = 0;
+	}
 
-	for (i = 0; i < NROFFSET; i++)
-		if (write(fd, buffer, sizeof(buffer)) < 0) {
+	if (timeout) {
+		ts.tv_sec = timeout->tv_sec;
+		ts.tv_nsec = timeout->tv_nsec;
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+
+	if (uring->pending || tail - head < (unsigned)min) {
+		ret = syscall(__NR_io_uring_enter, uring->fd, uring->pending,
+			      min, flags, timeout ? (void *)&arg : NULL,
+			      timeout ? sizeof(arg) : 0);
+		if (ret < 0 && errno != ETIME && errno != EINTR) {
+			ERROR("io_uring_enter: %m\n");
+			return -1;
+		}
+
+		if (ret > 0)
+			uring->pending -= ret;
+		tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+	}
+
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cq_mask];
+
+		if (cqe->res < 0) {
+			ERROR("io_uring: %s\n", strerror(-cqe->res));
+			return -1;
+		}
+		slots[nr++] = cqe->user_data;
+	}
+
+	__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+	return nr;
+}
+
+static void uring_teardown(struct iofile *io)
+{
+	struct iofile_uring *uring = &io->uring;
+
+	munmap(uring->sqes, uring->sqes_size);
+	munmap(uring->cq_ring, uring->cq_size);
+	munmap(uring->sq_ring, uring->sq_size);
+	close(uring->fd);
+}
+
+static struct iofile_engine engines[] = {
+	{ "sync",  sync_setup,  sync_prep,  sync_submit,  sync_reap,  sync_teardown  },
+	{ "aio",   aio_setup,   aio_prep,   aio_submit,   aio_reap,   aio_teardown   },
+	{ "uring", uring_setup, uring_prep, uring_submit, uring_reap, uring_teardown },
+};
+
+/*
+ * Write the big file, with the buffers written by the I/Os
+ */
+static int write_file(struct iofile *io)
+{
+	size_t i;
+
+	for (i = 0; i < io->size; i += PAGESIZE)
+		if (write(io->fd, io->buffers, PAGESIZE) < 0) {
 			ERROR("write");
 			return -1;
 		}
 
-	fsync(fd);
+	fsync(io->fd);
 
 	return 0;
 }
 
-void *plugin_prerun(void)
+void *plugin_prerun(struct ts_param *params)
 {
+	const char *engine = plugin_param(params, "engine");
+	const char *pattern = plugin_param(params, "pattern");
+	long pages = plugin_param_long(params, "pages");
 	char *name;
+	int i;
+
+	iofile.depth = plugin_param_long(params, "depth");
+	iofile.bs = plugin_param_long(params, "bs");
+	iofile.read = plugin_param_long(params, "read");
+	iofile.direct = plugin_param_long(params, "direct");
+	iofile.delay = plugin_param_long(params, "delay");
+	iofile.random = !strcmp(pattern, "random");
+	iofile.size = pages * PAGESIZE;
+	iofile.offset = 0;
+	histogram_reset(&iofile.histogram);
+	iofile.engine = NULL;
+
+	for (i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+		if (!strcmp(engines[i].name, engine))
+			iofile.engine = &engines[i];
+
+	if (!iofile.engine) {
+		ERROR("Unknown engine '%s'\n", engine);
+		return NULL;
+	}
+
+	if (iofile.depth < 1 || iofile.depth > MAXDEPTH) {
+		ERROR("Invalid queue depth %d\n", iofile.depth);
+		return NULL;
+	}
+
+	if (pages <= 0 || iofile.bs < PAGESIZE || iofile.bs % PAGESIZE ||
+	    iofile.bs > iofile.size) {
+		ERROR("Invalid block size or number of pages\n");
+		return NULL;
+	}
+
+	if (iofile.delay < 0) {
+		ERROR("Invalid delay %ld\n", iofile.delay);
+		return NULL;
+	}
+
+	if (iofile.read < 0 || iofile.read > 100 ||
+	    (!iofile.random && strcmp(pattern, "sequential"))) {
+		ERROR("Invalid read percentage or access pattern\n");
+		return NULL;
+	}
+
+	/* Aligned for the direct I/Os */
+	if (posix_memalign((void **)&iofile.buffers, PAGESIZE,
+			   iofile.depth * iofile.bs)) {
+		ERROR("Failed to allocate the I/O buffers\n");
+		return NULL;
+	}
+
+	memset(iofile.buffers, 0, iofile.depth * iofile.bs);
 
 	if (asprintf(&name, "./iosimul-XXXXXX") < 0) {
 		ERROR("Failed to allocate file name\n");
-		return (void *)-1;
+		return NULL;
 	}
 
-	fno = mkostemp(name, O_SYNC | O_RDWR);
-	if (fno < 0)
-		return (void *)-1;
+	iofile.fd = mkostemp(name, O_SYNC | O_RDWR |
+			     (iofile.direct ? O_DIRECT : 0));
+	if (iofile.fd < 0) {
+		ERROR("Failed to create '%s': %m\n", name);
+		free(name);
+		return NULL;
+	}
 
 	unlink(name);
 	free(name);
 
-	if (write_file(fno))
-		return (void *)-1;
+	if (write_file(&iofile))
+		return NULL;
+
+	if (iofile.engine->setup(&iofile))
+		return NULL;
 
-	return &fno;
+	return &iofile;
 }
 
-static int access_file(int fd)
+static off_t iofile_offset(struct iofile *io)
 {
-	struct timeval t;
+	size_t nrblocks = io->size / io->bs;
 	off_t offset;
-	int i, ret;
+
+	/*
+	 * Random accesses can not be optimized by the hardware
+	 */
+	if (io->random)
+		return (random() % nrblocks) * io->bs;
+
+	offset = io->offset;
+	io->offset = (io->offset + io->bs) % (nrblocks * io->bs);
+
+	return offset;
+}
+
+/*
+ * Record the latency of the completed I/Os and free their slots
+ */
+static void iofile_complete(struct iofile *io, int *slots, int nr,
+			    int *free_slots, int *nrfree)
+{
+	uint64_t now = histogram_now();
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		histogram_record(&io->histogram, now - io->start[slots[i]]);
+		free_slots[(*nrfree)++] = slots[i];
+	}
+}
+
+/*
+ * Sleep for the delay between the I/Os, reaping the ones in flight
+ * meanwhile, and return the number of I/Os completed
+ */
+static int iofile_idle(struct iofile *io, int *free_slots, int *nrfree)
+{
+	uint64_t now, deadline = histogram_now() + io->delay * 1000ULL;
+	struct timespec timeout;
+	int slots[MAXDEPTH], nr, completed = 0;
+
+	while ((now = histogram_now()) < deadline) {
+
+		timeout.tv_sec = (deadline - now) / 1000000000;
+		timeout.tv_nsec = (deadline - now) % 1000000000;
+
+		if (*nrfree == io->depth) {
+			nanosleep(&timeout, NULL);
+			continue;
+		}
+
+		nr = io->engine->reap(io, slots, 1, &timeout);
+		if (nr < 0)
+			return -1;
+
+		iofile_complete(io, slots, nr, free_slots, nrfree);
+		completed += nr;
+	}
+
+	return completed;
+}
+
+/*
+ * Keep up to 'depth' I/Os in flight until 'nrops' are completed
+ */
+static int access_file(struct iofile *io, unsigned long nrops)
+{
+	struct iofile_engine *engine = io->engine;
+	unsigned long submitted = 0, completed = 0;
+	int free_slots[MAXDEPTH], slots[MAXDEPTH];
+	int i, nr, slot, nrfree = io->depth;
+	struct timeval t;
 
 	/*
 	 * Initialize the random seed with the number of
-	 * current usec.  This random value will be used to
-	 * access the file randomly, no sequential accesses
-	 * which can be optimized by the hardware
+	 * current usec.
 	 */
 	gettimeofday(&t, NULL);
 	srandom(t.tv_usec);
 
-	for (i = 0; i < 10000; i++) {
-
-		/*
-		 * Compute the offset address to read from
-		 */
-		offset = (random() % NROFFSET) * PAGESIZE;
-		
-		/*
-		 * man posix_fadvise
-		 */
-		posix_fadvise(fd, offset, PAGESIZE, 
-			      POSIX_FADV_DONTNEED);
-		
-		/*
-		 * Measure the time to read a PAGESIZE buffer
-		 */
-		ret = random() % 2 ? pread(fd, buffer, PAGESIZE, offset) :
-			pwrite(fd, buffer, PAGESIZE, offset);
+	for (i = 0; i < io->depth; i++)
+		free_slots[i] = i;
 
-		if (ret > 0)
-			continue;
+	while (completed < nrops) {
+
+		for (nr = 0; nrfree && submitted < nrops; nr++, submitted++) {
+
+			off_t offset = iofile_offset(io);
+
+			/*
+			 * man posix_fadvise
+			 */
+			if (!io->direct)
+				posix_fadvise(io->fd, offset, io->bs,
+					      POSIX_FADV_DONTNEED);
+
+			/* The idle time between the accesses, as a sparse workload */
+			if (io->delay) {
+				i = iofile_idle(io, free_slots, &nrfree);
+				if (i < 0)
+					return -1;
+				completed += i;
+			}
+
+			slot = free_slots[--nrfree];
+			io->start[slot] = histogram_now();
+			engine->prep(io, slot, random() % 100 < io->read, offset);
 
-		ERROR("pread/pwrite: %m\n");
-		return ret;
+			/* A spaced I/O is submitted before the next sleep */
+			if (io->delay && engine->submit(io, 1))
+				return -1;
+		}
+
+		if (!io->delay && nr && engine->submit(io, nr))
+			return -1;
+
+		if (completed >= nrops)
+			break;
+
+		nr = engine->reap(io, slots, 1, NULL);
+		if (nr < 0)
+			return -1;
+
+		iofile_complete(io, slots, nr, free_slots, &nrfree);
+		completed += nr;
 	}
 
 	return 0;
 }
 
+int plugin_run_batch(void *arg, struct ts_work *work)
+{
+	struct iofile *io = arg;
+
+	if (!io)
+		return -1;
+
+	work->ops = work->batch;
+	work->bytes = work->batch * io->bs;
+
+	return access_file(io, work->batch);
+}
 
-int plugin_run(void *arg)
+void plugin_histogram(void *arg, struct histogram *histogram)
 {
-	int *fd = arg;
-	return access_file(*fd);
+	struct iofile *io = arg;
+
+	if (!io)
+		return;
+
+	histogram_merge(histogram, &io->histogram);
+	histogram_reset(&io->histogram);
 }
 
 void plugin_postrun(void *arg)
 {
-	int *fd = arg;
-	close(*fd);
+	struct iofile *io = arg;
+
+	if (io)
+		io->engine->teardown(io);
+
+	if (iofile.fd >= 0)
+		close(iofile.fd);
+
+	free(iofile.buffers);
+
+	iofile.fd = -1;
+	iofile.buffers = NULL;
 }
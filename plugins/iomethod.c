@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <fcntl.h>
+
+#include "common.h"
+
+/*
+ * Compare the ways of accessing the same file: the same random reads
+ * and writes are done with one of the access methods:
+ *
+ * - buffered:      pread/pwrite through the page cache
+ * - direct:        pread/pwrite with O_DIRECT and aligned buffers
+ * - mmap:          memory copies, the pages are unmapped before each
+ *                  access so it takes a page fault
+ * - mmap-populate: memory copies on a mapping populated at creation
+ *
+ * and the writes are made durable with one of:
+ *
+ * - none:            left in the page cache
+ * - fsync:           fsync() after each write
+ * - fdatasync:       fdatasync() after each write
+ * - dsync:           O_DSYNC, or msync() after each write with mmap
+ * - sync_file_range: the written range is written back and waited for
+ */
+#define PAGESIZE 4096
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
+
+const char *plugin_name = "IOmethod";
+const char *plugin_desc = "IO access methods and durability modes";
+
+struct ts_param plugin_params[] = {
+	{ .name = "method",     .range = "buffered,direct,mmap,mmap-populate" },
+	{ .name = "durability", .range = "none,fsync,fdatasync,dsync,sync_file_range" },
+	{ .name = "read",       .range = "50" }, /* percent of reads */
+	{ .name = "bs",         .range = "4096" },
+	{ .name = "size",       .range = "16777216" },
+	{ NULL },
+};
+
+enum { BUFFERED, DIRECT, MMAP, MMAP_POPULATE };
+enum { NONE, FSYNC, FDATASYNC, DSYNC, SYNC_FILE_RANGE };
+
+static const char *methods[] = { "buffered", "direct", "mmap", "mmap-populate" };
+static const char *durabilities[] = { "none", "fsync", "fdatasync", "dsync",
+				      "sync_file_range" };
+
+static struct iomethod {
+	int fd;
+	int method;
+	int durability;
+	int read;
+	size_t bs;
+	size_t size;
+	char *map;
+	char *buffer;
+	struct histogram histogram;
+} iomethod = { .fd = -1 };
+
+static int iomethod_lookup(const char **names, int nr, const char *name)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (!strcmp(names[i], name))
+			return i;
+
+	ERROR("Unknown value '%s'\n", name);
+	return -1;
+}
+
+/*
+ * Create the data set and reopen it with the flags of the method
+ */
+static int iomethod_open(struct iomethod *io)
+{
+	char name[] = "./iomethod-XXXXXX";
+	int fd, flags = O_RDWR;
+	size_t i;
+
+	fd = mkstemp(name);
+	if (fd < 0) {
+		ERROR("Failed to create '%s': %m\n", name);
+		return -1;
+	}
+
+	for (i = 0; i < io->size; i += io->bs)
+		if (write(fd, io->buffer, io->bs) < 0) {
+			ERROR("write: %m\n");
+			goto out;
+		}
+
+	fsync(fd);
+
+	if (io->method == DIRECT)
+		flags |= O_DIRECT;
+	if (io->durability == DSYNC)
+		flags |= O_DSYNC;
+
+	io->fd = open(name, flags);
+	if (io->fd < 0)
+		ERROR("Failed to open '%s': %m\n", name);
+out:
+	close(fd);
+	unlink(name);
+
+	return io->fd < 0 ? -1 : 0;
+}
+
+void *plugin_prerun(struct ts_param *params)
+{
+	memset(&iomethod, 0, sizeof(iomethod));
+	iomethod.fd = -1;
+
+	iomethod.method = iomethod_lookup(methods, ARRAY_SIZE(methods),
+					  plugin_param(params, "method"));
+	iomethod.durability = iomethod_lookup(durabilities, ARRAY_SIZE(durabilities),
+					      plugin_param(params, "durability"));
+	iomethod.read = plugin_param_long(params, "read");
+	iomethod.bs = plugin_param_long(params, "bs");
+	iomethod.size = plugin_param_long(params, "size");
+
+	if (iomethod.method < 0 || iomethod.durability < 0)
+		return NULL;
+
+	if (iomethod.read < 0 || iomethod.read > 100 ||
+	    iomethod.bs < PAGESIZE || iomethod.bs % PAGESIZE ||
+	    iomethod.size < iomethod.bs) {
+		ERROR("Invalid read percentage, block size or file size\n");
+		return NULL;
+	}
+
+	/* Aligned for the direct I/Os */
+	if (posix_memalign((void **)&iomethod.buffer, PAGESIZE, iomethod.bs)) {
+		ERROR("Failed to allocate the I/O buffer\n");
+		return NULL;
+	}
+
+	memset(iomethod.buffer, 0x5a, iomethod.bs);
+
+	if (iomethod_open(&iomethod))
+		return &iomethod;
+
+	if (iomethod.method == MMAP || iomethod.method == MMAP_POPULATE) {
+
+		iomethod.map = mmap(NULL, iomethod.size, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | (iomethod.method == MMAP_POPULATE ?
+						  MAP_POPULATE : 0),
+				    iomethod.fd, 0);
+		if (iomethod.map == MAP_FAILED) {
+			ERROR("Failed to map the file: %m\n");
+			iomethod.map = NULL;
+			return &iomethod;
+		}
+
+		madvise(iomethod.map, iomethod.size, MADV_RANDOM);
+	}
+
+	return &iomethod;
+}
+
+static int iomethod_access(struct iomethod *io, off_t offset, int read)
+{
+	char *addr = io->map ? io->map + offset : NULL;
+	ssize_t ret = io->bs;
+
+	switch (io->method) {
+	case BUFFERED:
+	case DIRECT:
+		ret = read ? pread(io->fd, io->buffer, io->bs, offset) :
+			pwrite(io->fd, io->buffer, io->bs, offset);
+		break;
+	case MMAP:
+		/* Drop the mapping of the pages, the access faults them */
+		madvise(addr, io->bs, MADV_DONTNEED);
+		/* fall through */
+	case MMAP_POPULATE:
+		if (read)
+			memcpy(io->buffer, addr, io->bs);
+		else
+			memcpy(addr, io->buffer, io->bs);
+		break;
+	}
+
+	if (ret < 0) {
+		ERROR("pread/pwrite: %m\n");
+		return -1;
+	}
+
+	if (read)
+		return 0;
+
+	switch (io->durability) {
+	case FSYNC:
+		ret = fsync(io->fd);
+		break;
+	case FDATASYNC:
+		ret = fdatasync(io->fd);
+		break;
+	case DSYNC:
+		if (io->map)
+			ret = msync(addr, io->bs, MS_SYNC);
+		break;
+	case SYNC_FILE_RANGE:
+		ret = sync_file_range(io->fd, offset, io->bs,
+				      SYNC_FILE_RANGE_WAIT_BEFORE |
+				      SYNC_FILE_RANGE_WRITE |
+				      SYNC_FILE_RANGE_WAIT_AFTER);
+		break;
+	}
+
+	if (ret < 0) {
+		ERROR("%s: %m\n", durabilities[io->durability]);
+		return -1;
+	}
+
+	return 0;
+}
+
+int plugin_run_batch(void *arg, struct ts_work *work)
+{
+	struct iomethod *io = arg;
+	size_t nrblocks;
+	struct timeval t;
+	unsigned long i;
+	uint64_t start;
+
+	if (!io || io->fd < 0 || (io->method >= MMAP && !io->map))
+		return -1;
+
+	nrblocks = io->size / io->bs;
+
+	gettimeofday(&t, NULL);
+	srandom(t.tv_usec);
+
+	for (i = 0; i < work->batch; i++) {
+
+		off_t offset = (random() % nrblocks) * io->bs;
+		int read = random() % 100 < io->read;
+
+		start = histogram_now();
+
+		if (iomethod_access(io, offset, read))
+			return -1;
+
+		histogram_record(&io->histogram, histogram_now() - start);
+	}
+
+	work->ops = work->batch;
+	work->bytes = work->batch * io->bs;
+
+	return 0;
+}
+
+void plugin_histogram(void *arg, struct histogram *histogram)
+{
+	struct iomethod *io = arg;
+
+	if (!io)
+		return;
+
+	histogram_merge(histogram, &io->histogram);
+	histogram_reset(&io->histogram);
+}
+
+void plugin_postrun(void *arg)
+{
+	if (iomethod.map)
+		munmap(iomethod.map, iomethod.size);
+
+	if (iomethod.fd >= 0)
+		close(iomethod.fd);
+
+	free(iomethod.buffer);
+
+	iomethod.map = NULL;
+	iomethod.fd = -1;
+	iomethod.buffer = NULL;
+}
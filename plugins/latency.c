@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "common.h"
+#include "cache.h"
+
+/*
+ * Memory latency with a pointer chase: the working set is a chain of
+ * cache lines linked in a random order, so each access depends on the
+ * previous one and the hardware prefetchers can not guess the next
+ * line. The time and the energy per operation are the latency and the
+ * energy of one access, sweeping the size gives the curve across the
+ * cache hierarchy.
+ */
+#define LATENCY_LINE  64
+#define LATENCY_HUGE  (2 * 1024 * 1024)
+#define MPOL_BIND     2
+
+const char *plugin_name = "Latency";
+const char *plugin_desc = "Memory latency with a random pointer chase";
+
+struct ts_param plugin_params[] = {
+	{ .name = "size",  .range = "4096:268435456:*2" },
+	{ .name = "pages", .range = "normal" },
+	{ .name = "cpu",   .range = "0" },
+	{ .name = "node",  .range = "-1" },
+	{ NULL },
+};
+
+static struct latency {
+	void **chain;
+	size_t size;
+	size_t length; /* of the mapping */
+	int huge;
+	cpu_set_t cpuset; /* affinity of the harness to restore */
+} latency;
+
+/*
+ * Tell in which cache of the cpu the working set fits
+ */
+static void latency_show_level(int cpu, size_t size)
+{
+	struct cache caches[8];
+	int i, nr;
+
+	nr = cpu_caches(cpu, caches, sizeof(caches) / sizeof(caches[0]));
+
+	for (i = 0; i < nr; i++) {
+		if (size > caches[i].size)
+			continue;
+
+		NOTICE("%zu KB working set fits in L%d (%zu KB)\n",
+		       size / 1024, caches[i].level, caches[i].size / 1024);
+		return;
+	}
+
+	NOTICE("%zu KB working set is beyond the caches, in memory\n",
+	       size / 1024);
+}
+
+static void *latency_alloc(size_t size, int huge, int node)
+{
+	unsigned long nodemask;
+	void *addr = MAP_FAILED;
+
+	if (huge) {
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (addr == MAP_FAILED)
+			WARNING("No hugetlb pages, using transparent hugepages\n");
+	}
+
+	if (addr == MAP_FAILED) {
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (addr == MAP_FAILED)
+			return NULL;
+
+		madvise(addr, size, huge ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+	}
+
+	/* The pages are not touched yet, they are allocated on the node */
+	if (node >= 0) {
+		nodemask = 1UL << node;
+		if (syscall(SYS_mbind, addr, size, MPOL_BIND, &nodemask,
+			    sizeof(nodemask) * 8, 0)) {
+			ERROR("Failed to bind the memory on node %d: %m\n", node);
+			munmap(addr, size);
+			return NULL;
+		}
+	}
+
+	return addr;
+}
+
+/*
+ * Link the cache lines in a random cycle going through all of them
+ * (Sattolo's algorithm)
+ */
+static void latency_chain(void **chain, size_t size)
+{
+	size_t i, j, nrlines = size / LATENCY_LINE;
+	size_t stride = LATENCY_LINE / sizeof(void *);
+	size_t *order;
+
+	order = malloc(nrlines * sizeof(*order));
+	if (!order)
+		FATAL("Failed to allocate memory for the chain\n");
+
+	for (i = 0; i < nrlines; i++)
+		order[i] = i;
+
+	srandom(nrlines);
+
+	for (i = nrlines - 1; i > 0; i--) {
+		size_t tmp;
+
+		j = random() % i;
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	for (i = 0; i < nrlines; i++)
+		chain[order[i] * stride] = &chain[order[(i + 1) % nrlines] * stride];
+
+	free(order);
+}
+
+void *plugin_prerun(struct ts_param *params)
+{
+	cpu_set_t cpuset;
+	long size = plugin_param_long(params, "size");
+	int cpu = plugin_param_long(params, "cpu");
+	int node = plugin_param_long(params, "node");
+
+	memset(&latency, 0, sizeof(latency));
+
+	if (size < 2 * LATENCY_LINE) {
+		ERROR("Invalid working set size %ld\n", size);
+		return NULL;
+	}
+
+	latency.size = size - size % LATENCY_LINE;
+	latency.huge = !strcmp(plugin_param(params, "pages"), "huge");
+
+	/* The chain is walked by the harness thread, pin it on the cpu */
+	sched_getaffinity(0, sizeof(latency.cpuset), &latency.cpuset);
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	if (sched_setaffinity(0, sizeof(cpuset), &cpuset)) {
+		ERROR("Failed to run on cpu %d: %m\n", cpu);
+		return NULL;
+	}
+
+	/* The hugetlb mappings are a multiple of the hugepage size */
+	latency.length = latency.size;
+	if (latency.huge && latency.length % LATENCY_HUGE)
+		latency.length += LATENCY_HUGE - latency.length % LATENCY_HUGE;
+
+	latency.chain = latency_alloc(latency.length, latency.huge, node);
+	if (!latency.chain) {
+		ERROR("Failed to allocate the working set\n");
+		return &latency;
+	}
+
+	latency_chain(latency.chain, latency.size);
+
+	latency_show_level(cpu, latency.size);
+
+	return &latency;
+}
+
+int plugin_run_batch(void *arg, struct ts_work *work)
+{
+	struct latency *latency = arg;
+	void **p;
+	unsigned long i;
+
+	if (!latency || !latency->chain)
+		return -1;
+
+	p = latency->chain;
+
+	for (i = 0; i < work->batch; i++)
+		p = *p;
+
+	/* Keep the chase from being optimized out */
+	__asm__ __volatile__("" : : "r"(p));
+
+	work->ops = work->batch;
+
+	return 0;
+}
+
+void plugin_postrun(void *arg)
+{
+	struct latency *latency = arg;
+
+	if (!latency)
+		return;
+
+	if (latency->chain)
+		munmap(latency->chain, latency->length);
+
+	sched_setaffinity(0, sizeof(latency->cpuset), &latency->cpuset);
+}
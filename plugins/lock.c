@@ -0,0 +1,446 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "common.h"
+#include "cache.h"
+
+/*
+ * Lock contention: the workers of the pool share a number of critical
+ * sections, each one incrementing counters spread over a few cache
+ * lines, under one of:
+ *
+ * - mutex:    pthread mutex
+ * - spinlock: pthread spinlock
+ * - ticket:   ticket spinlock, served in the arrival order
+ * - mcs:      MCS queue lock, each waiter spins on its own cache line
+ * - rwlock:   pthread rwlock, 'read' percent of the sections only read
+ * - futex:    three states futex mutex
+ * - atomic:   no lock, the counters are incremented atomically
+ *
+ * The 'hold' and 'think' parameters are the number of increments in
+ * and out of the critical section, their ratio sets the contention.
+ * The workers take the critical sections until all the operations of
+ * the batch are done, so the fast workers may do more than the others:
+ * the spread of the operations between them is the fairness of the
+ * lock. The time to acquire the lock is recorded in the histograms.
+ */
+#define LOCK_LINE     64
+#define LOCK_COUNTERS 8 /* cache lines touched in the critical section */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() do { } while (0)
+#endif
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
+
+const char *plugin_name = "Lock";
+const char *plugin_desc = "Locks and synchronization primitives contention";
+
+struct ts_param plugin_params[] = {
+	{ .name = "lock",    .range = "mutex,spinlock,ticket,mcs,rwlock,futex,atomic" },
+	{ .name = "workers", .range = "cores" },
+	{ .name = "hold",    .range = "16" },
+	{ .name = "think",   .range = "0" },
+	{ .name = "read",    .range = "0" }, /* percent, rwlock only */
+	{ NULL },
+};
+
+enum { MUTEX, SPINLOCK, TICKET, MCS, RWLOCK, FUTEX, ATOMIC };
+
+static const char *locks[] = { "mutex", "spinlock", "ticket", "mcs",
+			       "rwlock", "futex", "atomic" };
+
+struct mcs_node {
+	struct mcs_node *next;
+	int locked;
+} __attribute__((aligned(LOCK_LINE)));
+
+struct lock_worker {
+	struct mcs_node node;
+	unsigned long ops;
+	unsigned int seed;
+	struct histogram histogram;
+} __attribute__((aligned(LOCK_LINE)));
+
+static struct lock {
+	int lock;
+	int nrworkers; /* zero for one per cpu */
+	int nrslots;   /* the most workers the pool may start */
+	int nrran;     /* workers started by the pool */
+	int hold;
+	int think;
+	int read;
+	struct lock_worker *workers;
+
+	pthread_mutex_t mutex __attribute__((aligned(LOCK_LINE)));
+	pthread_spinlock_t spinlock;
+	pthread_rwlock_t rwlock;
+	struct {
+		unsigned int next;
+		unsigned int owner;
+	} ticket;
+	struct mcs_node *mcs;
+	unsigned int futex;
+
+	/* The operations done and the counters, protected by the lock */
+	unsigned long done __attribute__((aligned(LOCK_LINE)));
+	unsigned long total;
+	struct {
+		unsigned long value;
+	} __attribute__((aligned(LOCK_LINE))) counters[LOCK_COUNTERS];
+} lock;
+
+static long futex(unsigned int *uaddr, int op, unsigned int val)
+{
+	return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static void ticket_lock(struct lock *l)
+{
+	unsigned int ticket = __atomic_fetch_add(&l->ticket.next, 1, __ATOMIC_RELAXED);
+
+	while (__atomic_load_n(&l->ticket.owner, __ATOMIC_ACQUIRE) != ticket)
+		cpu_relax();
+}
+
+static void ticket_unlock(struct lock *l)
+{
+	__atomic_store_n(&l->ticket.owner, l->ticket.owner + 1, __ATOMIC_RELEASE);
+}
+
+static void mcs_lock(struct lock *l, struct mcs_node *node)
+{
+	struct mcs_node *prev;
+
+	node->next = NULL;
+	node->locked = 1;
+
+	prev = __atomic_exchange_n(&l->mcs, node, __ATOMIC_ACQ_REL);
+	if (!prev)
+		return;
+
+	__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+
+	while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE))
+		cpu_relax();
+}
+
+static void mcs_unlock(struct lock *l, struct mcs_node *node)
+{
+	struct mcs_node *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+
+	if (!next) {
+		struct mcs_node *expected = node;
+
+		if (__atomic_compare_exchange_n(&l->mcs, &expected, NULL, 0,
+						__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			return;
+
+		/* A waiter is linking itself */
+		while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)))
+			cpu_relax();
+	}
+
+	__atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * 0 unlocked, 1 locked, 2 locked with waiters
+ */
+static void futex_lock(struct lock *l)
+{
+	unsigned int c = 0;
+
+	if (__atomic_compare_exchange_n(&l->futex, &c, 1, 0,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+
+	if (c != 2)
+		c = __atomic_exchange_n(&l->futex, 2, __ATOMIC_ACQUIRE);
+
+	while (c) {
+		futex(&l->futex, FUTEX_WAIT_PRIVATE, 2);
+		c = __atomic_exchange_n(&l->futex, 2, __ATOMIC_ACQUIRE);
+	}
+}
+
+static void futex_unlock(struct lock *l)
+{
+	if (__atomic_exchange_n(&l->futex, 0, __ATOMIC_RELEASE) == 2)
+		futex(&l->futex, FUTEX_WAKE_PRIVATE, 1);
+}
+
+static void lock_acquire(struct lock *l, struct lock_worker *w, int read)
+{
+	switch (l->lock) {
+	case MUTEX:
+		pthread_mutex_lock(&l->mutex);
+		break;
+	case SPINLOCK:
+		pthread_spin_lock(&l->spinlock);
+		break;
+	case TICKET:
+		ticket_lock(l);
+		break;
+	case MCS:
+		mcs_lock(l, &w->node);
+		break;
+	case RWLOCK:
+		if (read)
+			pthread_rwlock_rdlock(&l->rwlock);
+		else
+			pthread_rwlock_wrlock(&l->rwlock);
+		break;
+	case FUTEX:
+		futex_lock(l);
+		break;
+	}
+}
+
+static void lock_release(struct lock *l, struct lock_worker *w)
+{
+	switch (l->lock) {
+	case MUTEX:
+		pthread_mutex_unlock(&l->mutex);
+		break;
+	case SPINLOCK:
+		pthread_spin_unlock(&l->spinlock);
+		break;
+	case TICKET:
+		ticket_unlock(l);
+		break;
+	case MCS:
+		mcs_unlock(l, &w->node);
+		break;
+	case RWLOCK:
+		pthread_rwlock_unlock(&l->rwlock);
+		break;
+	case FUTEX:
+		futex_unlock(l);
+		break;
+	}
+}
+
+static void lock_think(struct lock *l, unsigned long *local)
+{
+	int i;
+
+	for (i = 0; i < l->think; i++)
+		__atomic_store_n(local, *local + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Take the critical sections until all the operations are done
+ */
+static unsigned long lock_run(struct lock *l, struct lock_worker *w)
+{
+	unsigned long ops = 0, local = 0, sum;
+	uint64_t start;
+	int i, read;
+
+	for (;;) {
+
+		read = l->lock == RWLOCK && rand_r(&w->seed) % 100 < l->read;
+
+		start = histogram_now();
+		lock_acquire(l, w, read);
+		histogram_record(&w->histogram, histogram_now() - start);
+
+		if (__atomic_load_n(&l->done, __ATOMIC_RELAXED) >= l->total) {
+			lock_release(l, w);
+			break;
+		}
+
+		if (read) {
+			/* The readers share the lock, count them atomically */
+			__atomic_fetch_add(&l->done, 1, __ATOMIC_RELAXED);
+			for (i = 0, sum = 0; i < l->hold; i++)
+				sum += __atomic_load_n(&l->counters[i % LOCK_COUNTERS].value,
+						       __ATOMIC_RELAXED);
+		} else {
+			l->done++;
+			for (i = 0; i < l->hold; i++)
+				__atomic_store_n(&l->counters[i % LOCK_COUNTERS].value,
+						 l->counters[i % LOCK_COUNTERS].value + 1,
+						 __ATOMIC_RELAXED);
+		}
+
+		lock_release(l, w);
+
+		ops++;
+		lock_think(l, &local);
+	}
+
+	return ops;
+}
+
+/*
+ * The lock free alternative: the same increments, atomically
+ */
+static unsigned long lock_run_atomic(struct lock *l, struct lock_worker *w)
+{
+	unsigned long ops = 0, local = 0;
+	uint64_t start, done;
+	int i;
+
+	for (;;) {
+
+		start = histogram_now();
+		done = __atomic_fetch_add(&l->done, 1, __ATOMIC_ACQ_REL);
+		histogram_record(&w->histogram, histogram_now() - start);
+
+		if (done >= l->total)
+			break;
+
+		for (i = 0; i < l->hold; i++)
+			__atomic_fetch_add(&l->counters[i % LOCK_COUNTERS].value, 1,
+					   __ATOMIC_RELAXED);
+
+		ops++;
+		lock_think(l, &local);
+	}
+
+	return ops;
+}
+
+void *plugin_prerun(struct ts_param *params)
+{
+	const char *name = plugin_param(params, "lock");
+	int i;
+
+	memset(&lock, 0, sizeof(lock));
+
+	for (i = 0, lock.lock = -1; i < ARRAY_SIZE(locks); i++)
+		if (!strcmp(locks[i], name))
+			lock.lock = i;
+
+	if (lock.lock < 0) {
+		ERROR("Unknown lock '%s'\n", name);
+		return NULL;
+	}
+
+	lock.nrworkers = cpu_nrworkers(plugin_param(params, "workers"));
+	lock.hold = plugin_param_long(params, "hold");
+	lock.think = plugin_param_long(params, "think");
+	lock.read = plugin_param_long(params, "read");
+
+	if (lock.nrworkers < 0 || lock.hold < 0 || lock.think < 0 ||
+	    lock.read < 0 || lock.read > 100) {
+		ERROR("Invalid workers, hold, think or read percentage\n");
+		return NULL;
+	}
+
+	pthread_mutex_init(&lock.mutex, NULL);
+	pthread_spin_init(&lock.spinlock, PTHREAD_PROCESS_PRIVATE);
+	pthread_rwlock_init(&lock.rwlock, NULL);
+
+	/* One per online cpu are started, the offline ones are not known */
+	lock.nrslots = lock.nrworkers ? lock.nrworkers :
+		sysconf(_SC_NPROCESSORS_CONF);
+	lock.nrran = 0;
+
+	/* The lock is handed to a waiter which may not be running */
+	if ((lock.lock == TICKET || lock.lock == MCS) &&
+	    lock.nrworkers > sysconf(_SC_NPROCESSORS_ONLN))
+		WARNING("More workers than cpus, the %s lock waits for preemptions\n",
+			locks[lock.lock]);
+
+	if (posix_memalign((void **)&lock.workers, LOCK_LINE,
+			   sizeof(*lock.workers) * lock.nrslots))
+		FATAL("Failed to allocate memory for the workers\n");
+
+	memset(lock.workers, 0, sizeof(*lock.workers) * lock.nrslots);
+
+	for (i = 0; i < lock.nrslots; i++)
+		lock.workers[i].seed = i;
+
+	return &lock;
+}
+
+int plugin_workers(void *arg)
+{
+	struct lock *l = arg;
+
+	return l ? l->nrworkers : 0;
+}
+
+int plugin_run_worker(void *arg, struct ts_worker *worker)
+{
+	struct lock *l = arg;
+	struct lock_worker *w;
+
+	if (!l || worker->id >= l->nrslots)
+		return -1;
+
+	w = &l->workers[worker->id];
+
+	/* The first worker sets the operations of the run for all */
+	if (!worker->id) {
+		l->done = 0;
+		l->total = worker->work.batch * worker->nrworkers;
+		l->nrran = worker->nrworkers;
+	}
+
+	worker_barrier(worker);
+
+	w->ops = l->lock == ATOMIC ? lock_run_atomic(l, w) : lock_run(l, w);
+
+	worker->work.ops = w->ops;
+
+	return 0;
+}
+
+void plugin_histogram(void *arg, struct histogram *histogram)
+{
+	struct lock *l = arg;
+	int i;
+
+	if (!l)
+		return;
+
+	for (i = 0; i < l->nrslots; i++) {
+		histogram_merge(histogram, &l->workers[i].histogram);
+		histogram_reset(&l->workers[i].histogram);
+	}
+}
+
+/*
+ * Fairness of the last run: the spread of the operations done by the
+ * workers around their mean
+ */
+void plugin_postrun(void *arg)
+{
+	struct lock *l = arg;
+	unsigned long min = ULONG_MAX, max = 0, sum = 0;
+	int i;
+
+	if (!l)
+		return;
+
+	for (i = 0; i < l->nrran; i++) {
+		sum += l->workers[i].ops;
+		min = l->workers[i].ops < min ? l->workers[i].ops : min;
+		max = l->workers[i].ops > max ? l->workers[i].ops : max;
+	}
+
+	if (sum)
+		NOTICE("%s: %d workers, %lu to %lu ops per worker, %.1f%% spread\n",
+		       locks[l->lock], l->nrran, min, max,
+		       100.0 * (max - min) * l->nrran / sum);
+
+	pthread_mutex_destroy(&l->mutex);
+	pthread_spin_destroy(&l->spinlock);
+	pthread_rwlock_destroy(&l->rwlock);
+
+	free(l->workers);
+	l->workers = NULL;
+}
@@ -0,0 +1,369 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STREAM_X86
+#endif
+
+#include "common.h"
+#include "cache.h"
+
+/*
+ * STREAM like memory bandwidth benchmark: the copy, scale, add and
+ * triad kernels run on arrays a few times bigger than the last level
+ * caches, split between the workers. The kernels are implemented for
+ * each instruction set, with regular or non-temporal stores, and the
+ * best one supported by the cpu is chosen at runtime unless forced by
+ * the 'isa' parameter.
+ */
+#define STREAM_ALIGN   64
+#define STREAM_VECTOR  8 /* doubles in the widest vector */
+#define STREAM_SCALAR  3.0
+#define STREAM_MINSIZE (16 * 1024 * 1024)
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
+
+const char *plugin_name = "Stream";
+const char *plugin_desc = "Memory bandwidth with copy/scale/add/triad kernels";
+
+struct ts_param plugin_params[] = {
+	{ .name = "kernel",  .range = "copy,scale,add,triad" },
+	{ .name = "isa",     .range = "auto" },
+#ifdef STREAM_X86
+	{ .name = "store",   .range = "temporal,nontemporal" },
+#else
+	{ .name = "store",   .range = "temporal" },
+#endif
+	{ .name = "workers", .range = "cores" },
+	{ .name = "ratio",   .range = "4" },
+	{ NULL },
+};
+
+typedef void (*stream_fn_t)(double *, const double *, const double *,
+			    double, size_t);
+
+/*
+ * Generate the four kernels for a vector type, the arrays are aligned
+ * and their size is a multiple of the widest vector
+ */
+#define STREAM_KERNELS(isa, attr, width, load, store, add, mul, set1)	\
+static attr void isa##_copy(double *d, const double *x, const double *y, \
+			    double q, size_t n)				\
+{									\
+	size_t i;							\
+	for (i = 0; i < n; i += width)					\
+		store(d + i, load(x + i));				\
+}									\
+static attr void isa##_scale(double *d, const double *x, const double *y, \
+			     double q, size_t n)			\
+{									\
+	size_t i;							\
+	for (i = 0; i < n; i += width)					\
+		store(d + i, mul(set1(q), load(x + i)));		\
+}									\
+static attr void isa##_add(double *d, const double *x, const double *y, \
+			   double q, size_t n)				\
+{									\
+	size_t i;							\
+	for (i = 0; i < n; i += width)					\
+		store(d + i, add(load(x + i), load(y + i)));		\
+}									\
+static attr void isa##_triad(double *d, const double *x, const double *y, \
+			     double q, size_t n)			\
+{									\
+	size_t i;							\
+	for (i = 0; i < n; i += width)					\
+		store(d + i, add(load(x + i), mul(set1(q), load(y + i)))); \
+}
+
+static inline double double_load(const double *p) { return *p; }
+static inline void double_store(double *p, double v) { *p = v; }
+static inline double double_add(double a, double b) { return a + b; }
+static inline double double_mul(double a, double b) { return a * b; }
+static inline double double_set1(double q) { return q; }
+
+STREAM_KERNELS(scalar, , 1, double_load, double_store,
+	       double_add, double_mul, double_set1)
+
+#ifdef STREAM_X86
+STREAM_KERNELS(sse2, __attribute__((target("sse2"))), 2,
+	       _mm_load_pd, _mm_store_pd, _mm_add_pd, _mm_mul_pd, _mm_set1_pd)
+STREAM_KERNELS(sse2_nt, __attribute__((target("sse2"))), 2,
+	       _mm_load_pd, _mm_stream_pd, _mm_add_pd, _mm_mul_pd, _mm_set1_pd)
+STREAM_KERNELS(avx2, __attribute__((target("avx2"))), 4,
+	       _mm256_load_pd, _mm256_store_pd, _mm256_add_pd, _mm256_mul_pd,
+	       _mm256_set1_pd)
+STREAM_KERNELS(avx2_nt, __attribute__((target("avx2"))), 4,
+	       _mm256_load_pd, _mm256_stream_pd, _mm256_add_pd, _mm256_mul_pd,
+	       _mm256_set1_pd)
+STREAM_KERNELS(avx512, __attribute__((target("avx512f"))), 8,
+	       _mm512_load_pd, _mm512_store_pd, _mm512_add_pd, _mm512_mul_pd,
+	       _mm512_set1_pd)
+STREAM_KERNELS(avx512_nt, __attribute__((target("avx512f"))), 8,
+	       _mm512_load_pd, _mm512_stream_pd, _mm512_add_pd, _mm512_mul_pd,
+	       _mm512_set1_pd)
+#endif
+
+#define KERNELS(isa) { isa##_copy, isa##_scale, isa##_add, isa##_triad }
+
+static struct stream_isa {
+	const char *name;
+	const char *feature;
+	stream_fn_t kernels[4];
+	stream_fn_t nt_kernels[4];
+} stream_isas[] = {
+	{ "scalar", NULL,      KERNELS(scalar),                     },
+#ifdef STREAM_X86
+	{ "sse2",   "sse2",    KERNELS(sse2),   KERNELS(sse2_nt),   },
+	{ "avx2",   "avx2",    KERNELS(avx2),   KERNELS(avx2_nt),   },
+	{ "avx512", "avx512f", KERNELS(avx512), KERNELS(avx512_nt), },
+#endif
+};
+
+/*
+ * The arrays used by the kernels as in the STREAM benchmark, with
+ * the number of arrays accessed to count the bytes moved
+ */
+static struct stream_kernel {
+	const char *name;
+	int dst, x, y, nrarrays;
+} stream_kernels[] = {
+	{ "copy",  2, 0, 0, 2 }, /* c = a */
+	{ "scale", 1, 2, 2, 2 }, /* b = q * c */
+	{ "add",   2, 0, 1, 3 }, /* c = a + b */
+	{ "triad", 0, 1, 2, 3 }, /* a = b + q * c */
+};
+
+static struct stream {
+	double *array[3];
+	size_t size;
+	int nrworkers;
+	int nt;
+	stream_fn_t fn;
+	struct stream_kernel *kernel;
+} stream;
+
+static int stream_isa_supported(struct stream_isa *isa)
+{
+#ifdef STREAM_X86
+	if (!isa->feature)
+		return 1;
+
+	__builtin_cpu_init();
+
+	if (!strcmp(isa->feature, "sse2"))
+		return __builtin_cpu_supports("sse2");
+	if (!strcmp(isa->feature, "avx2"))
+		return __builtin_cpu_supports("avx2");
+	if (!strcmp(isa->feature, "avx512f"))
+		return __builtin_cpu_supports("avx512f");
+
+	return 0;
+#else
+	return !isa->feature;
+#endif
+}
+
+static struct stream_isa *stream_isa_find(const char *name)
+{
+	int i;
+
+	/* The instruction sets are ordered from the oldest to the newest */
+	if (!strcmp(name, "auto")) {
+		for (i = ARRAY_SIZE(stream_isas) - 1; i > 0; i--)
+			if (stream_isa_supported(&stream_isas[i]))
+				break;
+		return &stream_isas[i];
+	}
+
+	for (i = 0; i < ARRAY_SIZE(stream_isas); i++) {
+		if (strcmp(stream_isas[i].name, name))
+			continue;
+
+		if (stream_isa_supported(&stream_isas[i]))
+			return &stream_isas[i];
+
+		ERROR("'%s' is not supported by the cpu\n", name);
+		return NULL;
+	}
+
+	ERROR("Unknown instruction set '%s'\n", name);
+	return NULL;
+}
+
+static struct stream_kernel *stream_kernel_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(stream_kernels); i++)
+		if (!strcmp(stream_kernels[i].name, name))
+			return &stream_kernels[i];
+
+	ERROR("Unknown kernel '%s'\n", name);
+	return NULL;
+}
+
+/*
+ * Size of the last level cache of a cpu, or zero if the cpu is not the
+ * first one sharing it, so the sum over the cpus counts each cache once
+ */
+static size_t stream_llc_size(int cpu)
+{
+	struct cache caches[8];
+	int nr;
+
+	nr = cpu_caches(cpu, caches, ARRAY_SIZE(caches));
+	if (!nr || caches[nr - 1].first != cpu)
+		return 0;
+
+	return caches[nr - 1].size;
+}
+
+void *plugin_prerun(struct ts_param *params)
+{
+	struct stream_isa *isa;
+	size_t llc = 0, size, chunk;
+	long ratio;
+	int i, cpu, nrcpus;
+
+	memset(&stream, 0, sizeof(stream));
+
+	stream.kernel = stream_kernel_find(plugin_param(params, "kernel"));
+	isa = stream_isa_find(plugin_param(params, "isa"));
+	if (!stream.kernel || !isa)
+		return NULL;
+
+	stream.nt = !strcmp(plugin_param(params, "store"), "nontemporal");
+	stream.fn = stream.nt ? isa->nt_kernels[stream.kernel - stream_kernels] :
+		isa->kernels[stream.kernel - stream_kernels];
+	if (!stream.fn) {
+		ERROR("No non-temporal stores for '%s'\n", isa->name);
+		return NULL;
+	}
+
+	stream.nrworkers = cpu_nrworkers(plugin_param(params, "workers"));
+	if (stream.nrworkers < 0)
+		return NULL;
+
+	nrcpus = sysconf(_SC_NPROCESSORS_CONF);
+	for (cpu = 0; cpu < nrcpus; cpu++)
+		llc += stream_llc_size(cpu);
+
+	ratio = plugin_param_long(params, "ratio");
+	if (ratio <= 0) {
+		ERROR("Invalid cache size ratio\n");
+		return NULL;
+	}
+
+	/* Each array is 'ratio' times the size of all the caches */
+	size = MAX(llc * ratio, STREAM_MINSIZE);
+
+	/* Split in aligned chunks of vectors between the workers */
+	chunk = size / MAX(stream.nrworkers, 1);
+	chunk -= chunk % (STREAM_VECTOR * sizeof(double));
+	stream.size = chunk * MAX(stream.nrworkers, 1);
+
+	DEBUG("%s %s%s, %zu KB of cache, %zu KB arrays, %d workers\n",
+	      stream.kernel->name, isa->name, stream.nt ? " non-temporal" : "",
+	      llc / 1024, stream.size / 1024, stream.nrworkers);
+
+	/* The pages are faulted in by the workers, see plugin_init_worker() */
+	for (i = 0; i < ARRAY_SIZE(stream.array); i++) {
+		if (posix_memalign((void **)&stream.array[i], STREAM_ALIGN,
+				   stream.size)) {
+			ERROR("Failed to allocate the arrays\n");
+			return NULL;
+		}
+	}
+
+	return &stream;
+}
+
+/*
+ * The part of the arrays of the worker, in bytes
+ */
+static size_t stream_chunk(struct stream *stream, struct ts_worker *worker)
+{
+	size_t chunk = stream->size / worker->nrworkers;
+
+	return chunk - chunk % (STREAM_VECTOR * sizeof(double));
+}
+
+int plugin_workers(void *arg)
+{
+	struct stream *stream = arg;
+
+	return stream ? stream->nrworkers : 0;
+}
+
+/*
+ * Fault in the part of the arrays of the worker from its cpu, so its
+ * pages are on its NUMA node as with the OpenMP STREAM
+ */
+int plugin_init_worker(void *arg, struct ts_worker *worker)
+{
+	struct stream *stream = arg;
+	size_t chunk;
+	int i;
+
+	if (!stream)
+		return -1;
+
+	chunk = stream_chunk(stream, worker);
+
+	for (i = 0; i < ARRAY_SIZE(stream->array); i++)
+		memset((char *)stream->array[i] + worker->id * chunk, 0, chunk);
+
+	return 0;
+}
+
+int plugin_run_worker(void *arg, struct ts_worker *worker)
+{
+	struct stream *stream = arg;
+	struct stream_kernel *kernel;
+	size_t chunk, offset, n;
+	unsigned long i;
+
+	if (!stream)
+		return -1;
+
+	kernel = stream->kernel;
+
+	chunk = stream_chunk(stream, worker);
+	offset = worker->id * chunk / sizeof(double);
+	n = chunk / sizeof(double);
+
+	for (i = 0; i < worker->work.batch; i++)
+		stream->fn(stream->array[kernel->dst] + offset,
+			   stream->array[kernel->x] + offset,
+			   stream->array[kernel->y] + offset,
+			   STREAM_SCALAR, n);
+
+#ifdef STREAM_X86
+	/* The non-temporal stores are weakly ordered */
+	if (stream->nt)
+		_mm_sfence();
+#endif
+
+	worker->work.ops = worker->work.batch;
+	worker->work.bytes = worker->work.batch * chunk * kernel->nrarrays;
+
+	return 0;
+}
+
+void plugin_postrun(void *arg)
+{
+	struct stream *stream = arg;
+	int i;
+
+	if (!stream)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(stream->array); i++)
+		free(stream->array[i]);
+}
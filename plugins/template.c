@@ -4,7 +4,12 @@
  * Rule1: do not use printf but the traces API
  *
  * Rule2: The plugin_prerun, plugin_run and plugin_postrun functions
- *        must be implemented with these names and function signatures
+ *        must be implemented with these names and function signatures,
+ *        a throughput plugin implements plugin_run_batch instead of
+ *        plugin_run, doing the number of operations asked by the
+ *        harness and reporting the operations and bytes processed,
+ *        a multi-threaded plugin implements plugin_run_worker, and
+ *        optionally plugin_workers, to run on the harness workers
  *
  * Rule3: Put in the plug_prerun function all initialization
  *
@@ -19,6 +24,9 @@
  *
  * Rule7: plugin_name and plugin_desc must be declared and initialized
  *
+ * Rule8: Instead of copying a plugin to change a constant, declare it
+ *        in plugin_params and read its value in plugin_prerun
+ *
  */
 
 #include "common.h"
@@ -30,9 +38,15 @@ static struct private_data {
 	int a_value;
 } pdata = { 1234 };
 
-void *plugin_prerun(void *arg)
+struct ts_param plugin_params[] = {
+	{ .name = "value", .range = "1234" },
+	{ NULL },
+};
+
+void *plugin_prerun(struct ts_param *params)
 {
-	/* arg is a ts_options structure coming for the ts */
+	/* params holds the values of the current run of the sweep */
+	pdata.a_value = plugin_param_long(params, "value");
 	return &pdata;
 }
 
@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "plugin.h"
+#include "pool.h"
+#include "topology.h"
+
+/*
+ * Pool of workers for the multi-threaded plugins. The workers are
+ * created and pinned before the measurement and wait on the start
+ * barrier, the harness releases them by joining the barrier and waits
+ * for their completion on the end barrier.
+ *
+ * The workers wait for all of them to be created before joining the
+ * barriers, so the ones already created can be stopped when the
+ * creation of one fails. They are then initialized on their cpu and
+ * pool_create() waits for them on the end barrier.
+ */
+struct pool_thread {
+	struct pool *pool;
+	struct ts_worker *worker;
+};
+
+struct pool {
+	int nrworkers;
+	int error;
+	int stop;
+	int created;
+	pool_fn_t init;
+	pool_fn_t fn;
+	void *arg;
+	pthread_t *threads;
+	struct pool_thread *args;
+	struct ts_worker *workers;
+	pthread_barrier_t start;
+	pthread_barrier_t end;
+	pthread_barrier_t barrier; /* for the workers themselves */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/*
+ * The cpus in the order they are given to the workers: the first
+ * thread of the first core of each package, then of the second core
+ * of each package, etc... then the second thread of each core. The
+ * workers are spread on the packages and the physical cores first, so
+ * as many workers as packages get one package each, and they are
+ * always placed the same way. The cpus the harness is not allowed to
+ * run on, as with taskset or a cpuset, are left out.
+ */
+static int pool_cpus(struct topology *topology, int **cpus)
+{
+	int i, j, t, nrcpus = 0, more = 1, cores;
+	int *array = NULL;
+	cpu_set_t allowed;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+		ERROR("Failed to get the allowed cpus: %m\n");
+		return 0;
+	}
+
+	for (t = 0; more; t++) {
+
+		more = 0;
+
+		for (j = 0, cores = 1; cores; j++) {
+
+			cores = 0;
+
+			for (i = 0; i < topology->nrpackages; i++) {
+
+				struct package *package = &topology->package[i];
+				struct core *core;
+				int cpu;
+
+				if (j >= package->nrcores)
+					continue;
+
+				cores = 1;
+				core = &package->core[j];
+
+				if (!core->nrthreads && !t)
+					cpu = core->os_id;
+				else if (t < core->nrthreads)
+					cpu = core->thread[t].os_id;
+				else
+					continue;
+
+				more = 1;
+
+				if (!CPU_ISSET(cpu, &allowed))
+					continue;
+
+				array = realloc(array, sizeof(*array) * (nrcpus + 1));
+				if (!array)
+					FATAL("Failed to allocate memory for cpus\n");
+
+				array[nrcpus++] = cpu;
+			}
+		}
+	}
+
+	*cpus = array;
+
+	return nrcpus;
+}
+
+static void *pool_worker(void *arg)
+{
+	struct pool_thread *thread = arg;
+	struct pool *pool = thread->pool;
+	struct ts_worker *worker = thread->worker;
+	int ret;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->created)
+		pthread_cond_wait(&pool->cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	if (pool->stop)
+		return NULL;
+
+	ret = pool->init ? pool->init(pool->arg, worker) : 0;
+	if (ret)
+		__atomic_store_n(&pool->error, ret, __ATOMIC_RELAXED);
+
+	pthread_barrier_wait(&pool->end);
+
+	for (;;) {
+
+		pthread_barrier_wait(&pool->start);
+
+		if (pool->stop)
+			break;
+
+		ret = pool->fn(pool->arg, worker);
+		if (ret)
+			__atomic_store_n(&pool->error, ret, __ATOMIC_RELAXED);
+
+		pthread_barrier_wait(&pool->end);
+	}
+
+	return NULL;
+}
+
+/*
+ * Join the stopped workers and free the pool
+ */
+static void pool_free(struct pool *pool)
+{
+	int i;
+
+	for (i = 0; i < pool->nrworkers; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_barrier_destroy(&pool->start);
+	pthread_barrier_destroy(&pool->end);
+	pthread_barrier_destroy(&pool->barrier);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->cond);
+
+	free(pool->threads);
+	free(pool->args);
+	free(pool->workers);
+	free(pool);
+}
+
+struct pool *pool_create(struct topology *topology, int nrworkers,
+			 pool_fn_t init, pool_fn_t fn, void *arg)
+{
+	struct pool *pool;
+	int i, ret, nrcpus, *cpus;
+
+	nrcpus = pool_cpus(topology, &cpus);
+	if (!nrcpus)
+		return NULL;
+
+	if (nrworkers <= 0)
+		nrworkers = nrcpus;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		FATAL("Failed to allocate memory for the pool\n");
+
+	pool->threads = calloc(nrworkers, sizeof(*pool->threads));
+	pool->args = calloc(nrworkers, sizeof(*pool->args));
+	pool->workers = calloc(nrworkers, sizeof(*pool->workers));
+	if (!pool->threads || !pool->args || !pool->workers)
+		FATAL("Failed to allocate memory for the workers\n");
+
+	pool->nrworkers = nrworkers;
+	pool->init = init;
+	pool->fn = fn;
+	pool->arg = arg;
+
+	pthread_barrier_init(&pool->start, NULL, nrworkers + 1);
+	pthread_barrier_init(&pool->end, NULL, nrworkers + 1);
+	pthread_barrier_init(&pool->barrier, NULL, nrworkers);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	for (i = 0; i < nrworkers; i++) {
+
+		struct ts_worker *worker = &pool->workers[i];
+		pthread_attr_t attr;
+		cpu_set_t cpuset;
+
+		worker->id = i;
+		worker->nrworkers = nrworkers;
+		worker->cpu = cpus[i % nrcpus];
+		worker->barrier = &pool->barrier;
+
+		pool->args[i].pool = pool;
+		pool->args[i].worker = worker;
+
+		CPU_ZERO(&cpuset);
+		CPU_SET(worker->cpu, &cpuset);
+
+		pthread_attr_init(&attr);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset);
+
+		ret = pthread_create(&pool->threads[i], &attr, pool_worker, &pool->args[i]);
+
+		pthread_attr_destroy(&attr);
+
+		if (ret) {
+			ERROR("Failed to create worker %d on cpu %d: %s\n",
+			      i, worker->cpu, strerror(ret));
+			pool->stop = 1;
+			break;
+		}
+
+		DEBUG("worker %d pinned on cpu %d\n", i, worker->cpu);
+	}
+
+	free(cpus);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->created = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	if (pool->stop) {
+		pool->nrworkers = i;
+		pool_free(pool);
+		return NULL;
+	}
+
+	pthread_barrier_wait(&pool->end);
+
+	if (pool->error) {
+		ERROR("Failed to initialize the workers\n");
+		pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+/*
+ * Release the workers and wait for them, this is the function
+ * called in the measurement window
+ */
+int pool_run(struct pool *pool, struct ts_work *work)
+{
+	int i;
+
+	pool->error = 0;
+
+	for (i = 0; i < pool->nrworkers; i++) {
+		pool->workers[i].work.batch = work->batch;
+		pool->workers[i].work.ops = 0;
+		pool->workers[i].work.bytes = 0;
+	}
+
+	pthread_barrier_wait(&pool->start);
+	pthread_barrier_wait(&pool->end);
+
+	work->ops = 0;
+	work->bytes = 0;
+
+	for (i = 0; i < pool->nrworkers; i++) {
+		work->ops += pool->workers[i].work.ops;
+		work->bytes += pool->workers[i].work.bytes;
+	}
+
+	return pool->error;
+}
+
+void pool_destroy(struct pool *pool)
+{
+	if (!pool)
+		return;
+
+	pool->stop = 1;
+	pthread_barrier_wait(&pool->start);
+
+	pool_free(pool);
+}
@@ -0,0 +1,18 @@
+#ifndef __TS_POOL_H
+#define __TS_POOL_H
+
+struct pool;
+struct topology;
+struct ts_work;
+struct ts_worker;
+
+typedef int (*pool_fn_t)(void *, struct ts_worker *);
+
+extern struct pool *pool_create(struct topology *topology, int nrworkers,
+				pool_fn_t init, pool_fn_t fn, void *arg);
+
+extern int pool_run(struct pool *pool, struct ts_work *work);
+
+extern void pool_destroy(struct pool *pool);
+
+#endif
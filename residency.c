@@ -0,0 +1,356 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "trace.h"
+#include "stats.h"
+#include "topology.h"
+#include "residency.h"
+#include "timeline.h"
+
+/*
+ * Idle states and frequency residency of the cpus: the cpuidle usage
+ * and time counters and the cpufreq statistics are read around the
+ * measurement windows, next to the energy, and their deltas are summed
+ * per package. The frequency is the average of the cpufreq time in
+ * state, or of the current frequency at both ends of the window when
+ * the statistics are not available or the window is too short for
+ * them.
+ *
+ * The cpu sysfs root can be changed with the TS_CPU_ROOT environment
+ * variable, "/sys/devices/system/cpu" by default, to use a fake tree.
+ */
+#define RESIDENCY_ROOT "/sys/devices/system/cpu"
+
+struct residency_cpu {
+	uint64_t usage[RESIDENCY_STATES];
+	uint64_t time[RESIDENCY_STATES];
+	uint64_t freq_time; /* sum of the cpufreq time in state */
+	uint64_t freq_sum;  /* sum of the frequencies times their time */
+	uint64_t cur_freq;
+};
+
+static const char *residency_root;
+static int residency_nrcpus;
+static int *residency_cpus;
+static int *residency_packages; /* package index of each cpu */
+static int residency_nrpackages;
+static int residency_nrstates;
+static char residency_names[RESIDENCY_STATES][RESIDENCY_NAME];
+static struct residency_cpu *residency_snapshot[2];
+static uint64_t residency_ts;
+static struct residency *residency_last;
+
+static FILE *residency_open(int cpu, const char *file)
+{
+	char *path;
+	FILE *f;
+
+	if (asprintf(&path, "%s/cpu%d/%s", residency_root, cpu, file) < 0)
+		FATAL("Failed to allocate memory for the residency path\n");
+
+	f = fopen(path, "r");
+
+	free(path);
+
+	return f;
+}
+
+static uint64_t residency_read_value(int cpu, const char *file)
+{
+	unsigned long long value = 0;
+	FILE *f;
+
+	f = residency_open(cpu, file);
+	if (!f)
+		return 0;
+
+	if (fscanf(f, "%llu", &value) != 1)
+		value = 0;
+
+	fclose(f);
+
+	return value;
+}
+
+static void residency_read(int cpu, struct residency_cpu *snapshot)
+{
+	unsigned long long freq, time;
+	char file[64];
+	FILE *f;
+	int i;
+
+	for (i = 0; i < residency_nrstates; i++) {
+		snprintf(file, sizeof(file), "cpuidle/state%d/usage", i);
+		snapshot->usage[i] = residency_read_value(cpu, file);
+		snprintf(file, sizeof(file), "cpuidle/state%d/time", i);
+		snapshot->time[i] = residency_read_value(cpu, file);
+	}
+
+	snapshot->cur_freq = residency_read_value(cpu, "cpufreq/scaling_cur_freq");
+	snapshot->freq_time = snapshot->freq_sum = 0;
+
+	f = residency_open(cpu, "cpufreq/stats/time_in_state");
+	if (!f)
+		return;
+
+	while (fscanf(f, "%llu %llu", &freq, &time) == 2) {
+		snapshot->freq_time += time;
+		snapshot->freq_sum += freq * time;
+	}
+
+	fclose(f);
+}
+
+static void residency_read_all(struct residency_cpu *snapshot)
+{
+	int i;
+
+	for (i = 0; i < residency_nrcpus; i++)
+		residency_read(residency_cpus[i], &snapshot[i]);
+}
+
+static int residency_add_cpu(int cpu, int package)
+{
+	residency_cpus = realloc(residency_cpus,
+				 sizeof(*residency_cpus) * (residency_nrcpus + 1));
+	residency_packages = realloc(residency_packages,
+				     sizeof(*residency_packages) * (residency_nrcpus + 1));
+	if (!residency_cpus || !residency_packages)
+		FATAL("Failed to allocate memory for the residency cpus\n");
+
+	residency_cpus[residency_nrcpus] = cpu;
+	residency_packages[residency_nrcpus] = package;
+	residency_nrcpus++;
+
+	return 0;
+}
+
+/*
+ * The idle states are described by the first cpu, the others are
+ * expected to have the same ones
+ */
+static void residency_probe_states(int cpu)
+{
+	char file[64];
+	FILE *f;
+
+	for (residency_nrstates = 0; residency_nrstates < RESIDENCY_STATES;
+	     residency_nrstates++) {
+
+		snprintf(file, sizeof(file), "cpuidle/state%d/name",
+			 residency_nrstates);
+
+		f = residency_open(cpu, file);
+		if (!f)
+			break;
+
+		if (fscanf(f, "%15s", residency_names[residency_nrstates]) != 1)
+			snprintf(residency_names[residency_nrstates],
+				 RESIDENCY_NAME, "state%d", residency_nrstates);
+
+		fclose(f);
+	}
+}
+
+int residency_init(struct topology *topology)
+{
+	int i, j, k;
+
+	timeline_begin("residency_init", NULL);
+
+	residency_root = getenv("TS_CPU_ROOT");
+	if (!residency_root)
+		residency_root = RESIDENCY_ROOT;
+
+	for (i = 0; i < topology->nrpackages; i++) {
+		struct package *package = &topology->package[i];
+
+		for (j = 0; j < package->nrcores; j++) {
+			struct core *core = &package->core[j];
+
+			if (!core->nrthreads)
+				residency_add_cpu(core->os_id, i);
+
+			for (k = 0; k < core->nrthreads; k++)
+				residency_add_cpu(core->thread[k].os_id, i);
+		}
+	}
+
+	residency_nrpackages = topology->nrpackages;
+
+	if (residency_nrcpus)
+		residency_probe_states(residency_cpus[0]);
+
+	if (!residency_nrcpus ||
+	    (!residency_nrstates &&
+	     !residency_read_value(residency_cpus[0], "cpufreq/scaling_cur_freq"))) {
+		DEBUG("No cpuidle nor cpufreq in '%s'\n", residency_root);
+		residency_fini();
+		timeline_end("residency_init");
+		return 0;
+	}
+
+	for (i = 0; i < 2; i++) {
+		residency_snapshot[i] = calloc(residency_nrcpus,
+					       sizeof(*residency_snapshot[i]));
+		if (!residency_snapshot[i])
+			FATAL("Failed to allocate memory for the residency\n");
+	}
+
+	residency_last = residency_alloc(residency_nrpackages);
+
+	DEBUG("%d idle states on %d cpus\n", residency_nrstates, residency_nrcpus);
+
+	timeline_end("residency_init");
+
+	return 0;
+}
+
+void residency_begin(void)
+{
+	if (!residency_last)
+		return;
+
+	residency_ts = timeline_now();
+	residency_read_all(residency_snapshot[0]);
+}
+
+/*
+ * Sum the deltas of the cpus of each package into the last window
+ */
+void residency_end(void)
+{
+	struct residency_cpu *begin = residency_snapshot[0];
+	struct residency_cpu *end = residency_snapshot[1];
+	struct residency_pkg *pkg;
+	int i, j, nrfreqs[residency_nrpackages];
+	double freq;
+
+	if (!residency_last)
+		return;
+
+	residency_read_all(end);
+
+	residency_last->duration = timeline_now() - residency_ts;
+
+	for (i = 0; i < residency_nrpackages; i++) {
+		pkg = &residency_last->pkg[i];
+		memset(pkg, 0, sizeof(*pkg));
+		pkg->nrstates = residency_nrstates;
+		for (j = 0; j < residency_nrstates; j++)
+			strcpy(pkg->states[j].name, residency_names[j]);
+		nrfreqs[i] = 0;
+	}
+
+	for (i = 0; i < residency_nrcpus; i++) {
+		pkg = &residency_last->pkg[residency_packages[i]];
+		pkg->nrcpus++;
+
+		for (j = 0; j < residency_nrstates; j++) {
+			pkg->states[j].usage += end[i].usage[j] - begin[i].usage[j];
+			pkg->states[j].time += end[i].time[j] - begin[i].time[j];
+		}
+
+		if (end[i].freq_time > begin[i].freq_time)
+			freq = (double)(end[i].freq_sum - begin[i].freq_sum) /
+				(end[i].freq_time - begin[i].freq_time);
+		else
+			freq = (begin[i].cur_freq + end[i].cur_freq) / 2.0;
+
+		if (!freq)
+			continue;
+
+		nrfreqs[residency_packages[i]]++;
+		pkg->freq = avg(pkg->freq, freq, nrfreqs[residency_packages[i]]);
+	}
+}
+
+struct residency *residency_alloc(int nrpackages)
+{
+	struct residency *residency;
+
+	residency = calloc(1, sizeof(*residency));
+	if (!residency)
+		FATAL("Failed to allocate memory for the residency\n");
+
+	residency->pkg = calloc(nrpackages, sizeof(*residency->pkg));
+	if (nrpackages && !residency->pkg)
+		FATAL("Failed to allocate memory for the residency\n");
+
+	residency->nrpackages = nrpackages;
+
+	return residency;
+}
+
+struct residency *residency_clone(const struct residency *residency)
+{
+	struct residency *clone;
+
+	clone = residency_alloc(residency->nrpackages);
+	clone->duration = residency->duration;
+	memcpy(clone->pkg, residency->pkg,
+	       sizeof(*residency->pkg) * residency->nrpackages);
+
+	return clone;
+}
+
+/*
+ * Average the last window in avg, allocated at the first one, where
+ * nr is the number of windows averaged including the last one
+ */
+void residency_average(struct residency **avg, int nr)
+{
+	struct residency_pkg *pkg, *last;
+	int i, j;
+
+	if (!residency_last)
+		return;
+
+	if (!*avg) {
+		*avg = residency_clone(residency_last);
+		return;
+	}
+
+	(*avg)->duration = avg((*avg)->duration, residency_last->duration, nr);
+
+	for (i = 0; i < residency_last->nrpackages; i++) {
+		pkg = &(*avg)->pkg[i];
+		last = &residency_last->pkg[i];
+
+		pkg->freq = avg(pkg->freq, last->freq, nr);
+
+		for (j = 0; j < last->nrstates; j++) {
+			pkg->states[j].usage = avg(pkg->states[j].usage,
+						   last->states[j].usage, nr);
+			pkg->states[j].time = avg(pkg->states[j].time,
+						  last->states[j].time, nr);
+		}
+	}
+}
+
+void residency_free(struct residency *residency)
+{
+	if (!residency)
+		return;
+
+	free(residency->pkg);
+	free(residency);
+}
+
+void residency_fini(void)
+{
+	residency_free(residency_last);
+	free(residency_snapshot[0]);
+	free(residency_snapshot[1]);
+	free(residency_cpus);
+	free(residency_packages);
+
+	residency_last = NULL;
+	residency_snapshot[0] = residency_snapshot[1] = NULL;
+	residency_cpus = NULL;
+	residency_packages = NULL;
+	residency_nrcpus = 0;
+}
@@ -0,0 +1,48 @@
+#ifndef __TS_RESIDENCY_H
+#define __TS_RESIDENCY_H
+
+#define RESIDENCY_STATES 16
+#define RESIDENCY_NAME   16
+
+struct topology;
+
+struct residency_state {
+	char name[RESIDENCY_NAME];
+	double usage; /* entries in the idle state */
+	double time;  /* usecs in the idle state, of all the cpus */
+};
+
+struct residency_pkg {
+	int nrcpus;
+	double freq;  /* average frequency of the cpus in kHz, 0 if unknown */
+	int nrstates;
+	struct residency_state states[RESIDENCY_STATES];
+};
+
+/*
+ * Idle states residency and frequency of the packages during a
+ * measurement window
+ */
+struct residency {
+	double duration; /* usecs */
+	int nrpackages;
+	struct residency_pkg *pkg;
+};
+
+extern int residency_init(struct topology *topology);
+
+extern void residency_begin(void);
+
+extern void residency_end(void);
+
+extern void residency_average(struct residency **avg, int nr);
+
+extern struct residency *residency_alloc(int nrpackages);
+
+extern struct residency *residency_clone(const struct residency *residency);
+
+extern void residency_free(struct residency *residency);
+
+extern void residency_fini(void);
+
+#endif
@@ -1,26 +1,42 @@
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
 #include <math.h>
+#include <sys/param.h>
 
 #include <openssl/md5.h>
 
 #include "trace.h"
 #include "topology.h"
 #include "energy.h"
-
-struct ts_plugin_results {
-	const char *path;
-	const char *md5sum;
-	double duration;
-	double energy;
+#include "results.h"
+#include "timeline.h"
+#include "histogram.h"
+#include "residency.h"
+#include "cgroup.h"
+
+/*
+ * The results file begins with the magic followed by the format
+ * version. The files written before the versioning begin directly
+ * with the number of results and are loaded as version 1.
+ */
+#define TS_RESULTS_MAGIC   0x53525354 /* "TSRS" */
+#define TS_RESULTS_VERSION 10
+
+struct ts_attr {
+	char *key;
+	char *value;
 };
 
 struct ts_results {
 	int nr_results;
+	int nr_attrs;
 	double duration;
 	double energy;
+	double baseline;
+	struct ts_attr *attrs;
 	struct ts_plugin_results *tspr;
 };
 
@@ -77,7 +93,7 @@ static const char *md5sum(const char *path)
 	return buffer;
 }
 
-int results_update(struct ts_results *tsr, const char *path, double duration, double energy)
+int results_update(struct ts_results *tsr, const struct ts_plugin_results *result)
 {
 	struct ts_plugin_results *tspr = tsr->tspr;
 
@@ -85,32 +101,357 @@ int results_update(struct ts_results *tsr, const char *path, double duration, do
 	if (!tspr)
 		FATAL("Failed to allocate memory for results\n");
 
-	tspr[tsr->nr_results].path = strdup(path);
-	tspr[tsr->nr_results].md5sum = md5sum(path);
-	tspr[tsr->nr_results].energy = energy;
-	tspr[tsr->nr_results].duration = duration;
+	tspr[tsr->nr_results] = *result;
+	tspr[tsr->nr_results].path = strdup(result->path);
+	tspr[tsr->nr_results].params = strdup(result->params ? result->params : "");
+	if (result->histogram) {
+		tspr[tsr->nr_results].histogram = malloc(sizeof(*result->histogram));
+		if (!tspr[tsr->nr_results].histogram)
+			FATAL("Failed to allocate memory for histogram\n");
+		*tspr[tsr->nr_results].histogram = *result->histogram;
+	}
+	if (result->residency)
+		tspr[tsr->nr_results].residency = residency_clone(result->residency);
+	if (result->cgroup) {
+		tspr[tsr->nr_results].cgroup = malloc(sizeof(*result->cgroup));
+		if (!tspr[tsr->nr_results].cgroup)
+			FATAL("Failed to allocate memory for the cgroup stat\n");
+		*tspr[tsr->nr_results].cgroup = *result->cgroup;
+	}
+	timeline_begin("md5sum", NULL);
+	tspr[tsr->nr_results].md5sum = md5sum(result->path);
+	timeline_end("md5sum");
 	tsr->tspr = tspr;
 	tsr->nr_results++;
-	tsr->energy += energy;
-	tsr->duration += duration;
+	tsr->energy += result->energy;
+	tsr->duration += result->duration;
+	tsr->baseline += result->baseline;
 	
 	return 0;
 }
 
-static struct ts_plugin_results *results_find(const char *name, struct ts_results *tsr)
+int results_set_attr(struct ts_results *tsr, const char *key, const char *fmt, ...)
+{
+	struct ts_attr *attrs;
+	va_list args;
+	char *value;
+	int i, ret;
+
+	va_start(args, fmt);
+	ret = vasprintf(&value, fmt, args);
+	va_end(args);
+
+	if (ret < 0)
+		FATAL("Failed to allocate memory for attribute '%s'\n", key);
+
+	for (i = 0; i < tsr->nr_attrs; i++) {
+		if (strcmp(tsr->attrs[i].key, key))
+			continue;
+		free(tsr->attrs[i].value);
+		tsr->attrs[i].value = value;
+		return 0;
+	}
+
+	attrs = realloc(tsr->attrs, (tsr->nr_attrs + 1) * sizeof(*attrs));
+	if (!attrs)
+		FATAL("Failed to allocate memory for attributes\n");
+
+	attrs[tsr->nr_attrs].key = strdup(key);
+	attrs[tsr->nr_attrs].value = value;
+	tsr->attrs = attrs;
+	tsr->nr_attrs++;
+
+	return 0;
+}
+
+const char *results_get_attr(struct ts_results *tsr, const char *key)
+{
+	int i;
+
+	for (i = 0; i < tsr->nr_attrs; i++)
+		if (!strcmp(tsr->attrs[i].key, key))
+			return tsr->attrs[i].value;
+
+	return NULL;
+}
+
+static void results_show_attrs(struct ts_results *tsr, const char *prefix)
+{
+	int i;
+
+	for (i = 0; i < tsr->nr_attrs; i++)
+		if (!strncmp(tsr->attrs[i].key, prefix, strlen(prefix)))
+			NOTICE("%s: %s\n", tsr->attrs[i].key, tsr->attrs[i].value);
+}
+
+/*
+ * Warn about the attributes with the prefix differing between the
+ * results, or missing from one of them
+ */
+static void results_compare_attrs(struct ts_results *tsr1,
+				  struct ts_results *tsr2, const char *prefix)
+{
+	const char *key, *value;
+	int i;
+
+	for (i = 0; i < tsr1->nr_attrs; i++) {
+
+		key = tsr1->attrs[i].key;
+		if (strncmp(key, prefix, strlen(prefix)))
+			continue;
+
+		value = results_get_attr(tsr2, key);
+		if (!value)
+			WARNING("%s: missing from the second run\n", key);
+		else if (strcmp(tsr1->attrs[i].value, value))
+			WARNING("%s: '%s' / '%s'\n", key, tsr1->attrs[i].value, value);
+	}
+
+	for (i = 0; i < tsr2->nr_attrs; i++) {
+
+		key = tsr2->attrs[i].key;
+		if (!strncmp(key, prefix, strlen(prefix)) &&
+		    !results_get_attr(tsr1, key))
+			WARNING("%s: missing from the first run\n", key);
+	}
+}
+
+static struct ts_plugin_results *results_find(const char *name, const char *params,
+						struct ts_results *tsr)
 {
 	int i;
 	struct ts_plugin_results *tspr = tsr->tspr;
 
 	for (i = 0; i < tsr->nr_results; i++)
-		if (!strcmp(name, tspr[i].path))
+		if (!strcmp(name, tspr[i].path) && !strcmp(params, tspr[i].params))
 			return &tspr[i];
 
 	return NULL;
 }
 
+/*
+ * The results of a sweep share the same path, they are told apart
+ * by their parameters
+ */
+static const char *results_label(const char *name, const char *params,
+				 char *buffer, size_t size)
+{
+	if (!*params)
+		return name;
+
+	snprintf(buffer, size, "%s [%s]", name, params);
+
+	return buffer;
+}
+
+static void results_show_throughput(struct ts_plugin_results *tspr, const char *label)
+{
+	double secs = tspr->duration / 1000000;
+
+	NOTICE("%s: %.0lf ops, %.2lf ns/op, %.2lf ops/s\n", label,
+	       tspr->ops, tspr->duration * 1000 / tspr->ops, tspr->ops / secs);
+
+	if (tspr->energy)
+		NOTICE("%s: %g J/op\n", label,
+		       tspr->energy / 1000000 / tspr->ops);
+
+	if (tspr->bytes)
+		NOTICE("%s: %.0lf bytes, %.2lf MB/s\n", label,
+		       tspr->bytes, tspr->bytes / secs / 1000000);
+
+	if (tspr->bytes && tspr->energy)
+		NOTICE("%s: %.2lf GB/s, %g J/GB\n", label,
+		       tspr->bytes / secs / 1000000000,
+		       tspr->energy / 1000000 / (tspr->bytes / 1000000000));
+}
+
+static const double results_percentiles[] = { 50, 90, 99, 99.9, 99.99 };
+
+/*
+ * Append to the line being built, a truncated line stays at the end of
+ * the buffer
+ */
+static int results_append(char *buffer, size_t size, int len, const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	if (len >= size - 1)
+		return len;
+
+	va_start(args, fmt);
+	ret = vsnprintf(buffer + len, size - len, fmt, args);
+	va_end(args);
+
+	if (ret < 0)
+		return len;
+
+	return len + ret < size ? len + ret : size - 1;
+}
+
+static void results_show_histogram(struct histogram *histogram, const char *label)
+{
+	char buffer[256];
+	int i, len;
+
+	len = results_append(buffer, sizeof(buffer), 0, "%s: latency", label);
+
+	for (i = 0; i < sizeof(results_percentiles) / sizeof(double); i++)
+		len = results_append(buffer, sizeof(buffer), len,
+				" p%g %.2lf", results_percentiles[i],
+				histogram_percentile(histogram,
+						     results_percentiles[i]) / 1000.0);
+
+	NOTICE("%s, max %.2lf usecs (%llu samples)\n", buffer,
+	       histogram->max / 1000.0, (unsigned long long)histogram->count);
+}
+
+/*
+ * Percentage of the time the cpus of a package spent in an idle state
+ */
+static double results_residency_pct(struct residency *residency,
+				    struct residency_pkg *pkg, int state)
+{
+	double time = residency->duration * pkg->nrcpus;
+
+	return time ? pkg->states[state].time * 100 / time : 0;
+}
+
+static void results_show_residency(struct residency *residency, const char *label)
+{
+	char buffer[512];
+	int i, j, len;
+
+	for (i = 0; i < residency->nrpackages; i++) {
+
+		struct residency_pkg *pkg = &residency->pkg[i];
+
+		len = results_append(buffer, sizeof(buffer), 0, "%s: package%d", label, i);
+
+		if (pkg->freq)
+			len = results_append(buffer, sizeof(buffer), len,
+					" %.2lf GHz", pkg->freq / 1000000);
+
+		for (j = 0; j < pkg->nrstates; j++)
+			len = results_append(buffer, sizeof(buffer), len,
+					" %s %.2lf%% (%.0lf)", pkg->states[j].name,
+					results_residency_pct(residency, pkg, j),
+					pkg->states[j].usage);
+
+		NOTICE("%s\n", buffer);
+	}
+}
+
 #define ratio(v1, v2) ((((v2) - (v1)) / (v1)) * 100)
 
+/*
+ * The size in MB, "n/a" when it was not measured
+ */
+static const char *results_mb(double bytes, int missing, char *buffer, size_t size)
+{
+	if (missing)
+		return "n/a";
+
+	snprintf(buffer, size, "%.2lf", bytes / (1 << 20));
+
+	return buffer;
+}
+
+static void results_show_cgroup(struct cgroup_stat *cgroup, const char *label)
+{
+	char memory[32], rbytes[32], wbytes[32];
+
+	NOTICE("%s: %.0lf usecs user / %.0lf usecs system, %s MB peak, "
+	       "%s MB read / %s MB written%s\n", label, cgroup->user,
+	       cgroup->system,
+	       results_mb(cgroup->memory, cgroup->missing & CGROUP_NO_MEMORY,
+			  memory, sizeof(memory)),
+	       results_mb(cgroup->rbytes, cgroup->missing & CGROUP_NO_IO,
+			  rbytes, sizeof(rbytes)),
+	       results_mb(cgroup->wbytes, cgroup->missing & CGROUP_NO_IO,
+			  wbytes, sizeof(wbytes)),
+	       cgroup->wait4 ? " (waited processes only)" : "");
+
+	if (!cgroup->wait4)
+		NOTICE("%s: %.0lf / %.0lf / %.0lf usecs stalled on cpu / memory / io\n",
+		       label, cgroup->cpu_some, cgroup->memory_some,
+		       cgroup->io_some);
+}
+
+/*
+ * The runs of a comparison having the flag set
+ */
+static const char *results_which(int flags1, int flags2, int flag)
+{
+	if ((flags1 & flag) && (flags2 & flag))
+		return "both runs";
+
+	return flags1 & flag ? "the first run" : "the second run";
+}
+
+/*
+ * The frequencies are compared in percent and the residencies in
+ * percentage points, the idle states are matched by name
+ */
+static void results_compare_residency(struct residency *residency1,
+				      struct residency *residency2,
+				      const char *name)
+{
+	char buffer[512];
+	int i, j, k, len;
+
+	for (i = 0; i < residency1->nrpackages && i < residency2->nrpackages; i++) {
+
+		struct residency_pkg *pkg1 = &residency1->pkg[i];
+		struct residency_pkg *pkg2 = &residency2->pkg[i];
+
+		len = results_append(buffer, sizeof(buffer), 0, "'%s': package%d", name, i);
+
+		if (pkg1->freq && pkg2->freq)
+			len = results_append(buffer, sizeof(buffer), len,
+					" %+.2lf%% freq", ratio(pkg1->freq, pkg2->freq));
+
+		for (j = 0; j < pkg1->nrstates; j++) {
+
+			for (k = 0; k < pkg2->nrstates; k++)
+				if (!strcmp(pkg1->states[j].name, pkg2->states[k].name))
+					break;
+
+			if (k == pkg2->nrstates)
+				continue;
+
+			len = results_append(buffer, sizeof(buffer), len,
+					" %s %+.2lf pts", pkg1->states[j].name,
+					results_residency_pct(residency2, pkg2, k) -
+					results_residency_pct(residency1, pkg1, j));
+		}
+
+		NOTICE("%s\n", buffer);
+	}
+}
+
+static void results_compare_histogram(struct histogram *histogram1,
+				      struct histogram *histogram2,
+				      const char *name)
+{
+	char buffer[256];
+	int i, len;
+
+	len = results_append(buffer, sizeof(buffer), 0, "'%s': latency", name);
+
+	for (i = 0; i < sizeof(results_percentiles) / sizeof(double); i++) {
+
+		double p1 = histogram_percentile(histogram1, results_percentiles[i]);
+		double p2 = histogram_percentile(histogram2, results_percentiles[i]);
+
+		len = results_append(buffer, sizeof(buffer), len,
+				" p%g %+.2lf%%", results_percentiles[i],
+				p1 ? ratio(p1, p2) : 0);
+	}
+
+	NOTICE("%s\n", buffer);
+}
+
 int results_compare(struct ts_results *tsr1, struct ts_results *tsr2)
 {
 	int i;
@@ -124,6 +465,14 @@ int results_compare(struct ts_results *tsr1, struct ts_results *tsr2)
 	if (tsr1->nr_results != tsr2->nr_results)
 		WARNING("There is a different number of results\n");
 
+	NOTICE("Baseline 1:\n");
+	results_show_attrs(tsr1, "baseline.");
+	NOTICE("Baseline 2:\n");
+	results_show_attrs(tsr2, "baseline.");
+
+	/* A different machine or setup makes the comparison questionable */
+	results_compare_attrs(tsr1, tsr2, "env.");
+
 	tspr1 = tsr1->tspr;
 	tspr2 = tsr2->tspr;
 
@@ -135,9 +484,13 @@ int results_compare(struct ts_results *tsr1, struct ts_results *tsr2)
 	for (i = 0; i < tsr1->nr_results; i++) {
 
 		struct ts_plugin_results *tspr;
-		char *name = basename(tsr1->tspr[i].path);
+		char buffer[MAXPATHLEN];
+		const char *name;
+
+		name = results_label(basename(tspr1[i].path), tspr1[i].params,
+				     buffer, sizeof(buffer));
 
-		tspr = results_find(tspr1[i].path, tsr2);
+		tspr = results_find(tspr1[i].path, tspr1[i].params, tsr2);
 		if (!tspr) {
 			WARNING("Failed to find plugin '%s' result to compare\n", name);
 			continue;
@@ -150,6 +503,64 @@ int results_compare(struct ts_results *tsr1, struct ts_results *tsr2)
 		NOTICE("'%s': %+.2lf%% usecs / %+.2lf%% uJ\n",
 		       name, ratio(tspr1[i].duration, tspr->duration),
 		       ratio(tspr1[i].energy, tspr->energy));
+
+		/*
+		 * The batch size of the throughput plugins changes from
+		 * one run to another, compare the cost per operation
+		 */
+		if (tspr1[i].ops && tspr->ops)
+			NOTICE("'%s': %+.2lf%% ns/op / %+.2lf%% J/op\n", name,
+			       ratio(tspr1[i].duration / tspr1[i].ops,
+				     tspr->duration / tspr->ops),
+			       ratio(tspr1[i].energy / tspr1[i].ops,
+				     tspr->energy / tspr->ops));
+
+		if (tspr1[i].histogram && tspr->histogram)
+			results_compare_histogram(tspr1[i].histogram,
+						  tspr->histogram, name);
+
+		if (tspr1[i].residency && tspr->residency)
+			results_compare_residency(tspr1[i].residency,
+						  tspr->residency, name);
+
+		if (tspr1[i].cgroup && tspr->cgroup &&
+		    ((tspr1[i].cgroup->missing | tspr->cgroup->missing) & CGROUP_NO_MEMORY))
+			NOTICE("'%s': %+.2lf%% cpu / n/a peak memory\n", name,
+			       ratio(tspr1[i].cgroup->user + tspr1[i].cgroup->system,
+				     tspr->cgroup->user + tspr->cgroup->system));
+		else if (tspr1[i].cgroup && tspr->cgroup)
+			NOTICE("'%s': %+.2lf%% cpu / %+.2lf%% peak memory\n", name,
+			       ratio(tspr1[i].cgroup->user + tspr1[i].cgroup->system,
+				     tspr->cgroup->user + tspr->cgroup->system),
+			       ratio(tspr1[i].cgroup->memory, tspr->cgroup->memory));
+
+		if ((tspr1[i].flags | tspr->flags) & RESULT_OVERHEAD_NOISE)
+			WARNING("'%s': within the harness overhead noise, "
+				"the comparison is not relevant\n", name);
+
+		if ((tspr1[i].flags | tspr->flags) & RESULT_THROTTLED)
+			WARNING("'%s': thermal throttling during %s\n",
+				name, results_which(tspr1[i].flags, tspr->flags,
+						    RESULT_THROTTLED));
+
+		DEBUG("'%s': %.2lf%% / %.2lf%% foreign cpu\n", name,
+		      tspr1[i].noise, tspr->noise);
+
+		if ((tspr1[i].flags | tspr->flags) & RESULT_NOISY)
+			WARNING("'%s': system noise during %s\n",
+				name, results_which(tspr1[i].flags, tspr->flags,
+						    RESULT_NOISY));
+
+		if (!tspr1[i].baseline || !tspr->baseline)
+			continue;
+
+		DEBUG("'%s': %lf / %lf dynamic uJ\n", name,
+		      tspr1[i].energy - tspr1[i].baseline,
+		      tspr->energy - tspr->baseline);
+
+		NOTICE("'%s': %+.2lf%% dynamic uJ\n", name,
+		       ratio(tspr1[i].energy - tspr1[i].baseline,
+			     tspr->energy - tspr->baseline));
 	}
 
 	DEBUG("Overall time: %.0lf / %.0lf usecs\n",
@@ -175,13 +586,61 @@ int results_publish(struct ts_results *tsr)
 	if (!tspr)
 		FATAL("Something is wrong, no plugins result\n");
 
+	results_show_attrs(tsr, "env.");
+	results_show_attrs(tsr, "baseline.");
+	results_show_attrs(tsr, "overhead.");
+
 	for (i = 0; i < tsr->nr_results; i++) {
-		NOTICE("%s: %.0lf usecs / %lf uJoules\n", tspr[i].path,
+
+		char buffer[MAXPATHLEN];
+		const char *label;
+
+		label = results_label(tspr[i].path, tspr[i].params,
+				      buffer, sizeof(buffer));
+
+		NOTICE("%s: %.0lf usecs / %lf uJoules\n", label,
 		       tspr[i].duration, tspr[i].energy);
+
+		if (tspr[i].baseline)
+			NOTICE("%s: %lf uJoules baseline / %lf uJoules dynamic\n",
+			       label, tspr[i].baseline,
+			       tspr[i].energy - tspr[i].baseline);
+
+		if (tspr[i].ops)
+			results_show_throughput(&tspr[i], label);
+
+		if (tspr[i].histogram)
+			results_show_histogram(tspr[i].histogram, label);
+
+		if (tspr[i].residency)
+			results_show_residency(tspr[i].residency, label);
+
+		if (tspr[i].flags & RESULT_OVERHEAD_NOISE)
+			WARNING("%s: result is within the harness overhead noise\n",
+				label);
+
+		if (tspr[i].flags & RESULT_THROTTLED)
+			WARNING("%s: thermal throttling during the run\n", label);
+
+		if (tspr[i].noise || tspr[i].irqs || tspr[i].reruns)
+			NOTICE("%s: %.2lf%% foreign cpu, %.0lf irqs/s, load %.2lf, "
+			       "%d reruns\n", label, tspr[i].noise, tspr[i].irqs,
+			       tspr[i].load, tspr[i].reruns);
+
+		if (tspr[i].flags & RESULT_NOISY)
+			WARNING("%s: noisy iterations kept after the reruns\n",
+				label);
+
+		if (tspr[i].cgroup)
+			results_show_cgroup(tspr[i].cgroup, label);
 	}
 
 	NOTICE("Overall: %.0lf usecs, %lf uJoules\n", tsr->duration, tsr->energy);
 
+	if (tsr->baseline)
+		NOTICE("Overall: %lf uJoules baseline, %lf uJoules dynamic\n",
+		       tsr->baseline, tsr->energy - tsr->baseline);
+
 	return 0;
 }
 
@@ -198,15 +657,303 @@ struct ts_results *results_alloc(void)
 
 void results_free(struct ts_results *tsr)
 {
+	int i;
+
+	for (i = 0; i < tsr->nr_results; i++) {
+		free((char *)tsr->tspr[i].path);
+		free((char *)tsr->tspr[i].params);
+		free((char *)tsr->tspr[i].md5sum);
+		free(tsr->tspr[i].histogram);
+		residency_free(tsr->tspr[i].residency);
+		free(tsr->tspr[i].cgroup);
+	}
+
+	for (i = 0; i < tsr->nr_attrs; i++) {
+		free(tsr->attrs[i].key);
+		free(tsr->attrs[i].value);
+	}
+
+	free(tsr->tspr);
+	free(tsr->attrs);
 	free(tsr);
 }
 
+static char *results_read_string(FILE *f)
+{
+	size_t len;
+	char *str;
+
+	if (fread(&len, sizeof(len), 1, f) < 1)
+		return NULL;
+
+	str = malloc(len + 1);
+	if (!str)
+		FATAL("Failed to allocate memory for string\n");
+
+	if (fread(str, len + 1, 1, f) < 1) {
+		free(str);
+		return NULL;
+	}
+
+	str[len] = '\0';
+
+	return str;
+}
+
+static int results_write_string(FILE *f, const char *str)
+{
+	size_t len = strlen(str);
+
+	if (fwrite(&len, sizeof(len), 1, f) < 1)
+		return -1;
+
+	if (fwrite(str, len + 1, 1, f) < 1)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * The histograms are stored as their number of non empty buckets,
+ * zero if there is no histogram, followed by the index and the count
+ * of these buckets
+ */
+static int results_write_histogram(FILE *f, struct histogram *histogram)
+{
+	int i, nr = 0;
+
+	for (i = 0; histogram && i < HISTOGRAM_BUCKETS; i++)
+		nr += !!histogram->buckets[i];
+
+	if (fwrite(&nr, sizeof(nr), 1, f) < 1)
+		return -1;
+
+	if (!nr)
+		return 0;
+
+	if (fwrite(&histogram->min, sizeof(histogram->min), 1, f) < 1 ||
+	    fwrite(&histogram->max, sizeof(histogram->max), 1, f) < 1)
+		return -1;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+
+		if (!histogram->buckets[i])
+			continue;
+
+		if (fwrite(&i, sizeof(i), 1, f) < 1 ||
+		    fwrite(&histogram->buckets[i], sizeof(histogram->buckets[i]), 1, f) < 1)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int results_read_histogram(FILE *f, struct histogram **histogram)
+{
+	struct histogram *h;
+	uint64_t count;
+	int i, nr, index;
+
+	*histogram = NULL;
+
+	if (fread(&nr, sizeof(nr), 1, f) < 1)
+		return -1;
+
+	if (!nr)
+		return 0;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		FATAL("Failed to allocate memory for histogram\n");
+
+	if (fread(&h->min, sizeof(h->min), 1, f) < 1 ||
+	    fread(&h->max, sizeof(h->max), 1, f) < 1)
+		goto out_free;
+
+	for (i = 0; i < nr; i++) {
+
+		if (fread(&index, sizeof(index), 1, f) < 1 ||
+		    fread(&count, sizeof(count), 1, f) < 1 ||
+		    index < 0 || index >= HISTOGRAM_BUCKETS)
+			goto out_free;
+
+		h->buckets[index] = count;
+		h->count += count;
+	}
+
+	*histogram = h;
+
+	return 0;
+
+out_free:
+	free(h);
+	return -1;
+}
+
+/*
+ * The residency is stored as its number of packages, zero if there is
+ * no residency, its duration and the frequency and the idle states of
+ * each package
+ */
+static int results_write_residency(FILE *f, struct residency *residency)
+{
+	int i, j, nr = residency ? residency->nrpackages : 0;
+
+	if (fwrite(&nr, sizeof(nr), 1, f) < 1)
+		return -1;
+
+	if (!nr)
+		return 0;
+
+	if (fwrite(&residency->duration, sizeof(residency->duration), 1, f) < 1)
+		return -1;
+
+	for (i = 0; i < nr; i++) {
+
+		struct residency_pkg *pkg = &residency->pkg[i];
+
+		if (fwrite(&pkg->nrcpus, sizeof(pkg->nrcpus), 1, f) < 1 ||
+		    fwrite(&pkg->freq, sizeof(pkg->freq), 1, f) < 1 ||
+		    fwrite(&pkg->nrstates, sizeof(pkg->nrstates), 1, f) < 1)
+			return -1;
+
+		for (j = 0; j < pkg->nrstates; j++)
+			if (results_write_string(f, pkg->states[j].name) ||
+			    fwrite(&pkg->states[j].usage, sizeof(pkg->states[j].usage), 1, f) < 1 ||
+			    fwrite(&pkg->states[j].time, sizeof(pkg->states[j].time), 1, f) < 1)
+				return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * The resources of a script are stored after a flag, zero for a plugin
+ */
+static int results_write_cgroup(FILE *f, struct cgroup_stat *cgroup)
+{
+	int present = !!cgroup;
+
+	if (fwrite(&present, sizeof(present), 1, f) < 1)
+		return -1;
+
+	if (!present)
+		return 0;
+
+	if (fwrite(&cgroup->user, sizeof(cgroup->user), 1, f) < 1 ||
+	    fwrite(&cgroup->system, sizeof(cgroup->system), 1, f) < 1 ||
+	    fwrite(&cgroup->memory, sizeof(cgroup->memory), 1, f) < 1 ||
+	    fwrite(&cgroup->rbytes, sizeof(cgroup->rbytes), 1, f) < 1 ||
+	    fwrite(&cgroup->wbytes, sizeof(cgroup->wbytes), 1, f) < 1 ||
+	    fwrite(&cgroup->cpu_some, sizeof(cgroup->cpu_some), 1, f) < 1 ||
+	    fwrite(&cgroup->memory_some, sizeof(cgroup->memory_some), 1, f) < 1 ||
+	    fwrite(&cgroup->io_some, sizeof(cgroup->io_some), 1, f) < 1 ||
+	    fwrite(&cgroup->wait4, sizeof(cgroup->wait4), 1, f) < 1 ||
+	    fwrite(&cgroup->missing, sizeof(cgroup->missing), 1, f) < 1)
+		return -1;
+
+	return 0;
+}
+
+static int results_read_cgroup(FILE *f, int version, struct cgroup_stat **cgroup)
+{
+	struct cgroup_stat *c;
+	int present;
+
+	*cgroup = NULL;
+
+	if (fread(&present, sizeof(present), 1, f) < 1)
+		return -1;
+
+	if (!present)
+		return 0;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		FATAL("Failed to allocate memory for the cgroup stat\n");
+
+	if (fread(&c->user, sizeof(c->user), 1, f) < 1 ||
+	    fread(&c->system, sizeof(c->system), 1, f) < 1 ||
+	    fread(&c->memory, sizeof(c->memory), 1, f) < 1 ||
+	    fread(&c->rbytes, sizeof(c->rbytes), 1, f) < 1 ||
+	    fread(&c->wbytes, sizeof(c->wbytes), 1, f) < 1 ||
+	    fread(&c->cpu_some, sizeof(c->cpu_some), 1, f) < 1 ||
+	    fread(&c->memory_some, sizeof(c->memory_some), 1, f) < 1 ||
+	    fread(&c->io_some, sizeof(c->io_some), 1, f) < 1 ||
+	    fread(&c->wait4, sizeof(c->wait4), 1, f) < 1 ||
+	    (version >= 10 &&
+	     fread(&c->missing, sizeof(c->missing), 1, f) < 1)) {
+		free(c);
+		return -1;
+	}
+
+	*cgroup = c;
+
+	return 0;
+}
+
+static int results_read_residency(FILE *f, struct residency **residency)
+{
+	struct residency *r;
+	char *name;
+	int i, j, nr;
+
+	*residency = NULL;
+
+	if (fread(&nr, sizeof(nr), 1, f) < 1)
+		return -1;
+
+	if (!nr)
+		return 0;
+
+	r = residency_alloc(nr);
+
+	if (fread(&r->duration, sizeof(r->duration), 1, f) < 1)
+		goto out_free;
+
+	for (i = 0; i < nr; i++) {
+
+		struct residency_pkg *pkg = &r->pkg[i];
+
+		if (fread(&pkg->nrcpus, sizeof(pkg->nrcpus), 1, f) < 1 ||
+		    fread(&pkg->freq, sizeof(pkg->freq), 1, f) < 1 ||
+		    fread(&pkg->nrstates, sizeof(pkg->nrstates), 1, f) < 1 ||
+		    pkg->nrstates < 0 || pkg->nrstates > RESIDENCY_STATES)
+			goto out_free;
+
+		for (j = 0; j < pkg->nrstates; j++) {
+
+			name = results_read_string(f);
+			if (!name)
+				goto out_free;
+
+			snprintf(pkg->states[j].name, RESIDENCY_NAME, "%s", name);
+			free(name);
+
+			if (fread(&pkg->states[j].usage, sizeof(pkg->states[j].usage), 1, f) < 1 ||
+			    fread(&pkg->states[j].time, sizeof(pkg->states[j].time), 1, f) < 1)
+				goto out_free;
+		}
+	}
+
+	*residency = r;
+
+	return 0;
+
+out_free:
+	residency_free(r);
+	return -1;
+}
+
 struct ts_results *results_load(const char *path)
 {
+	struct ts_plugin_results tspr = { NULL };
+	char *params = NULL;
 	char name[4096];
 	double energy, duration;
 	char md5sum[512];
-	int nr_results;
+	int nr_results, nr_attrs = 0;
+	int magic, version = 1;
 	struct ts_results *tsr;
 	FILE *f;
 	int i;
@@ -220,53 +967,162 @@ struct ts_results *results_load(const char *path)
 	f = fopen(path, "r");
 	if (!f) {
 		ERROR("Failed to open file '%s'\n", path);
-		return NULL;
+		goto out_free;
+	}
+
+	if (fread(&magic, sizeof(magic), 1, f) != 1) {
+		ERROR("Failed to read the results header\n");
+		goto out_free;
+	}
+
+	if (magic == TS_RESULTS_MAGIC) {
+
+		if (fread(&version, sizeof(version), 1, f) != 1) {
+			ERROR("Failed to read the results version\n");
+			goto out_free;
+		}
+
+		if (version > TS_RESULTS_VERSION) {
+			ERROR("Unsupported results version %d\n", version);
+			goto out_free;
+		}
+
+		if (fread(&nr_attrs, sizeof(nr_attrs), 1, f) != 1) {
+			ERROR("Failed to read the number of attributes\n");
+			goto out_free;
+		}
+	} else {
+		/* Old format without header, the magic is the number of results */
+		rewind(f);
+	}
+
+	for (i = 0; i < nr_attrs; i++) {
+
+		char *key, *value;
+
+		key = results_read_string(f);
+		value = key ? results_read_string(f) : NULL;
+		if (!value) {
+			ERROR("Failed to read results attribute\n");
+			free(key);
+			goto out_free;
+		}
+
+		results_set_attr(tsr, key, "%s", value);
+		free(key);
+		free(value);
 	}
 
 	if (fread(&nr_results, sizeof(nr_results), 1, f) != 1) {
 		ERROR("Failed to result the number of results data\n");
-		return NULL;
+		goto out_free;
 	}
 
 	for (i = 0; i < nr_results; i++) {
 
 		size_t len;
 
-		if (fread(&len, sizeof(len), 1, f) < 1) {
+		memset(&tspr, 0, sizeof(tspr));
+		tspr.path = name;
+		params = NULL;
+
+		if (fread(&len, sizeof(len), 1, f) < 1 || len >= sizeof(name)) {
 			ERROR("Failed to read plugin name length\n");
-			return NULL;
+			goto out_free;
 		}
 
 		if (fread(name, len + 1, 1, f) < 1) {
 			ERROR("Failed to read plugin name\n");
-			return NULL;
+			goto out_free;
 		}
 
-		if (fread(&len, sizeof(len), 1, f) < 1) {
-			ERROR("Failed to read plugin name length\n");
-			return NULL;
+		if (fread(&len, sizeof(len), 1, f) < 1 || len >= sizeof(md5sum)) {
+			ERROR("Failed to read plugin md5sum length\n");
+			goto out_free;
 		}
 
 		if (fread(md5sum, len + 1, 1, f) < 1) {
 			ERROR("Failed to read plugin md5sum\n");
-			return NULL;
+			goto out_free;
 		}
 
 		if (fread(&duration, sizeof(duration), 1, f) < 1) {
 			ERROR("Failed to read plugin duration results\n");
-			return NULL;
+			goto out_free;
 		}
 
 		if (fread(&energy, sizeof(energy), 1, f) < 1) {
 			ERROR("Failed to read plugin energy results\n");
-			return NULL;
+			goto out_free;
 		}
 
-		if (results_update(tsr, name, duration, energy)) {
+		if (version >= 2 &&
+		    fread(&tspr.baseline, sizeof(tspr.baseline), 1, f) < 1) {
+			ERROR("Failed to read plugin baseline results\n");
+			goto out_free;
+		}
+
+		if (version >= 3 &&
+		    fread(&tspr.flags, sizeof(tspr.flags), 1, f) < 1) {
+			ERROR("Failed to read plugin flags\n");
+			goto out_free;
+		}
+
+		if (version >= 4 &&
+		    (fread(&tspr.ops, sizeof(tspr.ops), 1, f) < 1 ||
+		     fread(&tspr.bytes, sizeof(tspr.bytes), 1, f) < 1)) {
+			ERROR("Failed to read plugin throughput results\n");
+			goto out_free;
+		}
+
+		if (version >= 5) {
+			params = results_read_string(f);
+			if (!params) {
+				ERROR("Failed to read plugin parameters\n");
+				goto out_free;
+			}
+			tspr.params = params;
+		}
+
+		if (version >= 6 && results_read_histogram(f, &tspr.histogram)) {
+			ERROR("Failed to read plugin latency histogram\n");
+			goto out_free;
+		}
+
+		if (version >= 7 && results_read_residency(f, &tspr.residency)) {
+			ERROR("Failed to read plugin idle and frequency residency\n");
+			goto out_free;
+		}
+
+		if (version >= 8 &&
+		    (fread(&tspr.noise, sizeof(tspr.noise), 1, f) < 1 ||
+		     fread(&tspr.irqs, sizeof(tspr.irqs), 1, f) < 1 ||
+		     fread(&tspr.load, sizeof(tspr.load), 1, f) < 1 ||
+		     fread(&tspr.reruns, sizeof(tspr.reruns), 1, f) < 1)) {
+			ERROR("Failed to read plugin system noise\n");
+			goto out_free;
+		}
+
+		if (version >= 9 && results_read_cgroup(f, version, &tspr.cgroup)) {
+			ERROR("Failed to read script resources\n");
+			goto out_free;
+		}
+
+		tspr.duration = duration;
+		tspr.energy = energy;
+
+		if (results_update(tsr, &tspr)) {
 			ERROR("Failed to update results\n");
-			return NULL;
+			goto out_free;
 		}
 
+		free(params);
+		free(tspr.histogram);
+		residency_free(tspr.residency);
+		free(tspr.cgroup);
+		memset(&tspr, 0, sizeof(tspr));
+		params = NULL;
+
 		if (tsr->tspr[i].md5sum && strcmp(tsr->tspr[i].md5sum, md5sum))
 			WARNING("md5sum differs on '%s', was it modified ?\n", name);
 	}
@@ -274,10 +1130,21 @@ struct ts_results *results_load(const char *path)
 	fclose(f);
 
 	return tsr;
+
+out_free:
+	free(params);
+	free(tspr.histogram);
+	residency_free(tspr.residency);
+	free(tspr.cgroup);
+	if (f)
+		fclose(f);
+	results_free(tsr);
+	return NULL;
 }
 
-int results_save(const char *path, struct ts_results *tsr)
+static int _results_save(const char *path, struct ts_results *tsr)
 {
+	int magic = TS_RESULTS_MAGIC, version = TS_RESULTS_VERSION;
 	FILE *f;
 	int i;
 
@@ -297,6 +1164,21 @@ int results_save(const char *path, struct ts_results *tsr)
 		return -1;
 	}
 
+	if (fwrite(&magic, sizeof(magic), 1, f) != 1 ||
+	    fwrite(&version, sizeof(version), 1, f) != 1 ||
+	    fwrite(&tsr->nr_attrs, sizeof(tsr->nr_attrs), 1, f) != 1) {
+		ERROR("Failed to write results header\n");
+		return -1;
+	}
+
+	for (i = 0; i < tsr->nr_attrs; i++) {
+		if (results_write_string(f, tsr->attrs[i].key) ||
+		    results_write_string(f, tsr->attrs[i].value)) {
+			ERROR("Failed to write results attributes\n");
+			return -1;
+		}
+	}
+
 	if (fwrite(&tsr->nr_results, sizeof(tsr->nr_results), 1, f) != 1) {
 		ERROR("Failed to write results data\n");
 		return -1;
@@ -338,9 +1220,52 @@ int results_save(const char *path, struct ts_results *tsr)
 			ERROR("Failed to write plugin results\n");
 			return -1;
 		}
+
+		if (fwrite(&tspr->baseline, sizeof(tspr->baseline), 1, f) < 1) {
+			ERROR("Failed to write plugin results\n");
+			return -1;
+		}
+
+		if (fwrite(&tspr->flags, sizeof(tspr->flags), 1, f) < 1) {
+			ERROR("Failed to write plugin results\n");
+			return -1;
+		}
+
+		if (fwrite(&tspr->ops, sizeof(tspr->ops), 1, f) < 1 ||
+		    fwrite(&tspr->bytes, sizeof(tspr->bytes), 1, f) < 1) {
+			ERROR("Failed to write plugin results\n");
+			return -1;
+		}
+
+		if (results_write_string(f, tspr->params) ||
+		    results_write_histogram(f, tspr->histogram) ||
+		    results_write_residency(f, tspr->residency)) {
+			ERROR("Failed to write plugin results\n");
+			return -1;
+		}
+
+		if (fwrite(&tspr->noise, sizeof(tspr->noise), 1, f) < 1 ||
+		    fwrite(&tspr->irqs, sizeof(tspr->irqs), 1, f) < 1 ||
+		    fwrite(&tspr->load, sizeof(tspr->load), 1, f) < 1 ||
+		    fwrite(&tspr->reruns, sizeof(tspr->reruns), 1, f) < 1 ||
+		    results_write_cgroup(f, tspr->cgroup)) {
+			ERROR("Failed to write plugin results\n");
+			return -1;
+		}
 	}
 
 	fclose(f);
 
 	return 0;
 }
+
+int results_save(const char *path, struct ts_results *tsr)
+{
+	int ret;
+
+	timeline_begin("results_save", NULL);
+	ret = _results_save(path, tsr);
+	timeline_end("results_save");
+
+	return ret;
+}
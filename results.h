@@ -2,13 +2,44 @@
 #define __TS_RESULTS_H
 
 struct ts_results;
+struct histogram;
+struct residency;
+struct cgroup_stat;
+
+#define RESULT_OVERHEAD_NOISE 0x1 /* result within the harness noise */
+#define RESULT_THROTTLED      0x2 /* thermal throttling during a run */
+#define RESULT_NOISY          0x4 /* noisy iterations kept, out of reruns */
+
+struct ts_plugin_results {
+	const char *path;
+	const char *md5sum;
+	double duration;
+	double energy;
+	double baseline; /* idle energy for the duration */
+	int flags;
+	double ops;   /* operations done by a throughput plugin */
+	double bytes; /* bytes processed by a throughput plugin */
+	const char *params; /* "name=value,..." of the parameter sweep */
+	struct histogram *histogram; /* latencies recorded by the plugin */
+	struct residency *residency; /* idle states and frequency, may be NULL */
+	double noise; /* % of the cpus time used by the other tasks */
+	double irqs;  /* interrupts per second */
+	double load;  /* 1 minute load average */
+	int reruns;   /* noisy iterations run again */
+	struct cgroup_stat *cgroup; /* resources of a script, may be NULL */
+};
 
 extern struct ts_results *results_alloc(void);
 extern struct ts_results *results_load(const char *path);
 extern void results_free(struct ts_results *tsr);
 
-extern int results_update(struct ts_results *tsr, const char *path,
-			  double duration, double energy);
+extern int results_update(struct ts_results *tsr,
+			  const struct ts_plugin_results *tspr);
+
+extern int results_set_attr(struct ts_results *tsr, const char *key,
+			    const char *fmt, ...);
+
+extern const char *results_get_attr(struct ts_results *tsr, const char *key);
 
 extern int results_compare(struct ts_results *tsr1, struct ts_results *tsr2);
 
@@ -1,5 +1,6 @@
 #define _GNU_SOURCE 
 #include <dirent.h>
+#include <errno.h>
 #include <dlfcn.h>
 #include <unistd.h>
 #include <regex.h>
@@ -17,18 +18,90 @@
 #include "results.h"
 #include "energy.h"
 #include "topology.h"
+#include "baseline.h"
+#include "measure.h"
+#include "overhead.h"
+#include "stats.h"
+#include "timeline.h"
+#include "residency.h"
+#include "thermal.h"
+#include "noise.h"
+#include "cgroup.h"
+#include "sweep.h"
+
+/*
+ * The scripts declare their parameters with comment lines:
+ *
+ * # ts-param: name=range
+ *
+ * see sweep.c for the range format. The current values are passed to
+ * each phase of the script as "name=value" arguments after the phase.
+ */
+#define SCRIPT_PARAM "# ts-param:"
+
+struct script {
+	const char *path;
+	struct sweep *sweep;
+	struct rusage rusage;    /* of the last run */
+	struct cgroup_stat stat; /* resources of the last run */
+};
+
+static void script_child_error(const char *path, const char *error)
+{
+	const char *strs[] = { "ERROR: Failed to execute '", path, "': ",
+			       error, "\n" };
+	int i;
 
-static int script_exec(const char *script, const char *parameter)
+	for (i = 0; i < sizeof(strs) / sizeof(strs[0]); i++)
+		if (write(STDOUT_FILENO, strs[i], strlen(strs[i])) < 0)
+			break;
+}
+
+/*
+ * Execute a phase of the script, when rusage is not NULL the script is
+ * moved into the run cgroup and its rusage is stored
+ */
+static int script_exec(struct script *script, const char *parameter,
+		       struct rusage *rusage)
 {
-	const char *const argv[] = { script, parameter, NULL };
+	int i, nrparams = sweep_nrparams(script->sweep);
+	char *argv[nrparams + 3];
+	struct rusage self;
+	int sync[2];
 	pid_t pid;
 	int status, cout, cerr;
 
+	argv[0] = (char *)script->path;
+	argv[1] = (char *)parameter;
+	argv[nrparams + 2] = NULL;
+
+	for (i = 0; i < nrparams; i++) {
+		const char *name = sweep_name(script->sweep, i);
+
+		if (asprintf(&argv[i + 2], "%s=%s", name,
+			     sweep_value(script->sweep, name)) < 0)
+			FATAL("Failed to allocate script argument\n");
+	}
+
+	trace_flush();
+
+	/* The script waits for the parent to move it into its cgroup */
+	if (pipe2(sync, O_CLOEXEC))
+		FATAL("Failed to create the script pipe\n");
+
 	pid = fork();
 	if (pid < 0)
 		FATAL("Failed to fork script process\n");
 
+	/*
+	 * The trace lock may be held by the drain thread at the fork, the
+	 * child writes its error directly and exits without the atexit
+	 * flush of the traces
+	 */
 	if (!pid) {
+		close(sync[1]);
+		if (read(sync[0], &status, 1) < 0)
+			_exit(1);
 /*		cout = open(script, O_CREAT, 0600);
 		if (cout < 0) {
 			ERROR("Failed to open '%s': %m", );
@@ -39,12 +112,21 @@ static int script_exec(const char *script, const char *parameter)
                         ERROR("Failed to open ");
                 }
 */
-		execv(script, argv);
-		ERROR("Failed to execute script: %m\n");
-		exit(1);
+		execv(script->path, argv);
+		script_child_error(script->path, strerror(errno));
+		_exit(1);
 	}
 
-	if (waitpid(pid, &status, 0) < 0) {
+	if (rusage)
+		cgroup_attach(pid);
+
+	close(sync[0]);
+	close(sync[1]);
+
+	for (i = 0; i < nrparams; i++)
+		free(argv[i + 2]);
+
+	if (wait4(pid, &status, 0, rusage ? rusage : &self) < 0) {
 		ERROR("Failed to wait pid '%d': %m\n", pid);
 		return -1;
 	}
@@ -56,55 +138,192 @@ static int script_exec(const char *script, const char *parameter)
 	return -1;
 }
 
-static int script_run(struct ts_options *tso, const char *path,
-		      unsigned long *duration, struct energy *energy)
+static int script_exec_run(void *script)
 {
-	struct timeval begin, end;
-	struct energy *nrj;
-	int ret = -1;
+	struct script *s = script;
 
-	nrj = energy_clone(energy);
+	return script_exec(s, "run", &s->rusage);
+}
 
-	if (script_exec(path, "prerun")) {
-		ERROR("Failed to run '%s prerun\n");
+static int script_run(struct ts_options *tso, struct script *script,
+		      unsigned long *duration, struct energy *energy)
+{
+	const char *path = script->path;
+	int ret;
+
+	timeline_begin("prerun", NULL);
+	ret = script_exec(script, "prerun", NULL);
+	timeline_end("prerun");
+	if (ret) {
+		ERROR("Failed to run '%s prerun\n", path);
 		return -1;
 	}
 
-	trace_raw(NOTICE, "NOTICE: Running '%s'... ", path);
+	if (sweep_nrparams(script->sweep))
+		trace_raw(NOTICE, "NOTICE: Running '%s' [%s]... ", path,
+			  sweep_tag(script->sweep));
+	else
+		trace_raw(NOTICE, "NOTICE: Running '%s'... ", path);
 
-	gettimeofday(&begin, NULL);
+	timeline_begin("run", NULL);
+	cgroup_begin();
+	ret = measure(script_exec_run, script, energy, duration);
+	cgroup_end(&script->rusage, &script->stat);
+	timeline_end("run");
 
-	if (energy_read(nrj))
-		ERROR("Failed to read sensor energie\n");
+	trace_raw(NOTICE, "%s\n", ret ? "Fail" : "Ok");
 
-	ret = script_exec(path, "run");
 	if (ret) {
-		ERROR("Failed to run '%s run\n");
+		ERROR("Failed to run '%s run\n", path);
 		return -1;
 	}
 
-	if (energy_read(energy))
-		ERROR("Failed to read sensor energie\n");
+	timeline_begin("postrun", NULL);
+	ret = script_exec(script, "postrun", NULL);
+	timeline_end("postrun");
+	if (ret) {
+		ERROR("Failed to run '%s postrun\n", path);
+		return -1;
+	}
 
-	gettimeofday(&end, NULL);
+	return 0;
+}
 
-	trace_raw(NOTICE, "%s\n", ret ? "Fail" : "Ok");
+/*
+ * Build the sweep of the parameters declared in the script
+ */
+static struct sweep *script_sweep(struct ts_options *tso, const char *path,
+				  const char *name)
+{
+	struct sweep *sweep;
+	char *line = NULL;
+	size_t len = 0;
+	FILE *f;
 
-	energy_delta(nrj, energy, energy);
+	sweep = sweep_alloc(name, tso->sweep);
 
-	if (script_exec(path, "postrun")) {
-		ERROR("Failed to run '%s postrun\n");
+	f = fopen(path, "r");
+	if (!f) {
+		ERROR("Failed to open '%s': %m\n", path);
+		goto out_free;
+	}
+
+	while (getline(&line, &len, f) > 0) {
+
+		char *param, *range;
+
+		if (strncmp(line, SCRIPT_PARAM, strlen(SCRIPT_PARAM)))
+			continue;
+
+		line[strcspn(line, "\n")] = '\0';
+
+		param = line + strlen(SCRIPT_PARAM);
+		param += strspn(param, " \t");
+
+		range = strchr(param, '=');
+		if (!range) {
+			ERROR("Invalid parameter '%s' in '%s'\n", param, path);
+			goto out_close;
+		}
+
+		*range++ = '\0';
+
+		if (sweep_add(sweep, param, range))
+			goto out_close;
+	}
+
+	free(line);
+	fclose(f);
+
+	return sweep;
+
+out_close:
+	free(line);
+	fclose(f);
+out_free:
+	sweep_free(sweep);
+	return NULL;
+}
+
+/*
+ * Run the iterations of the script for the current values of the
+ * sweep and store the averaged results
+ */
+static int script_bench(struct ts_options *tso, struct ts_results *tsr,
+			struct energy *energy, struct script *script)
+{
+	struct ts_plugin_results tspr = { 0 };
+	struct residency *residency = NULL;
+	struct cgroup_stat cgroup = { 0 };
+	const struct noise *noise = noise_last();
+	double avg_duration = 0, avg_energy = 0;
+	unsigned long duration;
+	int i, ret, tries = 0;
+
+	if (tso->recalibrate && baseline_calibrate(energy, tso->calibrate))
+		WARNING("Failed to recalibrate the idle power\n");
+
+	timeline_begin("script", "path", script->path,
+		       "params", sweep_tag(script->sweep), NULL);
+
+	for (i = 0; i < tso->iterations; i++) {
+		if (tso->cooldown)
+			thermal_cooldown(energy, tso->cooldown,
+					 tso->cooldown_timeout);
+
+		ret = script_run(tso, script, &duration, energy);
+		if (ret) {
+			WARNING("'%s' failed \n", script->path);
+			break;
+		}
+
+		if (noise_noisy()) {
+			if (tries++ < tso->reruns) {
+				WARNING("'%s' noisy, %.2lf%% foreign cpu, rerun\n",
+					script->path, noise->foreign);
+				tspr.reruns++;
+				i--;
+				continue;
+			}
+			tspr.flags |= RESULT_NOISY;
+		}
+		tries = 0;
+
+		avg_duration = avg(avg_duration, duration, i + 1);
+		avg_energy = avg(avg_energy, energy_cost(energy), i + 1);
+		residency_average(&residency, i + 1);
+		cgroup_average(&cgroup, &script->stat, i + 1);
+		tspr.noise = avg(tspr.noise, noise->foreign, i + 1);
+		tspr.irqs = avg(tspr.irqs, noise->irqs, i + 1);
+		tspr.load = avg(tspr.load, noise->load, i + 1);
+
+		if (thermal_throttled())
+			tspr.flags |= RESULT_THROTTLED;
+	}
+
+	tspr.path = script->path;
+	tspr.params = sweep_tag(script->sweep);
+	tspr.duration = avg_duration;
+	tspr.energy = avg_energy;
+	tspr.residency = residency;
+	tspr.cgroup = &cgroup;
+	overhead_apply(&tspr);
+	tspr.baseline = baseline_energy(energy, tspr.duration);
+
+	if (!ret && results_update(tsr, &tspr)) {
+		ERROR("Failed to update results for '%s'", script->path);
+		residency_free(residency);
+		timeline_end("script");
 		return -1;
 	}
-	
-	*duration = (end.tv_sec - begin.tv_sec) * 1000000;
-	*duration += (end.tv_usec - begin.tv_usec);
+
+	residency_free(residency);
+
+	timeline_end("script");
 
 	return 0;
 }
 
-#define avg(a, b, i) ((a) + (((b) - (a)) / (i)))
-
 int script_is_excluded(char **exclude_list, const char *name)
 {
 	if (!exclude_list)
@@ -171,9 +390,7 @@ int scripts_run(struct ts_options *tso, struct ts_results *tsr, struct energy *e
 {
 	DIR *dir;
 	struct dirent dirent, *direntp;
-	unsigned long duration;
-	double avg_duration = 0;
-	double avg_energy = 0;
+	struct script script;
 	regex_t regex;
 	char *path;
 	char **exclude_list;
@@ -195,8 +412,6 @@ int scripts_run(struct ts_options *tso, struct ts_results *tsr, struct energy *e
 
 	while (!readdir_r(dir, &dirent, &direntp)) {
 
-		int i, ret;
-
 		if (!direntp)
 			break;
 		
@@ -215,25 +430,20 @@ int scripts_run(struct ts_options *tso, struct ts_results *tsr, struct energy *e
 			return -1;
 		}
 
-		avg_duration = 0;
-		avg_energy   = 0;
-
-		for (i = 0; i < tso->iterations; i++) {
-			ret = script_run(tso, path, &duration, energy);
-			if (ret) {
-				WARNING("'%s' failed \n", path);
-				break;
-			}
-
-			avg_duration = avg(avg_duration, duration, i + 1);
-			avg_energy = avg(avg_energy, energy_cost(energy), i + 1);
+		script.path = path;
+		script.sweep = script_sweep(tso, path, direntp->d_name);
+		if (!script.sweep) {
+			WARNING("'%s' has invalid parameters\n", path);
+			free(path);
+			continue;
 		}
 
-		if (!ret && results_update(tsr, path, avg_duration, avg_energy)) {
-			ERROR("Failed to update results for '%s'",
-			      direntp->d_name);
-			return -1;
-		}
+		do {
+			if (script_bench(tso, tsr, energy, &script))
+				return -1;
+		} while (sweep_next(script.sweep));
+
+		sweep_free(script.sweep);
 
 		free(path);
 	}
@@ -1,14 +1,17 @@
 #!/bin/sh
 
+# The parameters are swept by ts and passed as "name=value" after the phase
+# ts-param: value=1,2
+
 case "$1" in
 	prerun)
-		echo $1
+		echo $1 $2
 	;;
 	run)
-		echo $1
+		echo $1 $2
 	;;
 	postrun)
-		echo $1
+		echo $1 $2
 	;;
 	*)
 		echo "Unexpected value passed as parameter --$1--"
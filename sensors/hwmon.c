@@ -0,0 +1,587 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#include "../trace.h"
+#include "../topology.h"
+#include "../energy.h"
+
+/*
+ * Generic hwmon power sensor, for the boards where the RAPL MSRs are
+ * not available (ARM, embedded, ...). The power monitors (ina2xx,
+ * ina3221, ...) export under /sys/class/hwmon/hwmonX:
+ *
+ * - powerN_input : instantaneous power in micro-Watts
+ * - currN_input  : current in milli-Ampere
+ * - inN_input    : voltage in milli-Volt
+ * - energyN_input: cumulative energy in micro-Joules
+ *
+ * and an optional <channel>N_label giving the rail name. When no power
+ * is exported for a channel but the current and the voltage are, the
+ * power is computed with P = U * I.
+ *
+ * The power channels are sampled by a thread and integrated into
+ * energy, the energy channels are read as is.
+ *
+ * The channels are mapped to an energy domain by looking at their
+ * label (or the hwmon name if there is no label):
+ *
+ * - "gpu"                            => gpu
+ * - "dram", "ddr", "mem"             => dram
+ * - "cpu", "core", "cluster", "big",
+ *   "little", "a7", "a15", "a53", ...  => cpu cluster, one per package
+ * - anything else                    => board
+ *
+ * The behavior can be changed with the following environment variables:
+ *
+ * - TS_HWMON_ROOT  : the hwmon sysfs root, "/sys/class/hwmon" by
+ *                    default, it allows to use a fake hwmon tree
+ * - TS_HWMON_PERIOD: sampling period in usecs, 10000 by default
+ * - TS_HWMON_MAP   : comma separated list of "label=domain" overriding
+ *                    the default mapping, domain is one of "cpu<N>",
+ *                    "gpu", "dram", "board" or "ignore"
+ */
+#define HWMON_ROOT    "/sys/class/hwmon"
+#define HWMON_PERIOD  10000
+
+enum {
+	HWMON_DOMAIN_IGNORE = -1,
+	HWMON_DOMAIN_CPU,
+	HWMON_DOMAIN_GPU,
+	HWMON_DOMAIN_DRAM,
+	HWMON_DOMAIN_BOARD,
+};
+
+enum {
+	HWMON_POWER,
+	HWMON_CURR_VOLT,
+	HWMON_ENERGY,
+};
+
+struct hwmon_channel {
+	char label[64];
+	int type;
+	int domain;
+	int cluster;
+	int fd;      /* power, current or energy */
+	int fd_volt; /* voltage for HWMON_CURR_VOLT */
+	double power;  /* last sample in uW */
+	double energy; /* accumulated energy in uJ */
+};
+
+struct hwmon {
+	int nrchannels;
+	int nrclusters;
+	unsigned long period;
+	struct hwmon_channel *channel;
+	struct timespec last;
+	pthread_t sampler;
+	pthread_mutex_t lock;
+	volatile int stop;
+};
+
+static const char *hwmon_root(void)
+{
+	const char *root = getenv("TS_HWMON_ROOT");
+
+	return root ? root : HWMON_ROOT;
+}
+
+static int hwmon_read_value(int fd, double *value)
+{
+	char buffer[32];
+	ssize_t len;
+
+	len = pread(fd, buffer, sizeof(buffer) - 1, 0);
+	if (len <= 0)
+		return -1;
+
+	buffer[len] = '\0';
+	*value = strtod(buffer, NULL);
+
+	return 0;
+}
+
+static int hwmon_read_string(const char *path, char *buffer, size_t size)
+{
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+
+	if (!fgets(buffer, size, f)) {
+		fclose(f);
+		return -1;
+	}
+
+	buffer[strcspn(buffer, "\n")] = '\0';
+	fclose(f);
+
+	return 0;
+}
+
+static int hwmon_open(const char *dir, const char *type, int index, const char *suffix)
+{
+	char path[MAXPATHLEN];
+
+	snprintf(path, sizeof(path), "%s/%s%d_%s", dir, type, index, suffix);
+
+	return open(path, O_RDONLY);
+}
+
+static int hwmon_domain_override(const char *label, int *cluster)
+{
+	const char *map = getenv("TS_HWMON_MAP");
+	char *dup, *token, *saveptr;
+	int domain = -2;
+
+	if (!map)
+		return domain;
+
+	dup = strdup(map);
+	if (!dup)
+		return domain;
+
+	for (token = strtok_r(dup, ",", &saveptr); token;
+	     token = strtok_r(NULL, ",", &saveptr)) {
+
+		char *value = strchr(token, '=');
+
+		if (!value)
+			continue;
+
+		*value++ = '\0';
+
+		if (strcasecmp(token, label))
+			continue;
+
+		if (!strncasecmp(value, "cpu", 3)) {
+			domain = HWMON_DOMAIN_CPU;
+			*cluster = atoi(value + 3);
+		} else if (!strcasecmp(value, "gpu"))
+			domain = HWMON_DOMAIN_GPU;
+		else if (!strcasecmp(value, "dram"))
+			domain = HWMON_DOMAIN_DRAM;
+		else if (!strcasecmp(value, "board"))
+			domain = HWMON_DOMAIN_BOARD;
+		else if (!strcasecmp(value, "ignore"))
+			domain = HWMON_DOMAIN_IGNORE;
+		else
+			WARNING("Unknown hwmon domain '%s' for '%s'\n", value, label);
+		break;
+	}
+
+	free(dup);
+
+	return domain;
+}
+
+static int hwmon_domain(const char *label, int *cluster)
+{
+	const char *cpu[] = {
+		"cpu", "core", "cluster", "big", "little",
+		"a7", "a15", "a17", "a53", "a55", "a57", "a72", "a73", "a76",
+	};
+	const char *dram[] = { "dram", "ddr", "mem", };
+	int i, domain;
+
+	domain = hwmon_domain_override(label, cluster);
+	if (domain != -2)
+		return domain;
+
+	if (strcasestr(label, "gpu"))
+		return HWMON_DOMAIN_GPU;
+
+	for (i = 0; i < sizeof(dram) / sizeof(dram[0]); i++)
+		if (strcasestr(label, dram[i]))
+			return HWMON_DOMAIN_DRAM;
+
+	for (i = 0; i < sizeof(cpu) / sizeof(cpu[0]); i++)
+		if (strcasestr(label, cpu[i])) {
+			*cluster = -1;
+			return HWMON_DOMAIN_CPU;
+		}
+
+	return HWMON_DOMAIN_BOARD;
+}
+
+static int hwmon_add_channel(struct hwmon *hwmon, const char *dir,
+			     const char *name, const char *type, int index)
+{
+	struct hwmon_channel channel = { .fd = -1, .fd_volt = -1 };
+	struct hwmon_channel *channels;
+	char path[MAXPATHLEN];
+
+	if (!strcmp(type, "power")) {
+		channel.type = HWMON_POWER;
+		channel.fd = hwmon_open(dir, "power", index, "input");
+	} else if (!strcmp(type, "energy")) {
+		channel.type = HWMON_ENERGY;
+		channel.fd = hwmon_open(dir, "energy", index, "input");
+	} else {
+		channel.type = HWMON_CURR_VOLT;
+		channel.fd = hwmon_open(dir, "curr", index, "input");
+		channel.fd_volt = hwmon_open(dir, "in", index, "input");
+		if (channel.fd_volt < 0)
+			goto out_close;
+	}
+
+	if (channel.fd < 0)
+		goto out_close;
+
+	/*
+	 * Some drivers (eg. ina3221) only label the voltage channel
+	 */
+	snprintf(path, sizeof(path), "%s/%s%d_label", dir, type, index);
+	if (hwmon_read_string(path, channel.label, sizeof(channel.label))) {
+		snprintf(path, sizeof(path), "%s/in%d_label", dir, index);
+		if (channel.type != HWMON_CURR_VOLT ||
+		    hwmon_read_string(path, channel.label, sizeof(channel.label)))
+			snprintf(channel.label, sizeof(channel.label), "%s.%s%d",
+				 name, type, index);
+	}
+
+	channel.domain = hwmon_domain(channel.label, &channel.cluster);
+	if (channel.domain == HWMON_DOMAIN_IGNORE)
+		goto out_close;
+
+	if (channel.domain == HWMON_DOMAIN_CPU && channel.cluster < 0)
+		channel.cluster = hwmon->nrclusters++;
+
+	channels = realloc(hwmon->channel,
+			   sizeof(*channels) * (hwmon->nrchannels + 1));
+	if (!channels)
+		FATAL("Failed to allocate memory for hwmon channels\n");
+
+	channels[hwmon->nrchannels++] = channel;
+	hwmon->channel = channels;
+
+	DEBUG("hwmon channel '%s' (%s%d) mapped to domain %d\n",
+	      channel.label, type, index, channel.domain);
+
+	return 0;
+
+out_close:
+	if (channel.fd >= 0)
+		close(channel.fd);
+	if (channel.fd_volt >= 0)
+		close(channel.fd_volt);
+	return -1;
+}
+
+static int hwmon_has_channel(const char *dir, const char *type, int index)
+{
+	char path[MAXPATHLEN];
+
+	snprintf(path, sizeof(path), "%s/%s%d_input", dir, type, index);
+
+	return !access(path, R_OK);
+}
+
+static int hwmon_scan_device(struct hwmon *hwmon, const char *dir)
+{
+	char path[MAXPATHLEN];
+	char name[64];
+	int index, found = 0;
+
+	snprintf(path, sizeof(path), "%s/name", dir);
+	if (hwmon_read_string(path, name, sizeof(name)))
+		return 0;
+
+	/*
+	 * The channels index start at 0 or 1 depending on the driver, give
+	 * up at index 2 when nothing was found, the gaps are skipped after
+	 */
+	for (index = 0; index < 32; index++) {
+
+		if (hwmon_has_channel(dir, "energy", index)) {
+			found += !hwmon_add_channel(hwmon, dir, name, "energy", index);
+			continue;
+		}
+
+		if (hwmon_has_channel(dir, "power", index)) {
+			found += !hwmon_add_channel(hwmon, dir, name, "power", index);
+			continue;
+		}
+
+		if (hwmon_has_channel(dir, "curr", index) &&
+		    hwmon_has_channel(dir, "in", index)) {
+			found += !hwmon_add_channel(hwmon, dir, name, "curr", index);
+			continue;
+		}
+
+		if (index > 1 && !found)
+			break;
+	}
+
+	return found;
+}
+
+static int hwmon_scan(struct hwmon *hwmon)
+{
+	const char *root = hwmon_root();
+	struct dirent *direntp;
+	char path[MAXPATHLEN];
+	int found = 0;
+	DIR *dir;
+
+	dir = opendir(root);
+	if (!dir)
+		return -1;
+
+	while ((direntp = readdir(dir))) {
+
+		if (strncmp(direntp->d_name, "hwmon", 5))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", root, direntp->d_name);
+
+		found += hwmon_scan_device(hwmon, path);
+	}
+
+	closedir(dir);
+
+	return found ? 0 : -1;
+}
+
+static void hwmon_free(struct hwmon *hwmon)
+{
+	int i;
+
+	for (i = 0; i < hwmon->nrchannels; i++) {
+		close(hwmon->channel[i].fd);
+		if (hwmon->channel[i].fd_volt >= 0)
+			close(hwmon->channel[i].fd_volt);
+	}
+
+	free(hwmon->channel);
+	free(hwmon);
+}
+
+static double hwmon_channel_power(struct hwmon_channel *channel)
+{
+	double value, volt;
+
+	if (hwmon_read_value(channel->fd, &value))
+		return channel->power;
+
+	if (channel->type == HWMON_POWER)
+		return value;
+
+	if (hwmon_read_value(channel->fd_volt, &volt))
+		return channel->power;
+
+	/* mA * mV = uW */
+	return value * volt;
+}
+
+/*
+ * Integrate the power of the channels since the last sample with the
+ * trapezoidal rule, the hwmon lock must be held
+ */
+static void hwmon_sample(struct hwmon *hwmon)
+{
+	struct timespec now;
+	double elapsed;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	elapsed = (now.tv_sec - hwmon->last.tv_sec) * 1000000.0;
+	elapsed += (now.tv_nsec - hwmon->last.tv_nsec) / 1000.0;
+
+	for (i = 0; i < hwmon->nrchannels; i++) {
+
+		struct hwmon_channel *channel = &hwmon->channel[i];
+		double power;
+
+		if (channel->type == HWMON_ENERGY) {
+			hwmon_read_value(channel->fd, &channel->energy);
+			continue;
+		}
+
+		power = hwmon_channel_power(channel);
+
+		/* uW * usecs = 10^-6 uJ */
+		channel->energy += ((channel->power + power) / 2) * elapsed / 1000000.0;
+		channel->power = power;
+	}
+
+	hwmon->last = now;
+}
+
+static void *hwmon_sampler(void *arg)
+{
+	struct hwmon *hwmon = arg;
+	struct timespec next;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (!hwmon->stop) {
+
+		next.tv_nsec += hwmon->period * 1000;
+		while (next.tv_nsec >= 1000000000) {
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		pthread_mutex_lock(&hwmon->lock);
+		hwmon_sample(hwmon);
+		pthread_mutex_unlock(&hwmon->lock);
+	}
+
+	return NULL;
+}
+
+int sensor_probe(void)
+{
+	struct hwmon *hwmon;
+	int ret;
+
+	hwmon = calloc(1, sizeof(*hwmon));
+	if (!hwmon)
+		return -1;
+
+	ret = hwmon_scan(hwmon);
+
+	hwmon_free(hwmon);
+
+	return ret;
+}
+
+void sensor_fini(struct energy *energy)
+{
+	struct hwmon *hwmon = energy->data;
+
+	hwmon->stop = 1;
+	pthread_join(hwmon->sampler, NULL);
+	pthread_mutex_destroy(&hwmon->lock);
+
+	hwmon_free(hwmon);
+}
+
+int sensor_read(struct energy *energy)
+{
+	struct topology *topology = energy->topology;
+	struct hwmon *hwmon = energy->data;
+	int i;
+
+	for (i = 0; i < topology->nrpackages; i++)
+		energy->pkg[i].pkg = 0;
+
+	energy->sys.gpu = 0;
+	energy->sys.dram = 0;
+	energy->sys.board = 0;
+
+	pthread_mutex_lock(&hwmon->lock);
+
+	hwmon_sample(hwmon);
+
+	for (i = 0; i < hwmon->nrchannels; i++) {
+
+		struct hwmon_channel *channel = &hwmon->channel[i];
+
+		switch (channel->domain) {
+		case HWMON_DOMAIN_CPU:
+			energy->pkg[MIN(channel->cluster, topology->nrpackages - 1)].pkg +=
+				channel->energy;
+			break;
+		case HWMON_DOMAIN_GPU:
+			energy->sys.gpu += channel->energy;
+			break;
+		case HWMON_DOMAIN_DRAM:
+			energy->sys.dram += channel->energy;
+			break;
+		case HWMON_DOMAIN_BOARD:
+			energy->sys.board += channel->energy;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&hwmon->lock);
+
+	return 0;
+}
+
+int sensor_init(struct energy *energy)
+{
+	const char *period = getenv("TS_HWMON_PERIOD");
+	struct hwmon *hwmon;
+	int i;
+
+	hwmon = calloc(1, sizeof(*hwmon));
+	if (!hwmon)
+		return -1;
+
+	hwmon->period = period ? strtoul(period, NULL, 0) : HWMON_PERIOD;
+	if (!hwmon->period)
+		hwmon->period = HWMON_PERIOD;
+
+	if (hwmon_scan(hwmon))
+		goto out_free;
+
+	for (i = 0; i < hwmon->nrchannels; i++) {
+
+		struct hwmon_channel *channel = &hwmon->channel[i];
+
+		if (channel->type != HWMON_ENERGY)
+			channel->power = hwmon_channel_power(channel);
+
+		switch (channel->domain) {
+		case HWMON_DOMAIN_CPU:
+			energy->flags |= ENERGY_PKG_SUPPORTED;
+			break;
+		case HWMON_DOMAIN_GPU:
+			energy->flags |= ENERGY_GPU_SUPPORTED;
+			break;
+		case HWMON_DOMAIN_DRAM:
+			energy->flags |= ENERGY_DRAM_SUPPORTED;
+			break;
+		case HWMON_DOMAIN_BOARD:
+			energy->flags |= ENERGY_BOARD_SUPPORTED;
+			break;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &hwmon->last);
+
+	pthread_mutex_init(&hwmon->lock, NULL);
+
+	if (pthread_create(&hwmon->sampler, NULL, hwmon_sampler, hwmon)) {
+		ERROR("Failed to create the hwmon sampler thread\n");
+		goto out_destroy;
+	}
+
+	NOTICE("%d hwmon channel(s), sampling every %lu usecs\n",
+	       hwmon->nrchannels, hwmon->period);
+
+	energy->data = hwmon;
+
+	return 0;
+
+out_destroy:
+	pthread_mutex_destroy(&hwmon->lock);
+out_free:
+	hwmon_free(hwmon);
+	return -1;
+}
+
+void sensor_describe(struct energy *energy, char *buf, size_t len)
+{
+	struct hwmon *hwmon = energy->data;
+
+	snprintf(buf, len, "%d channels, %lu usecs sampling period",
+		 hwmon->nrchannels, hwmon->period);
+}
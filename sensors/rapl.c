@@ -57,6 +57,9 @@
 #define MSR_PP0_ENERGY_STATUS  0x639
 #define MSR_PP1_ENERGY_STATUS  0x641
 
+/* Preferred to the generic hwmon sensor which may also probe on x86 */
+int sensor_priority = 10;
+
 struct rapl {
 	int flags;
 	double pu;  /* Power Unit         */
@@ -115,7 +118,8 @@ static double rapl_read_energy(int cpu, struct rapl *rapl, int domain)
 		return -1;
 	}
 
-	return value * rapl->esu;
+	/* The energy status unit is in Joules, the energies are in uJ */
+	return value * rapl->esu * 1000000;
 }
 
 static double rapl_core_energy(int pkgid, struct topology *topology, struct rapl *rapl)
@@ -225,6 +229,41 @@ int sensor_read(struct energy *energy)
 	return 0;
 }
 
+int sensor_snapshot(struct energy *energy, void **data, size_t *len)
+{
+	*len = energy->topology->nrpackages * sizeof(struct rapl);
+
+	*data = malloc(*len);
+	if (!*data)
+		return -1;
+
+	memcpy(*data, energy->data, *len);
+
+	return 0;
+}
+
+/*
+ * Restore the units read by a previous sensor_init(), without accessing
+ * the MSRs
+ */
+int sensor_restore(struct energy *energy, const void *data, size_t len)
+{
+	struct rapl *rapl;
+
+	if (len != energy->topology->nrpackages * sizeof(*rapl))
+		return -1;
+
+	rapl = malloc(len);
+	if (!rapl)
+		return -1;
+
+	memcpy(rapl, data, len);
+
+	energy->data = rapl;
+
+	return 0;
+}
+
 int sensor_init(struct energy *energy)
 {
 	struct topology *topology = energy->topology;
@@ -269,3 +308,14 @@ out_free:
 	free(rapl);
 	return -1;
 }
+
+/*
+ * The units of the first package, the packages share the same units
+ */
+void sensor_describe(struct energy *energy, char *buf, size_t len)
+{
+	struct rapl *rapl = energy->data;
+
+	snprintf(buf, len, "power %g W, energy %g J, time %g s",
+		 rapl->pu, rapl->esu, rapl->tu);
+}
@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "trace.h"
+#include "energy.h"
+#include "snapshot.h"
+#include "topology.h"
+#include "timeline.h"
+
+/*
+ * The machine snapshot caches what is discovered at the startup: the
+ * topology, the sensor in use, its energy domains and its state when
+ * the sensor can save it (the RAPL units). It is valid as long as the
+ * boot id, the kernel release, the number of cpus, the online cpus and
+ * the sensor file do not change, and is loaded with a single read.
+ *
+ * The file is "~/.cache/ts-machine" by default, or the one set in the
+ * TS_MACHINE_CACHE environment variable.
+ */
+#define SNAPSHOT_MAGIC   0x534d5354 /* "TSMS" */
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_FILE    ".cache/ts-machine"
+#define SNAPSHOT_BOOT_ID "/proc/sys/kernel/random/boot_id"
+#define SNAPSHOT_ONLINE  "/sys/devices/system/cpu/online"
+
+struct snapshot_buffer {
+	const char *ptr;
+	const char *end;
+};
+
+static int snapshot_get(struct snapshot_buffer *buf, void *value, size_t len)
+{
+	if (buf->end - buf->ptr < len)
+		return -1;
+
+	memcpy(value, buf->ptr, len);
+	buf->ptr += len;
+
+	return 0;
+}
+
+static int snapshot_get_int(struct snapshot_buffer *buf, int *value)
+{
+	return snapshot_get(buf, value, sizeof(*value));
+}
+
+/*
+ * The strings point into the buffer and are not NUL terminated, they
+ * are compared with snapshot_match() or copied
+ */
+static int snapshot_get_string(struct snapshot_buffer *buf, const char **str,
+			       size_t *len)
+{
+	if (snapshot_get(buf, len, sizeof(*len)) || buf->end - buf->ptr < *len)
+		return -1;
+
+	*str = buf->ptr;
+	buf->ptr += *len;
+
+	return 0;
+}
+
+static int snapshot_match(struct snapshot_buffer *buf, const char *expected)
+{
+	const char *str;
+	size_t len;
+
+	if (snapshot_get_string(buf, &str, &len))
+		return 0;
+
+	return len == strlen(expected) && !memcmp(str, expected, len);
+}
+
+static void snapshot_put_string(FILE *f, const char *str)
+{
+	size_t len = str ? strlen(str) : 0;
+
+	fwrite(&len, sizeof(len), 1, f);
+	fwrite(str, 1, len, f);
+}
+
+/*
+ * The first line of the file, empty if it can not be read
+ */
+static char *snapshot_read_line(const char *path)
+{
+	char line[1024] = "";
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f) {
+		if (!fgets(line, sizeof(line), f))
+			line[0] = '\0';
+		fclose(f);
+	}
+
+	line[strcspn(line, "\n")] = '\0';
+
+	return strdup(line);
+}
+
+static char *snapshot_path(void)
+{
+	const char *home, *path = getenv("TS_MACHINE_CACHE");
+	char *dir, *file;
+
+	if (path)
+		return strdup(path);
+
+	home = getenv("HOME");
+	if (!home)
+		return NULL;
+
+	if (asprintf(&dir, "%s/.cache", home) < 0 ||
+	    asprintf(&file, "%s/%s", home, SNAPSHOT_FILE) < 0)
+		FATAL("Failed to allocate memory for the snapshot path\n");
+
+	mkdir(dir, 0700);
+	free(dir);
+
+	return file;
+}
+
+static int snapshot_get_topology(struct snapshot_buffer *buf,
+				 struct topology *topology)
+{
+	struct package *package;
+	struct core *core;
+	int i, j, nr;
+
+	/*
+	 * The counts are set once their array is allocated, a truncated
+	 * topology is freed by topology_fini()
+	 */
+	if (snapshot_get_int(buf, &nr) || nr < 0 || nr > buf->end - buf->ptr)
+		return -1;
+
+	topology->package = calloc(nr, sizeof(*package));
+	if (nr && !topology->package)
+		FATAL("Failed to allocate memory for package\n");
+
+	topology->nrpackages = nr;
+
+	for (i = 0; i < topology->nrpackages; i++) {
+
+		package = &topology->package[i];
+
+		if (snapshot_get_int(buf, &package->package_id) ||
+		    snapshot_get_int(buf, &nr) ||
+		    nr < 0 || nr > buf->end - buf->ptr)
+			return -1;
+
+		package->core = calloc(nr, sizeof(*core));
+		if (nr && !package->core)
+			FATAL("Failed to allocate memory for core\n");
+
+		package->nrcores = nr;
+
+		for (j = 0; j < package->nrcores; j++) {
+
+			core = &package->core[j];
+
+			if (snapshot_get_int(buf, &core->core_id) ||
+			    snapshot_get_int(buf, &core->os_id) ||
+			    snapshot_get_int(buf, &nr) ||
+			    nr < 0 || nr > buf->end - buf->ptr)
+				return -1;
+
+			if (!nr)
+				continue;
+
+			core->thread = calloc(nr, sizeof(*core->thread));
+			if (!core->thread)
+				FATAL("Failed to allocate memory for ht\n");
+
+			core->nrthreads = nr;
+
+			if (snapshot_get(buf, core->thread,
+					 core->nrthreads * sizeof(*core->thread)))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void snapshot_put_topology(FILE *f, struct topology *topology)
+{
+	struct package *package;
+	struct core *core;
+	int i, j;
+
+	fwrite(&topology->nrpackages, sizeof(topology->nrpackages), 1, f);
+
+	for (i = 0; i < topology->nrpackages; i++) {
+
+		package = &topology->package[i];
+
+		fwrite(&package->package_id, sizeof(package->package_id), 1, f);
+		fwrite(&package->nrcores, sizeof(package->nrcores), 1, f);
+
+		for (j = 0; j < package->nrcores; j++) {
+
+			core = &package->core[j];
+
+			fwrite(&core->core_id, sizeof(core->core_id), 1, f);
+			fwrite(&core->os_id, sizeof(core->os_id), 1, f);
+			fwrite(&core->nrthreads, sizeof(core->nrthreads), 1, f);
+			fwrite(core->thread, sizeof(*core->thread),
+			       core->nrthreads, f);
+		}
+	}
+}
+
+/*
+ * Read the whole file at once, NULL if it does not exist
+ */
+static char *snapshot_read(const char *path, size_t *len)
+{
+	struct stat st;
+	char *data;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+
+	data = malloc(st.st_size);
+	if (!data)
+		FATAL("Failed to allocate memory for the snapshot\n");
+
+	if (read(fd, data, st.st_size) != st.st_size) {
+		free(data);
+		close(fd);
+		return NULL;
+	}
+
+	close(fd);
+
+	*len = st.st_size;
+
+	return data;
+}
+
+static struct topology *snapshot_load(const char *path, struct energy **energy)
+{
+	struct snapshot_buffer buf;
+	struct topology *topology;
+	struct utsname utsname;
+	struct timespec mtime;
+	struct stat st;
+	const char *str, *state = NULL;
+	char *data, *boot_id, *online, *sensor = NULL;
+	int magic, version, nrcpus, flags;
+	size_t len, state_len = 0;
+
+	data = snapshot_read(path, &len);
+	if (!data) {
+		DEBUG("No machine snapshot in '%s'\n", path);
+		return NULL;
+	}
+
+	buf.ptr = data;
+	buf.end = data + len;
+
+	topology = calloc(1, sizeof(*topology));
+	if (!topology)
+		FATAL("Failed to allocate memory for the topology\n");
+
+	boot_id = snapshot_read_line(SNAPSHOT_BOOT_ID);
+	online = snapshot_read_line(SNAPSHOT_ONLINE);
+	uname(&utsname);
+
+	/* A cpu hotplug changes the topology, not the number of cpus */
+	if (snapshot_get_int(&buf, &magic) || magic != SNAPSHOT_MAGIC ||
+	    snapshot_get_int(&buf, &version) || version != SNAPSHOT_VERSION ||
+	    !snapshot_match(&buf, boot_id) ||
+	    !snapshot_match(&buf, utsname.release) ||
+	    snapshot_get_int(&buf, &nrcpus) ||
+	    nrcpus != sysconf(_SC_NPROCESSORS_CONF) ||
+	    !snapshot_match(&buf, online)) {
+		DEBUG("The machine snapshot '%s' is stale\n", path);
+		goto out_free;
+	}
+
+	if (snapshot_get_topology(&buf, topology) ||
+	    snapshot_get_string(&buf, &str, &len) ||
+	    snapshot_get(&buf, &mtime, sizeof(mtime)) ||
+	    snapshot_get_int(&buf, &flags) ||
+	    snapshot_get_string(&buf, &state, &state_len)) {
+		WARNING("The machine snapshot '%s' is corrupted\n", path);
+		goto out_free;
+	}
+
+	/* A snapshot without sensor is not used, the sensors are probed again */
+	if (!len) {
+		DEBUG("No sensor in the machine snapshot '%s'\n", path);
+		goto out_free;
+	}
+
+	sensor = strndup(str, len);
+	if (!sensor)
+		FATAL("Failed to allocate memory for the sensor path\n");
+
+	if (stat(sensor, &st) || st.st_mtim.tv_sec != mtime.tv_sec ||
+	    st.st_mtim.tv_nsec != mtime.tv_nsec) {
+		DEBUG("'%s' changed since the machine snapshot\n", sensor);
+		goto out_free;
+	}
+
+	*energy = energy_init_sensor(topology, sensor, flags, state, state_len);
+	if (!*energy) {
+		DEBUG("Failed to restore '%s' from the machine snapshot\n", sensor);
+		goto out_free;
+	}
+
+	DEBUG("Machine snapshot loaded from '%s'\n", path);
+
+	free(sensor);
+	free(online);
+	free(boot_id);
+	free(data);
+
+	return topology;
+
+out_free:
+	free(sensor);
+	free(online);
+	free(boot_id);
+	free(data);
+	topology_fini(topology);
+	free(topology);
+	return NULL;
+}
+
+static void snapshot_save(const char *path, struct topology *topology,
+			  struct energy *energy)
+{
+	int magic = SNAPSHOT_MAGIC, version = SNAPSHOT_VERSION;
+	int nrcpus = sysconf(_SC_NPROCESSORS_CONF);
+	struct timespec mtime = { 0 };
+	struct utsname utsname;
+	struct stat st;
+	const char *sensor;
+	char *data, *boot_id, *online, *tmp;
+	void *state;
+	size_t len, state_len;
+	FILE *f;
+	int fd;
+
+	sensor = energy_snapshot(energy, &state, &state_len);
+	if (sensor && !stat(sensor, &st))
+		mtime = st.st_mtim;
+
+	boot_id = snapshot_read_line(SNAPSHOT_BOOT_ID);
+	online = snapshot_read_line(SNAPSHOT_ONLINE);
+	uname(&utsname);
+
+	f = open_memstream(&data, &len);
+	if (!f)
+		FATAL("Failed to allocate memory for the snapshot\n");
+
+	fwrite(&magic, sizeof(magic), 1, f);
+	fwrite(&version, sizeof(version), 1, f);
+	snapshot_put_string(f, boot_id);
+	snapshot_put_string(f, utsname.release);
+	fwrite(&nrcpus, sizeof(nrcpus), 1, f);
+	snapshot_put_string(f, online);
+	snapshot_put_topology(f, topology);
+	snapshot_put_string(f, sensor);
+	fwrite(&mtime, sizeof(mtime), 1, f);
+	fwrite(&energy->flags, sizeof(energy->flags), 1, f);
+	fwrite(&state_len, sizeof(state_len), 1, f);
+	fwrite(state, 1, state_len, f);
+
+	fclose(f);
+
+	/* Written aside and renamed, the concurrent runs read a whole file */
+	if (asprintf(&tmp, "%s.%d", path, getpid()) < 0)
+		FATAL("Failed to allocate memory for the snapshot path\n");
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0 || write(fd, data, len) != len || close(fd) ||
+	    rename(tmp, path)) {
+		WARNING("Failed to save the machine snapshot '%s': %m\n", path);
+		unlink(tmp);
+	} else {
+		DEBUG("Machine snapshot saved in '%s'\n", path);
+	}
+
+	free(tmp);
+	free(data);
+	free(online);
+	free(boot_id);
+	free(state);
+}
+
+/*
+ * The topology and the energy, from the machine snapshot if it is valid
+ * and rediscover is not set, or discovered and saved in the snapshot
+ */
+struct topology *snapshot_init(int rediscover, struct energy **energy)
+{
+	struct topology *topology = NULL;
+	char *path;
+
+	path = snapshot_path();
+
+	if (path && !rediscover) {
+		timeline_begin("snapshot_load", NULL);
+		topology = snapshot_load(path, energy);
+		timeline_end("snapshot_load");
+		if (topology)
+			goto out;
+	}
+
+	topology = topology_init();
+	if (!topology)
+		goto out;
+
+	*energy = energy_init(topology);
+
+	/* Without sensor, a sensor made available later is found */
+	if (path && *energy && (*energy)->handle) {
+		timeline_begin("snapshot_save", NULL);
+		snapshot_save(path, topology, *energy);
+		timeline_end("snapshot_save");
+	}
+out:
+	free(path);
+	return topology;
+}
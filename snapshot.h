@@ -0,0 +1,9 @@
+#ifndef __TS_SNAPSHOT_H
+#define __TS_SNAPSHOT_H
+
+struct topology;
+struct energy;
+
+extern struct topology *snapshot_init(int rediscover, struct energy **energy);
+
+#endif
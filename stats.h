@@ -8,9 +8,9 @@
 #define avg(a, b, i) ((a) + (((b) - (a)) / (i)))
 
 /*
- * Standard deviation:
- * SQRT = SUM_X2 / NRVALUES - (SUM_X * SUM_X)
+ * Standard deviation from the average and the sum of the squares:
+ * STDDEV = SQRT(SUM_X2 / NRVALUES - AVG * AVG)
  */
-#define stddev(a, b, i) srqt((b) / (i) - ((a) * (a)))
+#define stddev(a, b, i) sqrt((b) / (i) - ((a) * (a)))
 
 #endif
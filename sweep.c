@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "sweep.h"
+
+/*
+ * Parameter sweep: the cartesian product of the values of the
+ * parameters declared by a benchmark. The values are described by a
+ * range which is either:
+ *
+ * - a list of values: "4096,8192,65536" or "sync,aio"
+ * - a numeric range:  "start:end[:step]" where the step is "+N"
+ *                     (default +1) or "*N", eg. "4096:1048576:*2"
+ *
+ * The range declared by the benchmark can be overridden with a sweep
+ * description: a ';' separated list of "[bench:]name=range", where
+ * bench is the benchmark file name, eg. "iofile.so:pages=64,256"
+ *
+ * A parameter has at most SWEEP_MAX_VALUES values.
+ */
+#define SWEEP_MAX_VALUES 1024
+
+struct sweep_param {
+	char *name;
+	char **values;
+	int nrvalues;
+	int index;
+};
+
+struct sweep {
+	char *bench;
+	char *desc;
+	char *tag;
+	int nrparams;
+	struct sweep_param *params;
+};
+
+struct sweep *sweep_alloc(const char *bench, const char *desc)
+{
+	struct sweep *sweep;
+
+	sweep = calloc(1, sizeof(*sweep));
+	if (!sweep)
+		FATAL("Failed to allocate memory for sweep\n");
+
+	sweep->bench = strdup(bench);
+	sweep->desc = desc ? strdup(desc) : NULL;
+
+	return sweep;
+}
+
+static int sweep_add_value(struct sweep_param *param, const char *value)
+{
+	if (param->nrvalues == SWEEP_MAX_VALUES) {
+		ERROR("More than %d values for parameter '%s'\n",
+		      SWEEP_MAX_VALUES, param->name);
+		return -1;
+	}
+
+	param->values = realloc(param->values,
+				sizeof(*param->values) * (param->nrvalues + 1));
+	if (!param->values)
+		FATAL("Failed to allocate memory for sweep values\n");
+
+	param->values[param->nrvalues] = strdup(value);
+	if (!param->values[param->nrvalues])
+		FATAL("Failed to allocate memory for sweep value\n");
+
+	param->nrvalues++;
+
+	return 0;
+}
+
+static void sweep_param_free(struct sweep_param *param)
+{
+	int i;
+
+	for (i = 0; i < param->nrvalues; i++)
+		free(param->values[i]);
+	free(param->values);
+	free(param->name);
+}
+
+static int sweep_expand(struct sweep_param *param, const char *range)
+{
+	double start, end, step = 1;
+	char op = '+', buffer[64];
+	char *dup, *token, *saveptr;
+	int nr, ret = 0;
+
+	nr = sscanf(range, "%lf:%lf:%c%lf", &start, &end, &op, &step);
+	if (nr >= 2) {
+
+		/* A multiplied start below or at 0 never reaches the end */
+		if (nr == 3 || (op != '+' && op != '*') ||
+		    (op == '+' && step <= 0) ||
+		    (op == '*' && (step <= 1 || start <= 0))) {
+			ERROR("Invalid step in range '%s'\n", range);
+			return -1;
+		}
+
+		for (; start <= end; start = op == '+' ? start + step : start * step) {
+			snprintf(buffer, sizeof(buffer), "%.15g", start);
+			if (sweep_add_value(param, buffer))
+				return -1;
+		}
+
+		return 0;
+	}
+
+	dup = strdup(range);
+	if (!dup)
+		FATAL("Failed to allocate memory for range\n");
+
+	for (token = strtok_r(dup, ",", &saveptr); token;
+	     token = strtok_r(NULL, ",", &saveptr)) {
+		ret = sweep_add_value(param, token);
+		if (ret)
+			break;
+	}
+
+	free(dup);
+
+	return ret;
+}
+
+/*
+ * Look for the range of the parameter in the sweep description,
+ * returns a string to be freed or NULL if not found
+ */
+static char *sweep_override(struct sweep *sweep, const char *name)
+{
+	char *dup, *token, *saveptr, *range = NULL;
+
+	if (!sweep->desc)
+		return NULL;
+
+	dup = strdup(sweep->desc);
+	if (!dup)
+		FATAL("Failed to allocate memory for sweep description\n");
+
+	for (token = strtok_r(dup, ";", &saveptr); token;
+	     token = strtok_r(NULL, ";", &saveptr)) {
+
+		char *value, *param = token, *colon;
+
+		value = strchr(token, '=');
+		if (!value)
+			continue;
+
+		*value++ = '\0';
+
+		colon = strchr(token, ':');
+		if (colon) {
+			*colon = '\0';
+			if (strcmp(token, sweep->bench))
+				continue;
+			param = colon + 1;
+		}
+
+		if (!strcmp(param, name)) {
+			free(range);
+			range = strdup(value);
+		}
+	}
+
+	free(dup);
+
+	return range;
+}
+
+int sweep_add(struct sweep *sweep, const char *name, const char *range)
+{
+	struct sweep_param *params, *param;
+	char *override;
+	int ret;
+
+	params = realloc(sweep->params, sizeof(*params) * (sweep->nrparams + 1));
+	if (!params)
+		FATAL("Failed to allocate memory for sweep parameters\n");
+
+	sweep->params = params;
+	param = &params[sweep->nrparams];
+	memset(param, 0, sizeof(*param));
+	param->name = strdup(name);
+	if (!param->name)
+		FATAL("Failed to allocate memory for sweep parameter\n");
+
+	override = sweep_override(sweep, name);
+
+	ret = sweep_expand(param, override ? override : range);
+
+	free(override);
+
+	if (ret || !param->nrvalues) {
+		if (!ret)
+			ERROR("No value for parameter '%s'\n", name);
+		sweep_param_free(param);
+		return -1;
+	}
+
+	sweep->nrparams++;
+
+	return 0;
+}
+
+/*
+ * Move to the next combination of values, returns zero when all of
+ * them have been done
+ */
+int sweep_next(struct sweep *sweep)
+{
+	int i;
+
+	for (i = sweep->nrparams - 1; i >= 0; i--) {
+
+		struct sweep_param *param = &sweep->params[i];
+
+		if (++param->index < param->nrvalues)
+			return 1;
+
+		param->index = 0;
+	}
+
+	return 0;
+}
+
+int sweep_nrparams(struct sweep *sweep)
+{
+	return sweep->nrparams;
+}
+
+const char *sweep_name(struct sweep *sweep, int i)
+{
+	return sweep->params[i].name;
+}
+
+const char *sweep_value(struct sweep *sweep, const char *name)
+{
+	int i;
+
+	for (i = 0; i < sweep->nrparams; i++)
+		if (!strcmp(sweep->params[i].name, name))
+			return sweep->params[i].values[sweep->params[i].index];
+
+	return NULL;
+}
+
+/*
+ * The current values as "name1=value1,name2=value2", an empty string
+ * when there is no parameter
+ */
+const char *sweep_tag(struct sweep *sweep)
+{
+	char *tag = NULL, *tmp;
+	int i;
+
+	for (i = 0; i < sweep->nrparams; i++) {
+
+		struct sweep_param *param = &sweep->params[i];
+
+		tmp = tag;
+		if (asprintf(&tag, "%s%s%s=%s", tmp ? tmp : "", tmp ? "," : "",
+			     param->name, param->values[param->index]) < 0)
+			FATAL("Failed to allocate memory for sweep tag\n");
+		free(tmp);
+	}
+
+	free(sweep->tag);
+	sweep->tag = tag ? tag : strdup("");
+
+	return sweep->tag;
+}
+
+void sweep_free(struct sweep *sweep)
+{
+	int i;
+
+	if (!sweep)
+		return;
+
+	for (i = 0; i < sweep->nrparams; i++)
+		sweep_param_free(&sweep->params[i]);
+
+	free(sweep->params);
+	free(sweep->bench);
+	free(sweep->desc);
+	free(sweep->tag);
+	free(sweep);
+}
@@ -0,0 +1,22 @@
+#ifndef __TS_SWEEP_H
+#define __TS_SWEEP_H
+
+struct sweep;
+
+extern struct sweep *sweep_alloc(const char *bench, const char *desc);
+
+extern int sweep_add(struct sweep *sweep, const char *name, const char *range);
+
+extern int sweep_next(struct sweep *sweep);
+
+extern int sweep_nrparams(struct sweep *sweep);
+
+extern const char *sweep_name(struct sweep *sweep, int i);
+
+extern const char *sweep_value(struct sweep *sweep, const char *name);
+
+extern const char *sweep_tag(struct sweep *sweep);
+
+extern void sweep_free(struct sweep *sweep);
+
+#endif
@@ -0,0 +1,322 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "energy.h"
+#include "thermal.h"
+#include "timeline.h"
+
+/*
+ * Thermal state of the system: the hottest thermal zone, and the
+ * throttling seen from the cpus thermal_throttle counters, on x86, and
+ * from the cpu cooling devices in use. The throttling is checked
+ * around the measurement windows, next to the energy, so the throttled
+ * runs can be flagged.
+ *
+ * Before a run, the harness can wait for the system to cool down to a
+ * target temperature, or to the temperature at the startup with
+ * "idle". Without thermal zones, "idle" waits for the power to come
+ * back to the calibrated idle power.
+ *
+ * The sysfs roots can be changed with the TS_THERMAL_ROOT and the
+ * TS_CPU_ROOT environment variables, "/sys/class/thermal" and
+ * "/sys/devices/system/cpu" by default, to use fake trees.
+ */
+#define THERMAL_ROOT     "/sys/class/thermal"
+#define THERMAL_CPU_ROOT "/sys/devices/system/cpu"
+#define THERMAL_MARGIN   1000 /* millidegrees above the idle temperature */
+#define THERMAL_POWER    1.05 /* ratio of the idle power */
+#define THERMAL_PERIOD   200  /* msecs between the cooldown checks */
+
+static const char *thermal_root;
+static const char *thermal_cpu_root;
+static int *thermal_zones;
+static int thermal_nrzones;
+static int *thermal_cooling;
+static int thermal_nrcooling;
+static int thermal_idle;      /* millidegrees at the startup */
+static uint64_t thermal_count; /* throttle events at the window begin */
+static int thermal_cooled;     /* cooling devices in use at the begin */
+static int thermal_last;       /* last window throttled */
+
+static long thermal_read_value(const char *fmt, const char *root, int id,
+			       const char *file)
+{
+	char *path;
+	long value = -1;
+	FILE *f;
+
+	if (asprintf(&path, fmt, root, id, file) < 0)
+		FATAL("Failed to allocate memory for the thermal path\n");
+
+	f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, "%ld", &value) != 1)
+			value = -1;
+		fclose(f);
+	}
+
+	free(path);
+
+	return value;
+}
+
+/*
+ * The hottest thermal zone in millidegrees
+ */
+static int thermal_temp(void)
+{
+	long temp, max = 0;
+	int i;
+
+	for (i = 0; i < thermal_nrzones; i++) {
+		temp = thermal_read_value("%s/thermal_zone%d/%s", thermal_root,
+					  thermal_zones[i], "temp");
+		if (temp > max)
+			max = temp;
+	}
+
+	return max;
+}
+
+/*
+ * The throttle events of the cpus since the boot
+ */
+static uint64_t thermal_throttle_count(void)
+{
+	uint64_t count = 0;
+	long value;
+	int cpu, nrcpus;
+
+	nrcpus = sysconf(_SC_NPROCESSORS_CONF);
+
+	for (cpu = 0; cpu < nrcpus; cpu++) {
+		value = thermal_read_value("%s/cpu%d/%s", thermal_cpu_root, cpu,
+					   "thermal_throttle/core_throttle_count");
+		if (value > 0)
+			count += value;
+
+		value = thermal_read_value("%s/cpu%d/%s", thermal_cpu_root, cpu,
+					   "thermal_throttle/package_throttle_count");
+		if (value > 0)
+			count += value;
+	}
+
+	return count;
+}
+
+/*
+ * Number of cpu cooling devices limiting the cpus
+ */
+static int thermal_cooling_count(void)
+{
+	int i, count = 0;
+
+	for (i = 0; i < thermal_nrcooling; i++)
+		if (thermal_read_value("%s/cooling_device%d/%s", thermal_root,
+				       thermal_cooling[i], "cur_state") > 0)
+			count++;
+
+	return count;
+}
+
+/*
+ * The cooling devices slowing down the cpus, not the fans
+ */
+static int thermal_cpu_cooling(int id)
+{
+	char *path, type[64] = "";
+	FILE *f;
+
+	if (asprintf(&path, "%s/cooling_device%d/type", thermal_root, id) < 0)
+		FATAL("Failed to allocate memory for the thermal path\n");
+
+	f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, "%63s", type) != 1)
+			type[0] = '\0';
+		fclose(f);
+	}
+
+	free(path);
+
+	return strcasestr(type, "processor") || strcasestr(type, "cpufreq") ||
+		strcasestr(type, "powerclamp");
+}
+
+static void thermal_add(int **ids, int *nr, int id)
+{
+	*ids = realloc(*ids, sizeof(**ids) * (*nr + 1));
+	if (!*ids)
+		FATAL("Failed to allocate memory for the thermal devices\n");
+
+	(*ids)[(*nr)++] = id;
+}
+
+int thermal_init(void)
+{
+	struct dirent *dirent;
+	DIR *dir;
+	int id;
+
+	timeline_begin("thermal_init", NULL);
+
+	thermal_root = getenv("TS_THERMAL_ROOT");
+	if (!thermal_root)
+		thermal_root = THERMAL_ROOT;
+
+	thermal_cpu_root = getenv("TS_CPU_ROOT");
+	if (!thermal_cpu_root)
+		thermal_cpu_root = THERMAL_CPU_ROOT;
+
+	dir = opendir(thermal_root);
+	if (dir) {
+		while ((dirent = readdir(dir))) {
+			if (sscanf(dirent->d_name, "thermal_zone%d", &id) == 1)
+				thermal_add(&thermal_zones, &thermal_nrzones, id);
+			else if (sscanf(dirent->d_name, "cooling_device%d", &id) == 1 &&
+				 thermal_cpu_cooling(id))
+				thermal_add(&thermal_cooling, &thermal_nrcooling, id);
+		}
+		closedir(dir);
+	}
+
+	thermal_idle = thermal_temp();
+
+	if (thermal_nrzones)
+		NOTICE("%d thermal zones, %.1lf C at idle\n", thermal_nrzones,
+		       thermal_idle / 1000.0);
+	else
+		DEBUG("No thermal zone in '%s'\n", thermal_root);
+
+	timeline_end("thermal_init");
+
+	return 0;
+}
+
+void thermal_begin(void)
+{
+	thermal_count = thermal_throttle_count();
+	thermal_cooled = thermal_cooling_count();
+}
+
+void thermal_end(void)
+{
+	thermal_last = thermal_throttle_count() > thermal_count ||
+		thermal_cooled || thermal_cooling_count();
+
+	if (thermal_nrzones)
+		DEBUG("%.1lf C at the end of the window%s\n", thermal_temp() / 1000.0,
+		      thermal_last ? ", throttled" : "");
+}
+
+int thermal_throttled(void)
+{
+	return thermal_last;
+}
+
+/*
+ * The average power for a period, in Watts
+ */
+static double thermal_power(struct energy *energy, unsigned int msecs)
+{
+	struct timespec ts = {
+		.tv_sec = msecs / 1000,
+		.tv_nsec = (msecs % 1000) * 1000000,
+	};
+	struct energy *before, *after;
+	double power = -1;
+
+	before = energy_clone(energy);
+	after = energy_clone(energy);
+
+	if (!energy_read(before)) {
+
+		while (nanosleep(&ts, &ts))
+			;
+
+		if (!energy_read(after)) {
+			energy_delta(before, after, after);
+			power = energy_cost(after) / (msecs * 1000.0);
+		}
+	}
+
+	energy_free(before);
+	energy_free(after);
+
+	return power;
+}
+
+/*
+ * Wait for the hottest zone to be below the target temperature in
+ * degrees, or "idle" for the temperature at the startup or the idle
+ * power, for at most timeout seconds
+ */
+int thermal_cooldown(struct energy *energy, const char *target,
+		     unsigned int timeout)
+{
+	struct timespec ts = { .tv_nsec = THERMAL_PERIOD * 1000000 };
+	int idle = !strcmp(target, "idle"), temp = 0;
+	double power = 0, idle_power = 0;
+	unsigned int waited;
+	int limit;
+
+	if (!timeout)
+		return 0;
+
+	limit = idle ? thermal_idle + THERMAL_MARGIN : atof(target) * 1000;
+
+	if (!thermal_nrzones) {
+		if (!idle || !energy || !energy->handle || !energy->baseline)
+			return 0;
+		idle_power = energy_cost(energy->baseline) * THERMAL_POWER;
+	}
+
+	timeline_begin("cooldown", NULL);
+
+	for (waited = 0; waited < timeout * 1000; waited += THERMAL_PERIOD) {
+
+		if (thermal_nrzones) {
+			temp = thermal_temp();
+			if (temp <= limit)
+				break;
+			nanosleep(&ts, NULL);
+		} else {
+			power = thermal_power(energy, THERMAL_PERIOD);
+			if (power <= idle_power)
+				break;
+		}
+	}
+
+	timeline_end("cooldown");
+
+	if (waited >= timeout * 1000) {
+		if (thermal_nrzones)
+			WARNING("Still %.1lf C after %u secs of cooldown\n",
+				temp / 1000.0, timeout);
+		else
+			WARNING("Still %.2lf W after %u secs of cooldown\n",
+				power, timeout);
+		return -1;
+	}
+
+	if (waited)
+		DEBUG("Cooled down in %u msecs\n", waited);
+
+	return 0;
+}
+
+void thermal_fini(void)
+{
+	free(thermal_zones);
+	free(thermal_cooling);
+
+	thermal_zones = thermal_cooling = NULL;
+	thermal_nrzones = thermal_nrcooling = 0;
+}
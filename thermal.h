@@ -0,0 +1,19 @@
+#ifndef __TS_THERMAL_H
+#define __TS_THERMAL_H
+
+struct energy;
+
+extern int thermal_init(void);
+
+extern void thermal_begin(void);
+
+extern void thermal_end(void);
+
+extern int thermal_throttled(void);
+
+extern int thermal_cooldown(struct energy *energy, const char *target,
+			    unsigned int timeout);
+
+extern void thermal_fini(void);
+
+#endif
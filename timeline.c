@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "energy.h"
+#include "topology.h"
+#include "timeline.h"
+
+/*
+ * Timeline of the harness phases and of the power, exported in the
+ * Chrome trace event JSON format which can be loaded in
+ * chrome://tracing or in Perfetto.
+ *
+ * The events are recorded in memory only when a timeline file was
+ * specified, otherwise the functions return immediately.
+ */
+struct timeline_event {
+	char ph;       /* 'B'egin, 'E'nd or 'C'ounter */
+	int tid;
+	uint64_t ts;   /* usecs */
+	const char *name;
+	char *args;    /* JSON object members, may be NULL */
+};
+
+static const char *timeline_path;
+static struct timeline_event *timeline_events;
+static int timeline_nrevents;
+static pthread_mutex_t timeline_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int timeline_init(const char *path)
+{
+	timeline_path = path;
+
+	return 0;
+}
+
+uint64_t timeline_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void timeline_add(char ph, uint64_t ts, const char *name, char *args)
+{
+	struct timeline_event *events;
+
+	pthread_mutex_lock(&timeline_lock);
+
+	events = realloc(timeline_events,
+			 sizeof(*events) * (timeline_nrevents + 1));
+	if (!events)
+		FATAL("Failed to allocate memory for the timeline\n");
+
+	events[timeline_nrevents].ph = ph;
+	events[timeline_nrevents].tid = syscall(SYS_gettid);
+	events[timeline_nrevents].ts = ts;
+	events[timeline_nrevents].name = name;
+	events[timeline_nrevents].args = args;
+	timeline_events = events;
+	timeline_nrevents++;
+
+	pthread_mutex_unlock(&timeline_lock);
+}
+
+/*
+ * Append the string to the JSON args, quoted and escaped
+ */
+static void timeline_put_string(FILE *f, const char *str)
+{
+	fputc('"', f);
+
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(f, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(f, "\\u%04x", *str);
+		else
+			fputc(*str, f);
+	}
+
+	fputc('"', f);
+}
+
+/*
+ * The name must be a persistent string, it is followed by the optional
+ * arguments as pairs of key and value strings ended by NULL, eg.
+ * timeline_begin("plugin", "path", path, NULL)
+ */
+void timeline_begin(const char *name, ...)
+{
+	const char *key, *value;
+	char *args = NULL;
+	size_t len;
+	va_list ap;
+	FILE *f;
+
+	if (!timeline_path)
+		return;
+
+	va_start(ap, name);
+
+	key = va_arg(ap, const char *);
+	if (key) {
+		f = open_memstream(&args, &len);
+		if (!f)
+			FATAL("Failed to allocate memory for the timeline\n");
+
+		for (; key; key = va_arg(ap, const char *)) {
+			value = va_arg(ap, const char *);
+			if (ftell(f))
+				fputs(", ", f);
+			timeline_put_string(f, key);
+			fputs(": ", f);
+			timeline_put_string(f, value ? value : "");
+		}
+
+		fclose(f);
+	}
+
+	va_end(ap);
+
+	timeline_add('B', timeline_now(), name, args);
+}
+
+void timeline_end(const char *name)
+{
+	if (!timeline_path)
+		return;
+
+	timeline_add('E', timeline_now(), name, NULL);
+}
+
+/*
+ * Add a counter sample with the energy of each supported domain
+ * multiplied by scale, eg. 1 / duration to get the power
+ */
+void timeline_energy(uint64_t ts, const char *name, struct energy *energy,
+		     double scale)
+{
+	char *args = NULL, *tmp;
+	int i, ret = 0;
+
+	if (!timeline_path || !energy || !energy->handle)
+		return;
+
+	for (i = 0; i < energy->topology->nrpackages && ret >= 0; i++) {
+		tmp = args;
+		ret = asprintf(&args, "%s%s\"pkg%d\": %lf", tmp ? tmp : "",
+			       tmp ? ", " : "", i, energy->pkg[i].pkg * scale);
+		free(tmp);
+	}
+
+	if (energy->flags & ENERGY_DRAM_SUPPORTED && ret >= 0) {
+		tmp = args;
+		ret = asprintf(&args, "%s, \"dram\": %lf", tmp,
+			       energy->sys.dram * scale);
+		free(tmp);
+	}
+
+	if (energy->flags & ENERGY_GPU_SUPPORTED && ret >= 0) {
+		tmp = args;
+		ret = asprintf(&args, "%s, \"gpu\": %lf", tmp,
+			       energy->sys.gpu * scale);
+		free(tmp);
+	}
+
+	if (energy->flags & ENERGY_BOARD_SUPPORTED && ret >= 0) {
+		tmp = args;
+		ret = asprintf(&args, "%s, \"board\": %lf", tmp,
+			       energy->sys.board * scale);
+		free(tmp);
+	}
+
+	if (ret < 0) {
+		ERROR("Failed to allocate timeline counter\n");
+		return;
+	}
+
+	timeline_add('C', ts, name, args);
+}
+
+int timeline_save(void)
+{
+	FILE *f;
+	int i;
+
+	if (!timeline_path)
+		return 0;
+
+	f = fopen(timeline_path, "w");
+	if (!f) {
+		ERROR("Failed to open timeline file '%s'\n", timeline_path);
+		return -1;
+	}
+
+	fprintf(f, "{\"traceEvents\": [\n");
+
+	for (i = 0; i < timeline_nrevents; i++) {
+
+		struct timeline_event *event = &timeline_events[i];
+
+		fprintf(f, "  {\"name\": ");
+		timeline_put_string(f, event->name);
+		fprintf(f, ", \"cat\": \"ts\", \"ph\": \"%c\", "
+			"\"ts\": %llu, \"pid\": %d, \"tid\": %d",
+			event->ph, (unsigned long long)event->ts,
+			getpid(), event->tid);
+
+		if (event->args)
+			fprintf(f, ", \"args\": {%s}", event->args);
+
+		fprintf(f, "}%s\n", i < timeline_nrevents - 1 ? "," : "");
+
+		free(event->args);
+	}
+
+	fprintf(f, "],\n\"displayTimeUnit\": \"ms\"}\n");
+
+	free(timeline_events);
+	timeline_events = NULL;
+	timeline_nrevents = 0;
+
+	if (fclose(f)) {
+		ERROR("Failed to write timeline file '%s'\n", timeline_path);
+		return -1;
+	}
+
+	NOTICE("Timeline saved in '%s'\n", timeline_path);
+
+	return 0;
+}
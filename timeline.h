@@ -0,0 +1,21 @@
+#ifndef __TS_TIMELINE_H
+#define __TS_TIMELINE_H
+
+#include <stdint.h>
+
+struct energy;
+
+extern int timeline_init(const char *path);
+
+extern uint64_t timeline_now(void);
+
+extern void timeline_begin(const char *name, ...);
+
+extern void timeline_end(const char *name);
+
+extern void timeline_energy(uint64_t ts, const char *name,
+			    struct energy *energy, double scale);
+
+extern int timeline_save(void);
+
+#endif
@@ -8,6 +8,7 @@
 
 #include "trace.h"
 #include "topology.h"
+#include "timeline.h"
 
 static int cpu_sysfs_read_id(int cpu, const char *file)
 {
@@ -228,11 +229,14 @@ struct topology *topology_init(void)
 	if (!topology)
 		return NULL;
 
+	timeline_begin("topology_init", NULL);
+
 	if (package_build(topology))
 		goto out_free;
 
 	topology_show(topology);
 out:
+	timeline_end("topology_init");
 	return topology;
 out_free:
 	free(topology);
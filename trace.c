@@ -1,13 +1,45 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "trace.h"
 
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
 
-static trace_level_t trace_level = TRACE;
+/*
+ * Per-thread ring buffer, single producer (the thread owning it) and
+ * single consumer (the drain, serialized by the trace lock). The head
+ * and the tail are free running counters. The rings are linked and
+ * unlinked under the trace lock, and freed when their thread exits.
+ *
+ * While the traces are held, the drain thread sleeps until they are
+ * released or a ring is filling up, so it does not wake up in the
+ * measurement windows.
+ */
+#define TRACE_RING_SLOTS  256
+#define TRACE_RING_FULL   (TRACE_RING_SLOTS * 3 / 4)
+#define TRACE_MSG_LEN     256
+#define TRACE_DRAIN_MSECS 10
+
+struct trace_record {
+	uint64_t timestamp;
+	char msg[TRACE_MSG_LEN];
+};
+
+struct trace_ring {
+	unsigned long head;
+	unsigned long tail;
+	unsigned long dropped;
+	struct trace_ring *next;
+	struct trace_record record[TRACE_RING_SLOTS];
+};
+
+trace_level_t trace_level = TRACE;
 static const char *trace_prefix;
 static const char *level2char[] = {
 	"TRACE",
@@ -19,6 +51,18 @@ static const char *level2char[] = {
 	"FATAL",
 };
 
+static int trace_async;
+static int trace_held;
+static int trace_stop;
+static int trace_full;
+static pthread_t trace_drainer;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trace_cond = PTHREAD_COND_INITIALIZER;
+static struct trace_ring *trace_rings;
+static __thread struct trace_ring *trace_ring;
+static pthread_key_t trace_ring_key;
+static pthread_once_t trace_ring_once = PTHREAD_ONCE_INIT;
+
 trace_level_t trace_char2level(const char *clvl)
 {
 	int i;
@@ -30,13 +74,264 @@ trace_level_t trace_char2level(const char *clvl)
 	return -1;
 }
 
+static void trace_drain(void);
+
+/*
+ * Write the last messages of the exiting thread and free its ring
+ */
+static void trace_ring_free(void *arg)
+{
+	struct trace_ring *ring = arg, **prev;
+
+	pthread_mutex_lock(&trace_lock);
+
+	trace_drain();
+
+	for (prev = &trace_rings; *prev; prev = &(*prev)->next) {
+		if (*prev == ring) {
+			*prev = ring->next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+
+	trace_ring = NULL;
+	free(ring);
+}
+
+static void trace_ring_key_create(void)
+{
+	pthread_key_create(&trace_ring_key, trace_ring_free);
+}
+
+static struct trace_ring *trace_ring_get(void)
+{
+	struct trace_ring *ring = trace_ring;
+
+	if (ring)
+		return ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	pthread_once(&trace_ring_once, trace_ring_key_create);
+	pthread_setspecific(trace_ring_key, ring);
+
+	pthread_mutex_lock(&trace_lock);
+	ring->next = trace_rings;
+	trace_rings = ring;
+	pthread_mutex_unlock(&trace_lock);
+
+	trace_ring = ring;
+
+	return ring;
+}
+
+static void trace_record(trace_level_t lvl, int header, char *fmt, va_list args)
+{
+	struct trace_ring *ring = trace_ring_get();
+	struct trace_record *record;
+	unsigned long head, tail;
+	struct timespec ts;
+	int len = 0;
+
+	if (!ring)
+		return;
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= TRACE_RING_SLOTS) {
+		__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	record = &ring->record[head % TRACE_RING_SLOTS];
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	record->timestamp = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	if (header && trace_prefix)
+		len = snprintf(record->msg, TRACE_MSG_LEN, "%s(%s): ",
+			       level2char[lvl], trace_prefix);
+	else if (header)
+		len = snprintf(record->msg, TRACE_MSG_LEN, "%s: ", level2char[lvl]);
+
+	if (len < TRACE_MSG_LEN)
+		len += vsnprintf(record->msg + len, TRACE_MSG_LEN - len, fmt, args);
+
+	/* A truncated message keeps its end of line */
+	if (len >= TRACE_MSG_LEN && fmt[strlen(fmt) - 1] == '\n')
+		record->msg[TRACE_MSG_LEN - 2] = '\n';
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	/* Wake up the drain before the ring drops messages */
+	if (head + 1 - tail == TRACE_RING_FULL) {
+		pthread_mutex_lock(&trace_lock);
+		trace_full = 1;
+		pthread_cond_signal(&trace_cond);
+		pthread_mutex_unlock(&trace_lock);
+	}
+}
+
+/*
+ * Write the pending records of all the rings ordered by their
+ * timestamp, the trace lock must be held
+ */
+static void trace_drain(void)
+{
+	struct trace_ring *ring, *oldest;
+	unsigned long dropped;
+
+	for (;;) {
+		oldest = NULL;
+
+		for (ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE);
+		     ring; ring = ring->next) {
+
+			unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+			if (head == ring->tail)
+				continue;
+
+			if (!oldest ||
+			    ring->record[ring->tail % TRACE_RING_SLOTS].timestamp <
+			    oldest->record[oldest->tail % TRACE_RING_SLOTS].timestamp)
+				oldest = ring;
+		}
+
+		if (!oldest)
+			break;
+
+		fputs(oldest->record[oldest->tail % TRACE_RING_SLOTS].msg, stdout);
+		__atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+	}
+
+	for (ring = trace_rings; ring; ring = ring->next) {
+		dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+		if (dropped)
+			printf("WARNING: %lu trace messages dropped\n", dropped);
+	}
+
+	fflush(stdout);
+}
+
+static void *trace_drain_thread(void *arg)
+{
+	struct timespec ts;
+
+	pthread_mutex_lock(&trace_lock);
+
+	while (!trace_stop) {
+
+		if (!trace_held || trace_full)
+			trace_drain();
+
+		trace_full = 0;
+
+		if (trace_held) {
+			pthread_cond_wait(&trace_cond, &trace_lock);
+			continue;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += TRACE_DRAIN_MSECS * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_nsec -= 1000000000;
+			ts.tv_sec++;
+		}
+
+		pthread_cond_timedwait(&trace_cond, &trace_lock, &ts);
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+
+	return NULL;
+}
+
+void trace_flush(void)
+{
+	if (!trace_async)
+		return;
+
+	pthread_mutex_lock(&trace_lock);
+	trace_drain();
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_hold(void)
+{
+	if (!trace_async)
+		return;
+
+	pthread_mutex_lock(&trace_lock);
+	trace_drain();
+	trace_held = 1;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_release(void)
+{
+	if (!trace_async)
+		return;
+
+	pthread_mutex_lock(&trace_lock);
+	trace_held = 0;
+	pthread_cond_signal(&trace_cond);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+int trace_async_start(void)
+{
+	if (trace_async)
+		return 0;
+
+	trace_stop = 0;
+
+	if (pthread_create(&trace_drainer, NULL, trace_drain_thread, NULL))
+		return -1;
+
+	trace_async = 1;
+
+	/* The FATAL traces are followed by an exit */
+	atexit(trace_flush);
+
+	return 0;
+}
+
+void trace_async_stop(void)
+{
+	if (!trace_async)
+		return;
+
+	pthread_mutex_lock(&trace_lock);
+	trace_stop = 1;
+	pthread_cond_signal(&trace_cond);
+	pthread_mutex_unlock(&trace_lock);
+
+	pthread_join(trace_drainer, NULL);
+
+	trace_flush();
+	trace_async = 0;
+}
+
 void trace(trace_level_t lvl, char *fmt, ...)
 {
 	va_list args;
-	
+
 	if (lvl < trace_level)
 		return;
 
+	if (trace_async) {
+		va_start(args, fmt);
+		trace_record(lvl, 1, fmt, args);
+		va_end(args);
+		return;
+	}
+
 	printf("%s", level2char[lvl]);
 
 	if (trace_prefix)
@@ -51,29 +346,36 @@ void trace(trace_level_t lvl, char *fmt, ...)
 
 int trace_set_level(trace_level_t lvl)
 {
-	if (lvl < TRACE && lvl > FATAL)
+	if (lvl < TRACE || lvl > FATAL)
 		return -1;
 
 	trace_level = lvl;
 	return 0;
 }
 
+/*
+ * The prefix of the messages, as the name of the running plugin, NULL
+ * for none
+ */
 void trace_set_prefix(const char *prefix)
 {
-	if (prefix)
-		trace_prefix = prefix;
+	trace_prefix = prefix;
 }
 
 void trace_raw(trace_level_t lvl, char *fmt, ...)
 {
 	va_list args;
-	
+
 	if (lvl < trace_level)
 		return;
 
 	va_start(args, fmt);
-	vprintf(fmt, args);
+	if (trace_async)
+		trace_record(lvl, 0, fmt, args);
+	else
+		vprintf(fmt, args);
 	va_end(args);
 
-	fflush(stdout);
+	if (!trace_async)
+		fflush(stdout);
 }
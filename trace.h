@@ -5,19 +5,39 @@
 
 typedef enum { TRACE = 0, DEBUG, NOTICE, WARNING, ERROR, CRITICAL, FATAL } trace_level_t;
 
+extern trace_level_t trace_level;
+
 extern void trace(trace_level_t lvl, char *fmt, ...);
 extern trace_level_t trace_char2level(const char *clvl);
 extern int trace_set_level(trace_level_t lvl);
 extern void trace_set_prefix(const char *prefix);
 extern void trace_raw(trace_level_t lvl, char *fmt, ...);
 
+/*
+ * Asynchronous tracing: the messages are formatted into per-thread
+ * ring buffers and written by a background thread. The measurement
+ * windows are enclosed by trace_hold() and trace_release(), the rings
+ * are drained before entering the window and not during it.
+ */
+extern int  trace_async_start(void);
+extern void trace_async_stop(void);
+extern void trace_flush(void);
+extern void trace_hold(void);
+extern void trace_release(void);
+
+/*
+ * The level is checked before calling trace(), so a disabled level
+ * costs only a branch and the arguments are not evaluated
+ */
+#define __trace(lvl, ...) do { if ((lvl) >= trace_level) trace(lvl, __VA_ARGS__); } while (0)
+
 #define FATAL(...)    do { trace(FATAL, __VA_ARGS__); exit(1); } while (0)
-#define CRITICAL(...) trace(CRITICAL, __VA_ARGS__)
-#define ERROR(...)    trace(ERROR, __VA_ARGS__)
-#define WARNING(...)  trace(WARNING, __VA_ARGS__)
-#define NOTICE(...)   trace(NOTICE, __VA_ARGS__)
-#define DEBUG(...)    trace(DEBUG, __VA_ARGS__)
-#define TRACE(...)    trace(TRACE, __VA_ARGS__)
+#define CRITICAL(...) __trace(CRITICAL, __VA_ARGS__)
+#define ERROR(...)    __trace(ERROR, __VA_ARGS__)
+#define WARNING(...)  __trace(WARNING, __VA_ARGS__)
+#define NOTICE(...)   __trace(NOTICE, __VA_ARGS__)
+#define DEBUG(...)    __trace(DEBUG, __VA_ARGS__)
+#define TRACE(...)    __trace(TRACE, __VA_ARGS__)
 
 
 #endif
@@ -1,6 +1,7 @@
 #define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/time.h>
+#include <stdlib.h>
 
 #include "trace.h"
 #include "energy.h"
@@ -9,6 +10,16 @@
 #include "results.h"
 #include "script.h"
 #include "topology.h"
+#include "baseline.h"
+#include "overhead.h"
+#include "timeline.h"
+#include "residency.h"
+#include "thermal.h"
+#include "noise.h"
+#include "cgroup.h"
+#include "daemon.h"
+#include "snapshot.h"
+#include "env.h"
 
 static int compare(struct ts_options *tso)
 {
@@ -24,11 +35,14 @@ static int compare(struct ts_options *tso)
 	tsr2 = results_load(tso->file2);
 	if (!tsr2) {
 		CRITICAL("Failed to load '%s' for comparison\n", tso->file2);
+		results_free(tsr1);
 		return 1;
 	}
 
 	if (results_compare(tsr1, tsr2)) {
 		ERROR("Failed to compare results\n");
+		results_free(tsr1);
+		results_free(tsr2);
 		return 1;
 	}
 
@@ -50,62 +64,172 @@ static int publish(struct ts_options *tso)
 
 	if (results_publish(tsr)) {
 		CRITICAL("Failed to publish results\n");
+		results_free(tsr);
 		return 1;
 	}
 
+	results_free(tsr);
+
 	return 0;
 }
 
-int run(struct ts_options *tso)
+static struct topology *topology;
+static struct energy *energy;
+
+/*
+ * The sensors read their settings from the environment, the command
+ * line options override it
+ */
+static void setup_sensor(const char *name, const char *value)
 {
-	struct ts_results *tsr;
-	struct topology *topology;
-	struct energy *energy;
-	int ret;
+	if (value && setenv(name, value, 1))
+		FATAL("Failed to set '%s': %m\n", name);
+}
 
-	tsr = results_alloc();
-	if (!tsr)
-		FATAL("Failed to allocated results array\na");
+/*
+ * Initialize what is kept between the runs, once per process or once
+ * for all the requests of the daemon
+ */
+static void setup(struct ts_options *tso)
+{
+	setup_sensor("TS_HWMON_ROOT", tso->hwmon_root);
+	setup_sensor("TS_HWMON_MAP", tso->hwmon_map);
+	setup_sensor("TS_HWMON_PERIOD", tso->hwmon_period);
 
-	topology = topology_init();
+	topology = snapshot_init(tso->rediscover, &energy);
 	if (!topology)
 		FATAL("Failed to initialize topology\n");
 
-	energy = energy_init(topology);
 	if (!energy)
 		WARNING("Failed to initialize energy\n");
 
+	if (residency_init(topology))
+		WARNING("Failed to initialize the idle and frequency residency\n");
+
+	if (thermal_init())
+		WARNING("Failed to initialize the thermal monitoring\n");
+
+	if (noise_init(tso->noise))
+		WARNING("Failed to initialize the system noise detection\n");
+
+	if (cgroup_init(topology, tso->cpuset, tso->memory_max))
+		FATAL("Failed to initialize the scripts cgroup\n");
+
+	timeline_begin("baseline_calibrate", NULL);
+	if (energy && baseline_calibrate(energy, tso->calibrate))
+		WARNING("Failed to calibrate the idle power\n");
+	timeline_end("baseline_calibrate");
+
+	timeline_begin("overhead_calibrate", NULL);
+	if (energy && overhead_calibrate(energy, tso->overhead))
+		WARNING("Failed to calibrate the harness overhead\n");
+	timeline_end("overhead_calibrate");
+}
+
+static void teardown(void)
+{
+	plugins_fini();
+	cgroup_fini();
+	thermal_fini();
+	residency_fini();
+	energy_fini(energy);
+	topology_fini(topology);
+
+	if (timeline_save())
+		ERROR("Failed to save the timeline\n");
+}
+
+static int bench(struct ts_options *tso)
+{
+	struct ts_results *tsr;
+	int ret;
+
+	tsr = results_alloc();
+	if (!tsr)
+		FATAL("Failed to allocated results array\na");
+
+	timeline_begin("scripts_run", NULL);
 	ret = scripts_run(tso, tsr, energy);
 	if (ret)
-		FATAL("Failed to run scripts\n");
+		ERROR("Failed to run scripts\n");
+	timeline_end("scripts_run");
+
+	timeline_begin("plugins_run", NULL);
+	if (!ret) {
+		ret = plugins_run(tso, tsr, energy);
+		if (ret)
+			ERROR("Failed to run plugins\n");
+	}
+	timeline_end("plugins_run");
 
-	ret = plugins_run(tso, tsr, energy);
-	if (ret)
-		FATAL("Failed to run plugins\n");
+	env_save(tsr, topology, energy);
+	baseline_save(tsr, energy);
+	overhead_save(tsr);
 
-	if (tso->save && results_save(tso->file, tsr))
+	if (!ret && tso->save && results_save(tso->file, tsr))
 		ERROR("Failed to save results\n");
 
-	if (results_publish(tsr))
+	if (!ret && results_publish(tsr))
 		ERROR("Failed to publish results\n");
 
 	results_free(tsr);
-	energy_fini(energy);
-	topology_fini(topology);
 
 	return ret ? 1 : 0;
 }
 
+/*
+ * A request of the command line or of a daemon client
+ */
+static int request(struct ts_options *tso)
+{
+	if (tso->compare)
+		return compare(tso);
+
+	if (tso->publish)
+		return publish(tso);
+
+	return bench(tso);
+}
+
+int run(struct ts_options *tso)
+{
+	int ret;
+
+	setup(tso);
+
+	ret = tso->daemon ? daemon_serve(tso->daemon, request) : bench(tso);
+
+	teardown();
+
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
 	struct ts_options tso;
 
-	if (ts_getoptions(argc, argv, &tso))
+	if (ts_getoptions(argc, argv, &tso)) {
+		ts_usage(stderr);
 		FATAL("Failed to parse options\n");
+	}
+
+	if (tso.help) {
+		ts_usage(stdout);
+		return 0;
+	}
+
+	if (tso.client)
+		return daemon_client(tso.client, argc, argv);
 
 	if (trace_set_level(tso.loglevel))
 		ERROR("Failed to set log level\n");
 
+	if (!tso.synctrace && trace_async_start())
+		ERROR("Failed to start asynchronous tracing\n");
+
+	if (timeline_init(tso.timeline))
+		ERROR("Failed to initialize the timeline\n");
+
 	if (tso.compare)
 		return compare(&tso);
 